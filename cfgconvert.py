@@ -0,0 +1,435 @@
+# Usage: python3 cfgconvert.py <Text CFG Filename> <Binary CFG Filename> [--program <Program>]
+# Converts a CFG in the text format (O:/S:/L: edges and @ directives) to the binary format read in place by the client.
+# The binary layout is described in src/cfgformat.h and must be kept in sync with it.
+import argparse
+import os
+import struct
+import sys
+
+CFG_FILE_MAGIC = b'DETCFG\0\0'
+CFG_FILE_VERSION = 1
+
+CFG_SECTION_SITES = 1
+CFG_SECTION_OFFSET_EDGES = 2
+CFG_SECTION_SYMBOL_EDGES = 3
+CFG_SECTION_STRINGS = 4
+CFG_SECTION_SITE_DIRECTORY = 5
+CFG_SECTION_FUNCTIONS = 6
+CFG_SECTION_SITE_LABELS = 7
+CFG_SECTION_TARGET_LABELS = 8
+CFG_SECTION_RETURN_SITES = 9
+CFG_SECTION_JUMP_TABLES = 10
+CFG_SECTION_MODULE_ID = 11
+
+CFG_SITE_DIRECTORY_SHIFT = 10
+
+CFG_DIRECTIVE_PREFIX = '@'
+CFG_FUNCTION_DIRECTIVE = '@func'
+CFG_LABEL_DIRECTIVE = '@label'
+CFG_RETURN_SITE_DIRECTIVE = '@retsite'
+CFG_JUMP_TABLE_DIRECTIVE = '@jumptable'
+CFG_MODULE_DIRECTIVE = '@module'
+CFG_LABEL_MAX = 0xffff
+CFG_FUNCTION_ATTRIBUTES = {
+    'leaf': 1 << 0,
+    'noarray': 1 << 1,
+    'noescape': 1 << 2,
+    'directonly': 1 << 3,
+}
+
+HEADER_FORMAT = '<8sII'
+SECTION_FORMAT = '<IIQQ'
+SITE_FORMAT = '<QIIII'
+OFFSET_EDGE_FORMAT = '<Q'
+SYMBOL_EDGE_FORMAT = '<II'
+DIRECTORY_ENTRY_FORMAT = '<I'
+FUNCTION_FORMAT = '<QII'
+SITE_LABEL_FORMAT = '<I'
+TARGET_LABEL_FORMAT = '<QII'
+RETURN_SITE_FORMAT = '<Q'
+JUMP_TABLE_FORMAT = '<QQII'
+MODULE_ID_FORMAT = '<QQII64s'
+
+CFG_BUILD_ID_MAX_SIZE = 64
+CFG_TEXT_HASH_SEED = 0xcbf29ce484222325
+CFG_TEXT_HASH_PRIME = 0x100000001b3
+HASH_MASK = 0xffffffffffffffff
+
+ELF_MAGIC = b'\x7fELF'
+ELF_CLASS_64 = 2
+ELF_DATA_LSB = 1
+ELF_HEADER_FORMAT = '<16sHHIQQQIHHHHHH'
+ELF_SEGMENT_FORMAT = '<IIQQQQQQ'
+ELF_NOTE_FORMAT = '<III'
+ELF_NOTE_GNU = b'GNU\0'
+PT_LOAD = 1
+PT_NOTE = 4
+PF_X = 1
+NT_GNU_BUILD_ID = 3
+
+
+class StringTable:
+    def __init__(self):
+        self.data = bytearray(b'\0')
+        self.offsets = {'': 0}
+
+    def add(self, string):
+        if string not in self.offsets:
+            self.offsets[string] = len(self.data)
+            self.data += string.encode('utf-8') + b'\0'
+
+        return self.offsets[string]
+
+
+class TextCfg:
+    def __init__(self):
+        # site offset -> (set of offsets, set of (library, name), label)
+        self.sites = {}
+        # start -> (size, attributes)
+        self.functions = {}
+        # target offset -> label
+        self.target_labels = {}
+        # offsets following call instructions
+        self.return_sites = set()
+        # site offset -> (table offset, entry count)
+        self.jump_tables = {}
+        # (text size, text hash, build-id bytes) of the module the CFG was exported from, or None
+        self.module_id = None
+
+
+def parse_text_cfg(text):
+    '''Parse the text format into a TextCfg, following the client loader.'''
+    cfg = TextCfg()
+    for line_number, line in enumerate(text.split('\n'), 1):
+        line = line.strip()
+        if not line:
+            continue
+
+        if line.startswith(CFG_DIRECTIVE_PREFIX):
+            parse_directive(line, line_number, cfg)
+            continue
+
+        parts = line.split(' ', 1)
+        if len(parts) != 2:
+            raise ValueError(f'line {line_number}: expected "<offset> <edges>"')
+
+        offset = int(parts[0], 16)
+        if offset in cfg.sites:
+            raise ValueError(f'line {line_number}: duplicate site {parts[0]}')
+
+        offset_edges = set()
+        symbol_edges = set()
+        label = 0
+        for edge in parts[1].split(','):
+            edge_type, _, value = edge.partition(':')
+            if not value:
+                raise ValueError(f'line {line_number}: invalid edge "{edge}"')
+
+            if edge_type == 'O':
+                offset_edges.add(int(value, 16))
+            elif edge_type == 'S':
+                library, separator, name = value.partition('::')
+                if not separator:
+                    library, name = '', value
+                symbol_edges.add((library, name))
+            elif edge_type == 'L':
+                label = parse_label(value, line_number)
+            else:
+                raise ValueError(f'line {line_number}: unknown edge type "{edge_type}"')
+
+        cfg.sites[offset] = (offset_edges, symbol_edges, label)
+
+    return cfg
+
+
+def parse_label(value, line_number):
+    label = int(value, 16)
+    if label <= 0 or label > CFG_LABEL_MAX:
+        raise ValueError(f'line {line_number}: label out of range "{value}"')
+
+    return label
+
+
+def parse_directive(line, line_number, cfg):
+    '''Parse a directive line. Unknown directives and attributes are skipped like the client does.'''
+    parts = line.split(' ')
+    if parts[0] == CFG_LABEL_DIRECTIVE:
+        if len(parts) != 3:
+            raise ValueError(f'line {line_number}: expected "{CFG_LABEL_DIRECTIVE} <target> <label>"')
+
+        offset = int(parts[1], 16)
+        if offset in cfg.target_labels:
+            raise ValueError(f'line {line_number}: duplicate target {parts[1]}')
+
+        cfg.target_labels[offset] = parse_label(parts[2], line_number)
+        return
+
+    if parts[0] == CFG_RETURN_SITE_DIRECTIVE:
+        if len(parts) != 2:
+            raise ValueError(f'line {line_number}: expected "{CFG_RETURN_SITE_DIRECTIVE} <offset>"')
+
+        cfg.return_sites.add(int(parts[1], 16))
+        return
+
+    if parts[0] == CFG_JUMP_TABLE_DIRECTIVE:
+        if len(parts) != 4:
+            raise ValueError(f'line {line_number}: expected "{CFG_JUMP_TABLE_DIRECTIVE} <site> <table> <entry count>"')
+
+        site = int(parts[1], 16)
+        entry_count = int(parts[3], 16)
+        if entry_count > 0xffffffff:
+            raise ValueError(f'line {line_number}: jump table too large')
+        if site in cfg.jump_tables:
+            raise ValueError(f'line {line_number}: duplicate jump table {parts[1]}')
+
+        cfg.jump_tables[site] = (int(parts[2], 16), entry_count)
+        return
+
+    if parts[0] == CFG_MODULE_DIRECTIVE:
+        if len(parts) not in (3, 4):
+            raise ValueError(f'line {line_number}: expected "{CFG_MODULE_DIRECTIVE} <text size> <text hash> [<build-id>]"')
+
+        build_id = bytes.fromhex(parts[3]) if len(parts) == 4 else b''
+        if len(build_id) > CFG_BUILD_ID_MAX_SIZE:
+            raise ValueError(f'line {line_number}: build-id too long')
+
+        cfg.module_id = (int(parts[1], 16), int(parts[2], 16), build_id)
+        return
+
+    if parts[0] != CFG_FUNCTION_DIRECTIVE:
+        return
+
+    if len(parts) != 4:
+        raise ValueError(f'line {line_number}: expected "{CFG_FUNCTION_DIRECTIVE} <start> <size> <attributes>"')
+
+    start = int(parts[1], 16)
+    size = int(parts[2], 16)
+    if size > 0xffffffff:
+        raise ValueError(f'line {line_number}: function too large')
+    if start in cfg.functions:
+        raise ValueError(f'line {line_number}: duplicate function {parts[1]}')
+
+    attributes = 0
+    for attribute in parts[3].split(','):
+        attributes |= CFG_FUNCTION_ATTRIBUTES.get(attribute, 0)
+
+    cfg.functions[start] = (size, attributes)
+
+
+def build_binary_cfg(cfg):
+    strings = StringTable()
+    sites = bytearray()
+    offset_edges = bytearray()
+    symbol_edges = bytearray()
+
+    offset_edge_count = 0
+    symbol_edge_count = 0
+    for offset in sorted(cfg.sites):
+        site_offset_edges, site_symbol_edges, _ = cfg.sites[offset]
+
+        sites += struct.pack(SITE_FORMAT, offset, offset_edge_count, len(site_offset_edges), symbol_edge_count, len(site_symbol_edges))
+
+        for edge in sorted(site_offset_edges):
+            offset_edges += struct.pack(OFFSET_EDGE_FORMAT, edge)
+        offset_edge_count += len(site_offset_edges)
+
+        for library, name in sorted(site_symbol_edges):
+            symbol_edges += struct.pack(SYMBOL_EDGE_FORMAT, strings.add(name), strings.add(library))
+        symbol_edge_count += len(site_symbol_edges)
+
+    directory = build_site_directory(sorted(cfg.sites))
+
+    sections = [
+        (CFG_SECTION_SITES, struct.calcsize(SITE_FORMAT), len(cfg.sites), sites),
+        (CFG_SECTION_SITE_DIRECTORY, struct.calcsize(DIRECTORY_ENTRY_FORMAT), len(directory), b''.join(struct.pack(DIRECTORY_ENTRY_FORMAT, entry) for entry in directory)),
+        (CFG_SECTION_OFFSET_EDGES, struct.calcsize(OFFSET_EDGE_FORMAT), offset_edge_count, offset_edges),
+        (CFG_SECTION_SYMBOL_EDGES, struct.calcsize(SYMBOL_EDGE_FORMAT), symbol_edge_count, symbol_edges),
+        (CFG_SECTION_STRINGS, 1, len(strings.data), strings.data),
+    ]
+
+    # Only written when present, so CFGs without them stay the same as before
+    if cfg.functions:
+        data = b''.join(struct.pack(FUNCTION_FORMAT, start, *cfg.functions[start]) for start in sorted(cfg.functions))
+        sections.append((CFG_SECTION_FUNCTIONS, struct.calcsize(FUNCTION_FORMAT), len(cfg.functions), data))
+
+    if cfg.target_labels or any(site[2] for site in cfg.sites.values()):
+        data = b''.join(struct.pack(SITE_LABEL_FORMAT, cfg.sites[offset][2]) for offset in sorted(cfg.sites))
+        sections.append((CFG_SECTION_SITE_LABELS, struct.calcsize(SITE_LABEL_FORMAT), len(cfg.sites), data))
+
+        data = b''.join(struct.pack(TARGET_LABEL_FORMAT, offset, cfg.target_labels[offset], 0) for offset in sorted(cfg.target_labels))
+        sections.append((CFG_SECTION_TARGET_LABELS, struct.calcsize(TARGET_LABEL_FORMAT), len(cfg.target_labels), data))
+
+    if cfg.return_sites:
+        data = b''.join(struct.pack(RETURN_SITE_FORMAT, offset) for offset in sorted(cfg.return_sites))
+        sections.append((CFG_SECTION_RETURN_SITES, struct.calcsize(RETURN_SITE_FORMAT), len(cfg.return_sites), data))
+
+    if cfg.jump_tables:
+        data = b''.join(struct.pack(JUMP_TABLE_FORMAT, site, *cfg.jump_tables[site], 0) for site in sorted(cfg.jump_tables))
+        sections.append((CFG_SECTION_JUMP_TABLES, struct.calcsize(JUMP_TABLE_FORMAT), len(cfg.jump_tables), data))
+
+    if cfg.module_id is not None:
+        text_size, text_hash, build_id = cfg.module_id
+        data = struct.pack(MODULE_ID_FORMAT, text_size, text_hash, len(build_id), 0, build_id)
+        sections.append((CFG_SECTION_MODULE_ID, struct.calcsize(MODULE_ID_FORMAT), 1, data))
+
+    return pack_sections(sections)
+
+
+def build_site_directory(site_offsets):
+    '''Entry k is the index of the first site with offset >> CFG_SITE_DIRECTORY_SHIFT >= k, the last entry is the site count.'''
+    if not site_offsets:
+        return [0]
+
+    directory = []
+    for index, offset in enumerate(site_offsets):
+        while len(directory) <= offset >> CFG_SITE_DIRECTORY_SHIFT:
+            directory.append(index)
+
+    directory.append(len(site_offsets))
+
+    return directory
+
+
+def pack_sections(sections):
+    '''Lay out (type, entry size, count, data) sections after the header and section table, each 8-byte aligned.'''
+    header_size = struct.calcsize(HEADER_FORMAT) + len(sections) * struct.calcsize(SECTION_FORMAT)
+
+    table = bytearray()
+    body = bytearray()
+    position = align(header_size)
+    for section_type, entry_size, count, data in sections:
+        table += struct.pack(SECTION_FORMAT, section_type, entry_size, position, count)
+        body += data + bytes(align(len(data)) - len(data))
+        position += align(len(data))
+
+    output = bytearray(struct.pack(HEADER_FORMAT, CFG_FILE_MAGIC, CFG_FILE_VERSION, len(sections)))
+    output += table
+    output += bytes(align(header_size) - header_size)
+    output += body
+
+    return bytes(output)
+
+
+def align(size):
+    return (size + 7) & ~7
+
+
+def hash_text(text_hash, data):
+    '''Continue the text hash over a buffer, following ModuleId::hashText.'''
+    word_count = len(data) // 8
+    for (word,) in struct.iter_unpack('<Q', data[:word_count * 8]):
+        text_hash = ((text_hash ^ word) * CFG_TEXT_HASH_PRIME) & HASH_MASK
+        text_hash ^= text_hash >> 32
+
+    for value in data[word_count * 8:]:
+        text_hash = ((text_hash ^ value) * CFG_TEXT_HASH_PRIME) & HASH_MASK
+        text_hash ^= text_hash >> 32
+
+    return text_hash
+
+
+def read_module_id(program_filename):
+    '''Read the identity the client checks a CFG against, (text size, text hash, build-id bytes), or None if the
+    program is not an x86-64 ELF file with executable segments.'''
+    with open(program_filename, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != ELF_MAGIC or data[4] != ELF_CLASS_64 or data[5] != ELF_DATA_LSB:
+        return None
+
+    header = struct.unpack_from(ELF_HEADER_FORMAT, data)
+    phoff, phentsize, phnum = header[5], header[9], header[10]
+
+    text_size = 0
+    text_hash = CFG_TEXT_HASH_SEED
+    build_id = b''
+    for i in range(phnum):
+        p_type, p_flags, p_offset, _, _, p_filesz, _, p_align = struct.unpack_from(ELF_SEGMENT_FORMAT, data, phoff + i * phentsize)
+        segment = data[p_offset:p_offset + p_filesz]
+
+        if p_type == PT_LOAD and p_flags & PF_X:
+            text_hash = hash_text(text_hash, segment)
+            text_size += p_filesz
+        elif p_type == PT_NOTE and not build_id:
+            build_id = find_build_id(segment, 8 if p_align == 8 else 4)
+
+    if text_size == 0:
+        return None
+
+    # Kept out of the CFG like the client does, only the text hash is checked then
+    if len(build_id) > CFG_BUILD_ID_MAX_SIZE:
+        build_id = b''
+
+    return (text_size, text_hash, build_id)
+
+
+def find_build_id(notes, alignment):
+    position = 0
+    while position + struct.calcsize(ELF_NOTE_FORMAT) <= len(notes):
+        namesz, descsz, note_type = struct.unpack_from(ELF_NOTE_FORMAT, notes, position)
+        name_offset = position + struct.calcsize(ELF_NOTE_FORMAT)
+        desc_offset = name_offset + align_to(namesz, alignment)
+        end = desc_offset + align_to(descsz, alignment)
+        if end > len(notes):
+            break
+
+        if note_type == NT_GNU_BUILD_ID and notes[name_offset:name_offset + namesz] == ELF_NOTE_GNU:
+            return notes[desc_offset:desc_offset + descsz]
+
+        position = end
+
+    return b''
+
+
+def align_to(size, alignment):
+    return (size + alignment - 1) & ~(alignment - 1)
+
+
+def format_module_directive(module_id):
+    text_size, text_hash, build_id = module_id
+    directive = f'{CFG_MODULE_DIRECTIVE} {text_size:#x} {text_hash:#x}'
+    if build_id:
+        directive += ' ' + build_id.hex()
+
+    return directive
+
+
+def convert_file(input_filename, output_filename, program_filename=None):
+    with open(input_filename, 'r') as file:
+        cfg = parse_text_cfg(file.read())
+
+    if program_filename is not None:
+        cfg.module_id = read_module_id(program_filename)
+
+    with open(output_filename, 'wb') as file:
+        file.write(build_binary_cfg(cfg))
+
+    return cfg
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('input_filename')
+    parser.add_argument('output_filename')
+    parser.add_argument('--program', help='record the build-id and text hash of the program the CFG was exported from')
+
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.input_filename):
+        print(f'Input file does not exist - "{args.input_filename}"')
+        sys.exit(1)
+
+    if args.program is not None and not os.path.isfile(args.program):
+        print(f'Program file does not exist - "{args.program}"')
+        sys.exit(1)
+
+    try:
+        cfg = convert_file(args.input_filename, args.output_filename, args.program)
+    except ValueError as e:
+        print(f'Invalid CFG file - {e}')
+        sys.exit(1)
+
+    print(f'Converted {len(cfg.sites)} sites to "{args.output_filename}"')
+
+if __name__ == '__main__':
+    main()
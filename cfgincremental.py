@@ -0,0 +1,410 @@
+# Usage: python3 cfgincremental.py split <Program> <Text CFG Filename> <Fragment Folder>
+#        python3 cfgincremental.py merge <Program> <Fragment Folder> <Output Filename> [--binary]
+# Keeps the CFG of a program as per-function fragments keyed by a hash of the function bytes, so a new build only has
+# to export the functions whose bytes changed. The executable segments are split into pieces, one per function symbol
+# and one per gap between them, so every site belongs to exactly one piece. Fragment offsets are relative to the start
+# of their piece and are rebased to wherever an identical piece lies in the new build. Sites whose edges are computed
+# from data outside their piece (function pointers, GOT slots) are exported again on every build, since the bytes of
+# the piece cannot vouch for that data.
+import argparse
+import bisect
+import hashlib
+import json
+import os
+import struct
+import sys
+import tempfile
+
+import cfgconvert
+
+ELF_MAGIC = b'\x7fELF'
+ELF_CLASS_32 = 1
+ELF_CLASS_64 = 2
+ELF_DATA_LSB = 1
+PT_LOAD = 1
+PF_X = 1
+SHT_SYMTAB = 2
+SHT_DYNSYM = 11
+STT_FUNC = 2
+SHN_UNDEF = 0
+PAGE_SIZE = 0x1000
+
+GAP_SUFFIX = '$gap'
+FRAGMENT_EXTENSION = '.json'
+# Fragments of another version are treated as missing
+FRAGMENT_VERSION = 2
+
+# Set by functions called from anywhere in the program, which the bytes of the function alone cannot vouch for
+FRAGMENT_DROPPED_ATTRIBUTES = cfgconvert.CFG_FUNCTION_ATTRIBUTES['directonly']
+
+ELF_FORMATS = {
+    # class -> (header, program header, section header, symbol)
+    ELF_CLASS_32: ('<16sHHIIIIIHHHHHH', '<IIIIIIII', '<IIIIIIIIII', '<IIIBBH'),
+    ELF_CLASS_64: ('<16sHHIQQQIHHHHHH', '<IIQQQQQQ', '<IIQQQQIIQQ', '<IBBHQQ'),
+}
+
+
+class Piece:
+    def __init__(self, name, start, size, key):
+        self.name = name
+        # offset from the start of the module, as in the CFG
+        self.start = start
+        self.size = size
+        # hash of the bytes, names the fragment
+        self.key = key
+
+
+def read_pieces(program_filename):
+    '''Split the executable segments of an ELF file into pieces, sorted by start.'''
+    with open(program_filename, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != ELF_MAGIC or data[5] != ELF_DATA_LSB or data[4] not in ELF_FORMATS:
+        raise ValueError(f'not a little endian ELF file - "{program_filename}"')
+
+    header_format, segment_format, section_format, symbol_format = ELF_FORMATS[data[4]]
+    header = struct.unpack_from(header_format, data)
+    phoff, shoff = header[5], header[6]
+    phentsize, phnum, shentsize, shnum = header[9], header[10], header[11], header[12]
+
+    segments = []
+    for i in range(phnum):
+        segment = struct.unpack_from(segment_format, data, phoff + i * phentsize)
+        if data[4] == ELF_CLASS_64:
+            p_type, p_flags, p_offset, p_vaddr, _, p_filesz, _, _ = segment
+        else:
+            p_type, p_offset, p_vaddr, _, p_filesz, _, p_flags, _ = segment
+        if p_type == PT_LOAD:
+            segments.append((p_vaddr, p_filesz, p_offset, p_flags))
+
+    if not segments:
+        raise ValueError(f'no loadable segments - "{program_filename}"')
+
+    # The client and the export take offsets from the start of the first mapped page
+    base = min(segment[0] for segment in segments) & ~(PAGE_SIZE - 1)
+
+    def read_bytes(vaddr, size):
+        for p_vaddr, p_filesz, p_offset, _ in segments:
+            if p_vaddr <= vaddr and vaddr + size <= p_vaddr + p_filesz:
+                start = p_offset + vaddr - p_vaddr
+                return data[start:start + size]
+        return None
+
+    symbols = {}
+    sections = [struct.unpack_from(section_format, data, shoff + i * shentsize) for i in range(shnum)]
+    # The full symbol table if the file is not stripped, otherwise the exported functions only
+    for symbol_table_type in (SHT_SYMTAB, SHT_DYNSYM):
+        for section in sections:
+            if section[1] != symbol_table_type:
+                continue
+
+            sh_offset, sh_size, sh_link, sh_entsize = section[4], section[5], section[6], section[9]
+            strings_offset = sections[sh_link][4]
+            for i in range(sh_size // sh_entsize):
+                symbol = struct.unpack_from(symbol_format, data, sh_offset + i * sh_entsize)
+                if data[4] == ELF_CLASS_64:
+                    st_name, st_info, _, st_shndx, st_value, st_size = symbol
+                else:
+                    st_name, st_value, st_size, st_info, _, st_shndx = symbol
+                if st_info & 0xf != STT_FUNC or st_shndx == SHN_UNDEF or st_size == 0:
+                    continue
+
+                name_end = data.index(b'\0', strings_offset + st_name)
+                name = data[strings_offset + st_name:name_end].decode('utf-8', 'replace')
+                # Aliases share a piece, the first name in order is kept so the choice is stable across builds
+                if st_value not in symbols or (name, st_size) < symbols[st_value]:
+                    symbols[st_value] = (name, st_size)
+
+        if symbols:
+            break
+
+    pieces = []
+    for p_vaddr, p_filesz, _, p_flags in sorted(segments):
+        if not p_flags & PF_X:
+            continue
+
+        position = p_vaddr
+        previous_name = ''
+        segment_end = p_vaddr + p_filesz
+        for vaddr in sorted(value for value in symbols if p_vaddr <= value < segment_end):
+            name, size = symbols[vaddr]
+            if vaddr < position or vaddr + size > segment_end:
+                # Overlaps the previous function, its sites are left to the piece already covering them
+                continue
+
+            if vaddr > position:
+                pieces.append(make_piece(previous_name + GAP_SUFFIX, position - base, read_bytes(position, vaddr - position)))
+
+            pieces.append(make_piece(name, vaddr - base, read_bytes(vaddr, size)))
+            position = vaddr + size
+            previous_name = name
+
+        if segment_end > position:
+            pieces.append(make_piece(previous_name + GAP_SUFFIX, position - base, read_bytes(position, segment_end - position)))
+
+    # Names must resolve to one piece, repeated names (eg. local symbols of different files) are numbered
+    counts = {}
+    for piece in pieces:
+        count = counts.get(piece.name, 0)
+        counts[piece.name] = count + 1
+        if count > 0:
+            piece.name += f'${count}'
+
+    return pieces
+
+
+def make_piece(name, start, data):
+    return Piece(name, start, len(data), hashlib.sha256(data).hexdigest())
+
+
+def find_piece(pieces, starts, offset):
+    i = bisect.bisect_right(starts, offset) - 1
+    if i >= 0 and offset < pieces[i].start + pieces[i].size:
+        return pieces[i]
+
+    return None
+
+
+def split(cfg, pieces, store_dir, exported=None):
+    '''Write a fragment for each piece of a text CFG. Returns the pieces a fragment could not be written for.
+
+    If exported is given, the CFG only covers those pieces (see ExportCFG.py -ranges), and their fragments replace the
+    stored ones. Otherwise, fragments already stored are kept.
+    '''
+    if cfg.target_labels or any(site[2] != 0 for site in cfg.sites.values()):
+        raise ValueError('CFGs with labels cannot be split, the labels depend on the whole program')
+
+    starts = [piece.start for piece in pieces]
+    fragments = {piece.key: {'version': FRAGMENT_VERSION, 'size': piece.size, 'sites': [], 'functions': [], 'return_sites': [],
+                             'jump_tables': []} for piece in pieces}
+    unsplit = set()
+
+    # Pieces with the same bytes share a fragment, it is taken from the first of them
+    canonical = {}
+    for piece in pieces:
+        canonical.setdefault(piece.key, piece)
+
+    def find_canonical_piece(offset):
+        piece = find_piece(pieces, starts, offset)
+        return piece if piece is not None and canonical[piece.key] is piece else None
+
+    for offset, (offsets, symbols, _) in sorted(cfg.sites.items()):
+        piece = find_piece(pieces, starts, offset)
+        if piece is None:
+            raise ValueError(f'site {offset:#x} is outside the executable segments')
+        if canonical[piece.key] is not piece:
+            continue
+
+        targets = []
+        for target in sorted(offsets):
+            target_piece = find_piece(pieces, starts, target)
+            if target_piece is None:
+                # Targets outside the code cannot be rebased
+                unsplit.add(piece.key)
+                break
+            # Repeated names are numbered in file order, the key tells whether the name still refers to the same piece
+            if target_piece is piece:
+                targets.append(['', None, target - target_piece.start])
+            else:
+                targets.append([target_piece.name, target_piece.key, target - target_piece.start])
+
+        symbol_edges = sorted(library + '::' + name if library else name for library, name in symbols)
+        fragments[piece.key]['sites'].append([offset - piece.start, targets, symbol_edges])
+
+    for start, (size, attributes) in sorted(cfg.functions.items()):
+        piece = find_canonical_piece(start)
+        if piece is not None and start + size <= piece.start + piece.size:
+            fragments[piece.key]['functions'].append([start - piece.start, size, attributes])
+
+    for offset in sorted(cfg.return_sites):
+        piece = find_canonical_piece(offset)
+        if piece is not None:
+            fragments[piece.key]['return_sites'].append(offset - piece.start)
+
+    for site, (table, entry_count) in sorted(cfg.jump_tables.items()):
+        piece = find_canonical_piece(site)
+        if piece is not None:
+            # A table found relative to the code moves with the piece, otherwise the rebased address no longer matches
+            # the jump and the client falls back to the case bitmap
+            fragments[piece.key]['jump_tables'].append([site - piece.start, table - piece.start if table != 0 else None, entry_count])
+
+    written = set(piece.key for piece in (exported if exported is not None else pieces))
+
+    os.makedirs(store_dir, exist_ok=True)
+    for key, fragment in fragments.items():
+        filename = os.path.join(store_dir, key + FRAGMENT_EXTENSION)
+        if key in unsplit or key not in written or (exported is None and os.path.exists(filename)):
+            continue
+
+        # Renamed into place, so concurrent or interrupted runs never leave a partial fragment
+        fd, temp_filename = tempfile.mkstemp(suffix=FRAGMENT_EXTENSION, dir=store_dir)
+        with os.fdopen(fd, 'w') as f:
+            json.dump(fragment, f, separators=(',', ':'))
+        os.replace(temp_filename, filename)
+
+    return [piece for piece in pieces if piece.key in unsplit and piece.key in written]
+
+
+def merge(pieces, store_dir):
+    '''Build a TextCfg from the stored fragments of the pieces. Returns it and the pieces that have to be exported.'''
+    fragments = {}
+    for piece in pieces:
+        filename = os.path.join(store_dir, piece.key + FRAGMENT_EXTENSION)
+        if piece.key not in fragments and os.path.exists(filename):
+            with open(filename, 'r') as f:
+                fragment = json.load(f)
+            if fragment.get('version') == FRAGMENT_VERSION:
+                fragments[piece.key] = fragment
+
+    by_name = {piece.name: piece for piece in pieces}
+    missing = set(piece.name for piece in pieces if piece.key not in fragments)
+
+    # Targets past the entry of a changed piece may not exist anymore, and a name whose key differs now refers to
+    # another piece (eg. local symbols of the same name in another order), so the pieces branching there are exported too
+    is_changed = True
+    while is_changed:
+        is_changed = False
+        for piece in pieces:
+            if piece.name in missing:
+                continue
+
+            for _, targets, _ in fragments[piece.key]['sites']:
+                if any(name and (name not in by_name or by_name[name].key != key or (name in missing and offset != 0))
+                       for name, key, offset in targets):
+                    missing.add(piece.name)
+                    is_changed = True
+                    break
+
+    # Only switch dispatch edges follow from the bytes of the piece, the edges of other sites are computed from data
+    # outside of it, eg. a function pointer table that gained an entry, so their pieces are exported again
+    for piece in pieces:
+        if piece.name in missing:
+            continue
+
+        fragment = fragments[piece.key]
+        jump_table_sites = set(site for site, _, _ in fragment['jump_tables'])
+        if any((targets or symbol_edges) and offset not in jump_table_sites for offset, targets, symbol_edges in fragment['sites']):
+            missing.add(piece.name)
+
+    cfg = cfgconvert.TextCfg()
+    for piece in pieces:
+        if piece.name in missing:
+            continue
+
+        fragment = fragments[piece.key]
+        for offset, targets, symbol_edges in fragment['sites']:
+            offset_edges = set((by_name[name].start if name else piece.start) + target for name, _, target in targets)
+            symbols = set()
+            for edge in symbol_edges:
+                library, separator, name = edge.partition('::')
+                symbols.add((library, name) if separator else ('', edge))
+            cfg.sites[piece.start + offset] = (offset_edges, symbols, 0)
+
+        for start, size, attributes in fragment['functions']:
+            cfg.functions[piece.start + start] = (size, attributes & ~FRAGMENT_DROPPED_ATTRIBUTES)
+
+        cfg.return_sites.update(piece.start + offset for offset in fragment['return_sites'])
+
+        for site, table, entry_count in fragment['jump_tables']:
+            cfg.jump_tables[piece.start + site] = (piece.start + table if table is not None else 0, entry_count)
+
+    return cfg, [piece for piece in pieces if piece.name in missing]
+
+
+def add_cfg(cfg, other):
+    '''Add the sites and directives of another TextCfg, eg. a partial export of the missing pieces.'''
+    cfg.sites.update(other.sites)
+    cfg.functions.update(other.functions)
+    cfg.return_sites.update(other.return_sites)
+    cfg.jump_tables.update(other.jump_tables)
+
+
+def format_text_cfg(cfg):
+    lines = []
+    for offset, (offsets, symbols, _) in sorted(cfg.sites.items()):
+        edges = ['O:' + hex(target) for target in sorted(offsets)]
+        edges += ['S:' + (library + '::' + name if library else name) for library, name in sorted(symbols)]
+        lines.append(hex(offset) + ' ' + ','.join(edges))
+
+    names = {value: name for name, value in cfgconvert.CFG_FUNCTION_ATTRIBUTES.items()}
+    for start, (size, attributes) in sorted(cfg.functions.items()):
+        attribute_names = [names[value] for value in sorted(names) if attributes & value]
+        if attribute_names:
+            lines.append(f'{cfgconvert.CFG_FUNCTION_DIRECTIVE} {start:#x} {size:#x} {",".join(attribute_names)}')
+
+    for offset in sorted(cfg.return_sites):
+        lines.append(f'{cfgconvert.CFG_RETURN_SITE_DIRECTIVE} {offset:#x}')
+
+    for site, (table, entry_count) in sorted(cfg.jump_tables.items()):
+        lines.append(f'{cfgconvert.CFG_JUMP_TABLE_DIRECTIVE} {site:#x} {table:#x} {entry_count:#x}')
+
+    if cfg.module_id is not None:
+        lines.append(cfgconvert.format_module_directive(cfg.module_id))
+
+    return ''.join(line + '\n' for line in lines)
+
+
+def write_cfg(cfg, output_filename, is_binary):
+    if is_binary:
+        with open(output_filename, 'wb') as file:
+            file.write(cfgconvert.build_binary_cfg(cfg))
+    else:
+        with open(output_filename, 'w') as file:
+            file.write(format_text_cfg(cfg))
+
+
+def write_ranges(pieces, filename):
+    '''Write the ranges of pieces for ExportCFG.py -ranges.'''
+    with open(filename, 'w') as file:
+        for piece in pieces:
+            file.write(f'{piece.start:#x} {piece.size:#x}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    split_parser = subparsers.add_parser('split', help='store the fragments of a text CFG')
+    split_parser.add_argument('program_filename')
+    split_parser.add_argument('cfg_filename')
+    split_parser.add_argument('store_dir')
+
+    merge_parser = subparsers.add_parser('merge', help='build a CFG from stored fragments')
+    merge_parser.add_argument('program_filename')
+    merge_parser.add_argument('store_dir')
+    merge_parser.add_argument('output_filename')
+    merge_parser.add_argument('-b', '--binary', action='store_true', help='write the CFG in the binary format')
+
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.program_filename):
+        print(f'Program file does not exist - "{args.program_filename}"')
+        sys.exit(1)
+
+    try:
+        pieces = read_pieces(args.program_filename)
+        if args.command == 'split':
+            with open(args.cfg_filename, 'r') as file:
+                cfg = cfgconvert.parse_text_cfg(file.read())
+            unsplit = split(cfg, pieces, args.store_dir)
+            print(f'Stored {len(pieces) - len(unsplit)} of {len(pieces)} pieces in "{args.store_dir}"')
+            return
+
+        cfg, missing = merge(pieces, args.store_dir)
+        cfg.module_id = cfgconvert.read_module_id(args.program_filename)
+    except ValueError as e:
+        print(f'Invalid input - {e}')
+        sys.exit(1)
+
+    if missing:
+        # Nothing is written, a CFG without the missing pieces would leave their sites unchecked
+        for piece in missing:
+            print(f'{piece.start:#x} {piece.size:#x} {piece.name}')
+        print(f'{len(missing)} of {len(pieces)} pieces have no fragment or have to be exported again')
+        sys.exit(2)
+
+    write_cfg(cfg, args.output_filename, args.binary)
+    print(f'Merged {len(pieces)} pieces to "{args.output_filename}"')
+
+if __name__ == '__main__':
+    main()
@@ -1,47 +1,49 @@
 # Usage: GHIDRA_INSTALL_DIR="<Ghidra Directory>" python3 ghidra_exportcfg.py ...
 import argparse
+import concurrent.futures
+import hashlib
 import os
 import sys
 import subprocess
 import tempfile
-import shutil 
+import shutil
+
+import cfgconvert
+import cfgincremental
 
 GHIDRA_SCRIPTS_DIR = './ghidra_scripts'
 SCRIPT_NAME = 'ExportCFG.py'
 
-def main():
-    ghidra_install_dir = os.getenv('GHIDRA_INSTALL_DIR')
-    if ghidra_install_dir is None:
-        print('GHIDRA_INSTALL_DIR environment variable not set')
-        sys.exit(1)
+CFG_FILE_EXTENSION = '.cfg'
+ELF_MAGIC = b'\x7fELF'
+CACHE_DIR_NAME = '.cache'
+HASH_CHUNK_SIZE = 1 << 20
 
-    parser = argparse.ArgumentParser()
-    parser.add_argument('program_filename')
-    parser.add_argument('output_filename')
 
-    args = parser.parse_args()
+def get_script_dir():
+    script_dir = GHIDRA_SCRIPTS_DIR
+    if not os.path.isabs(script_dir):
+        folder_name = os.path.dirname(os.path.abspath(__file__))
+        script_dir = os.path.abspath(os.path.join(folder_name, script_dir))
 
-    program_filename = os.path.abspath(args.program_filename)
-    if not os.path.isfile(program_filename):
-        print(f'Program file does not exist - "{program_filename}"')
-        sys.exit(1)
+    return script_dir
 
-    output_filename = args.output_filename
-    if os.path.exists(output_filename):
-        print(f'File or folder with the same name as output already exists - \"{output_filename}\"')
-        sys.exit(1)
 
+def export_cfg(ghidra_install_dir, program_filename, output_filename, is_binary, is_label_mode, quiet=False, ranges_filename=None):
+    """Run a headless Ghidra export of one program, optionally limited to some offset ranges. Returns False if Ghidra
+    wrote no CFG."""
     fd, path = tempfile.mkstemp()
     os.close(fd)
     os.remove(path)
 
     tempdir_path = tempfile.mkdtemp()
 
-    script_dir = GHIDRA_SCRIPTS_DIR
-    if not os.path.isabs(script_dir):
-        folder_name = os.path.dirname(os.path.abspath(__file__))
-        script_dir = os.path.abspath(os.path.join(folder_name, script_dir))
-    
+    # Ghidra writes the text format, convert it afterwards if needed
+    export_filename = output_filename
+    if is_binary:
+        fd, export_filename = tempfile.mkstemp(suffix=CFG_FILE_EXTENSION)
+        os.close(fd)
+
     args = [
         f'{os.path.expanduser(ghidra_install_dir)}/support/analyzeHeadless',
         tempdir_path,
@@ -53,16 +55,242 @@ def main():
         '-loader-loadSystemLibraries',
         'true',
         '-scriptPath',
-        script_dir,
+        get_script_dir(),
         '-postScript',
         SCRIPT_NAME,
-        output_filename,
+        export_filename,
         '-deleteProject'
     ]
+    if is_label_mode:
+        # Script arguments follow the script name
+        args.insert(args.index(export_filename) + 1, '-labels')
+    if ranges_filename is not None:
+        args[args.index(export_filename) + 1:args.index(export_filename) + 1] = ['-ranges', ranges_filename]
+
+    # Concurrent exports would interleave their logs
+    output = subprocess.DEVNULL if quiet else None
+    subprocess.run(args, stdout=output, stderr=output)
+
+    # A limited export may have no sites, the file is written either way
+    is_exported = os.path.exists(export_filename) and (os.path.getsize(export_filename) > 0 or ranges_filename is not None)
+    if is_exported and ranges_filename is None:
+        # The client refuses the CFG for any other build of the program
+        module_id = cfgconvert.read_module_id(program_filename)
+        if module_id is not None:
+            with open(export_filename, 'a') as file:
+                file.write(cfgconvert.format_module_directive(module_id) + '\n')
 
-    subprocess.run(args)
+    if export_filename != output_filename:
+        if is_exported:
+            cfgconvert.convert_file(export_filename, output_filename)
+        os.remove(export_filename)
 
     shutil.rmtree(tempdir_path)
 
+    return is_exported
+
+
+def hash_file(filename, digest):
+    with open(filename, 'rb') as f:
+        while True:
+            chunk = f.read(HASH_CHUNK_SIZE)
+            if not chunk:
+                break
+            digest.update(chunk)
+
+
+def get_cache_key(program_filename, is_binary, is_label_mode):
+    """Key of an exported CFG: the program content, the export options and the export scripts."""
+    digest = hashlib.sha256()
+    digest.update(b'binary' if is_binary else b'text')
+    digest.update(b'labels' if is_label_mode else b'edges')
+    hash_file(os.path.join(get_script_dir(), SCRIPT_NAME), digest)
+    hash_file(os.path.abspath(cfgconvert.__file__), digest)
+    hash_file(program_filename, digest)
+
+    return digest.hexdigest()
+
+
+def is_elf_file(filename):
+    try:
+        with open(filename, 'rb') as f:
+            return f.read(len(ELF_MAGIC)) == ELF_MAGIC
+    except OSError:
+        return False
+
+
+def find_programs(paths):
+    """Expand directories to the ELF files they contain."""
+    programs = []
+    for path in paths:
+        if os.path.isdir(path):
+            for root, _, filenames in os.walk(path):
+                for filename in sorted(filenames):
+                    filename = os.path.join(root, filename)
+                    if not os.path.islink(filename) and is_elf_file(filename):
+                        programs.append(os.path.abspath(filename))
+        else:
+            programs.append(os.path.abspath(path))
+
+    return programs
+
+
+def export_cached(ghidra_install_dir, program_filename, output_filename, cache_dir, is_binary, is_label_mode):
+    """Export one program unless a CFG of the same content is cached. Returns 'cached', 'exported' or 'failed'."""
+    cache_filename = os.path.join(cache_dir, get_cache_key(program_filename, is_binary, is_label_mode) + CFG_FILE_EXTENSION)
+    if os.path.exists(cache_filename):
+        shutil.copyfile(cache_filename, output_filename)
+        return 'cached'
+
+    fd, export_filename = tempfile.mkstemp(suffix=CFG_FILE_EXTENSION, dir=cache_dir)
+    os.close(fd)
+    os.remove(export_filename)
+
+    if not export_cfg(ghidra_install_dir, program_filename, export_filename, is_binary, is_label_mode, quiet=True):
+        if os.path.exists(export_filename):
+            os.remove(export_filename)
+        return 'failed'
+
+    # Renamed into place, so an interrupted export never leaves a partial CFG in the cache
+    os.replace(export_filename, cache_filename)
+    shutil.copyfile(cache_filename, output_filename)
+
+    return 'exported'
+
+
+def get_output_name(program_filename):
+    '''The client looks up <build-id>.cfg, then <module name>.cfg for programs without a build-id.'''
+    module_id = cfgconvert.read_module_id(program_filename)
+    if module_id is not None and module_id[2]:
+        return module_id[2].hex()
+
+    return os.path.basename(program_filename)
+
+
+def export_batch(ghidra_install_dir, paths, output_dir, cache_dir, jobs, is_binary, is_label_mode):
+    programs = find_programs(paths)
+
+    # Every program needs a distinct file name, copies of the same build share one
+    outputs = {}
+    for program_filename in programs:
+        if not os.path.isfile(program_filename):
+            print(f'Program file does not exist - "{program_filename}"')
+            sys.exit(1)
+
+        name = get_output_name(program_filename)
+        if name in outputs:
+            if name == os.path.basename(program_filename):
+                print(f'Programs with the same name - "{outputs[name]}" and "{program_filename}"')
+                sys.exit(1)
+
+            # Same build-id, the CFG of the first copy applies to every copy
+            print(f'[duplicate] {program_filename}')
+            continue
+        outputs[name] = program_filename
+
+    if cache_dir is None:
+        cache_dir = os.path.join(output_dir, CACHE_DIR_NAME)
+    os.makedirs(output_dir, exist_ok=True)
+    os.makedirs(cache_dir, exist_ok=True)
+
+    failed = 0
+    # Each export is a separate Ghidra process, threads only wait for them
+    with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as executor:
+        futures = {}
+        for name, program_filename in outputs.items():
+            output_filename = os.path.join(output_dir, name + CFG_FILE_EXTENSION)
+            future = executor.submit(export_cached, ghidra_install_dir, program_filename, output_filename, cache_dir, is_binary,
+                                     is_label_mode)
+            futures[future] = program_filename
+
+        for future in concurrent.futures.as_completed(futures):
+            result = future.result()
+            if result == 'failed':
+                failed += 1
+            print(f'[{result}] {futures[future]}')
+
+    print(f'{len(outputs) - failed} of {len(outputs)} CFGs written to "{output_dir}"')
+    if failed > 0:
+        sys.exit(1)
+
+
+def export_incremental(ghidra_install_dir, program_filename, output_filename, store_dir, is_binary):
+    """Build the CFG of a program from the fragments of its unchanged functions, and export only the other ones."""
+    pieces = cfgincremental.read_pieces(program_filename)
+    cfg, missing = cfgincremental.merge(pieces, store_dir)
+
+    if missing:
+        fd, ranges_filename = tempfile.mkstemp(suffix='.txt')
+        os.close(fd)
+        cfgincremental.write_ranges(missing, ranges_filename)
+
+        # Removed so that only a file written by Ghidra counts as an export
+        fd, export_filename = tempfile.mkstemp(suffix=CFG_FILE_EXTENSION)
+        os.close(fd)
+        os.remove(export_filename)
+
+        is_exported = export_cfg(ghidra_install_dir, program_filename, export_filename, False, False, ranges_filename=ranges_filename)
+        os.remove(ranges_filename)
+        if not is_exported:
+            print(f'Export failed - "{program_filename}"')
+            sys.exit(1)
+
+        with open(export_filename, 'r') as file:
+            partial_cfg = cfgconvert.parse_text_cfg(file.read())
+        os.remove(export_filename)
+
+        cfgincremental.split(partial_cfg, pieces, store_dir, exported=missing)
+        cfgincremental.add_cfg(cfg, partial_cfg)
+
+    cfg.module_id = cfgconvert.read_module_id(program_filename)
+    cfgincremental.write_cfg(cfg, output_filename, is_binary)
+    print(f'{len(pieces) - len(missing)} of {len(pieces)} functions reused from "{store_dir}"')
+
+
+def main():
+    ghidra_install_dir = os.getenv('GHIDRA_INSTALL_DIR')
+    if ghidra_install_dir is None:
+        print('GHIDRA_INSTALL_DIR environment variable not set')
+        sys.exit(1)
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('files', nargs='+', metavar='file',
+                        help='<program> <output>, or with --batch, the programs and directories of programs to export')
+    parser.add_argument('-b', '--binary', action='store_true', help='write the CFG in the binary format')
+    parser.add_argument('-l', '--labels', action='store_true', help='write equivalence class labels instead of offset edges')
+    parser.add_argument('--batch', metavar='OUTPUT_DIR', help='export each program to OUTPUT_DIR/<build-id>.cfg, or <program name>.cfg without a build-id')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='concurrent Ghidra exports in batch mode (default: CPU count)')
+    parser.add_argument('--cache-dir', help='CFGs of already exported programs, keyed by content (default: OUTPUT_DIR/.cache)')
+    parser.add_argument('--fragments', metavar='FRAGMENT_DIR', help='reuse the CFG fragments of functions exported before and only export changed ones')
+
+    args = parser.parse_args()
+    is_label_mode = args.labels
+
+    if args.fragments is not None and (args.batch is not None or is_label_mode):
+        parser.error('--fragments cannot be combined with --batch or --labels')
+
+    if args.batch is not None:
+        export_batch(ghidra_install_dir, args.files, args.batch, args.cache_dir, max(args.jobs, 1), args.binary, is_label_mode)
+        return
+
+    if len(args.files) != 2:
+        parser.error('expected <program> <output>, or --batch <output dir> <program>...')
+
+    program_filename = os.path.abspath(args.files[0])
+    if not os.path.isfile(program_filename):
+        print(f'Program file does not exist - "{program_filename}"')
+        sys.exit(1)
+
+    output_filename = args.files[1]
+    if os.path.exists(output_filename):
+        print(f'File or folder with the same name as output already exists - \"{output_filename}\"')
+        sys.exit(1)
+
+    if args.fragments is not None:
+        export_incremental(ghidra_install_dir, program_filename, output_filename, args.fragments, args.binary)
+        return
+
+    export_cfg(ghidra_install_dir, program_filename, output_filename, args.binary, is_label_mode)
+
 if __name__ == '__main__':
     main()
@@ -6,15 +6,51 @@
 #@toolbar 
 
 from ghidra.program.model.block import BasicBlockModel
+from ghidra.program.model.data import Array, Composite, TypeDef
+from ghidra.program.model.lang import OperandType
+import bisect
 import sys
 import os
 
+LABELS_OPTION = '-labels'
+RANGES_OPTION = '-ranges'
+LABEL_MAX = 0xffff
+
 args = getScriptArgs()
-if len(args) > 1:
-	print('[' + getScriptName() + '] ' + 'Invalid Parameters. Usage: ./analyzeHeadless ... ' + getScriptName() + ' <OUTPUT_FILENAME>')
+# With -labels, offset edges are replaced by equivalence class labels
+isLabelMode = LABELS_OPTION in args
+args = [arg for arg in args if arg != LABELS_OPTION]
+
+# With -ranges <file>, only sites and functions within the listed "<start> <size>" offset ranges are exported, eg. the
+# functions that changed since the last export (see cfgincremental.py)
+ranges = None
+if RANGES_OPTION in args and args.index(RANGES_OPTION) + 1 < len(args):
+	index = args.index(RANGES_OPTION)
+	ranges = []
+	with open(args[index + 1], 'r') as file:
+		for line in file:
+			parts = line.split()
+			if len(parts) == 2:
+				ranges.append((int(parts[0], 16), int(parts[1], 16)))
+	ranges.sort()
+	args = args[:index] + args[index + 2:]
+
+if len(args) > 1 or RANGES_OPTION in args:
+	print('[' + getScriptName() + '] ' + 'Invalid Parameters. Usage: ./analyzeHeadless ... ' + getScriptName() + ' <OUTPUT_FILENAME> [' + LABELS_OPTION + '] [' + RANGES_OPTION + ' <RANGES_FILENAME>]')
 	sys.exit(1)
 
+rangeStarts = [start for start, size in ranges] if ranges is not None else []
+
+def isInRanges(offset):
+	if ranges is None:
+		return True
+
+	index = bisect.bisect_right(rangeStarts, offset) - 1
+	return index >= 0 and offset < ranges[index][0] + ranges[index][1]
+
 cfg = {}
+# site -> code block of computed jumps, candidates for switch dispatch
+jumpSites = {}
 
 functionManager = currentProgram.getFunctionManager()
 referenceManager = currentProgram.getReferenceManager()
@@ -45,29 +81,254 @@ while codeBlockiterator.hasNext():
 		else:
 			destination = int(dest_addr.getOffset() - baseAddress.getOffset())
 
-		src_addr = hex(int(destinationBlock.getReferent().getOffset() - baseAddress.getOffset()))
+		src_offset = int(destinationBlock.getReferent().getOffset() - baseAddress.getOffset())
+		if not isInRanges(src_offset):
+			continue
+
+		src_addr = hex(src_offset)
 		if src_addr in cfg:
 			cfg[src_addr].add(destination)
 		else:
 			cfg[src_addr] = set([destination])
 
-output = ''
-for key, value in cfg.items():
-	output += key + ' '
-	for i, item in enumerate(value):
-		if i > 0:
-			output += ','
+		if flowType.isJump():
+			jumpSites[src_addr] = codeBlock
+
+# A switch dispatch reads its target from a table, referenced as data by the jump or by the instructions computing it.
+# The table is only exported when Ghidra typed it as an array, otherwise its entry count is unknown.
+def findJumpTable(codeBlock):
+	memory = currentProgram.getMemory()
+	instructionIterator = currentProgram.getListing().getInstructions(codeBlock, True)
+	while instructionIterator.hasNext():
+		instruction = instructionIterator.next()
+		for reference in instruction.getReferencesFrom():
+			if not reference.getReferenceType().isData():
+				continue
+
+			tableAddress = reference.getToAddress()
+			block = memory.getBlock(tableAddress)
+			if block is None or block.isExecute():
+				continue
+
+			data = currentProgram.getListing().getDataAt(tableAddress)
+			if data is not None and data.isArray() and data.getNumComponents() > 0:
+				return int(tableAddress.getOffset() - baseAddress.getOffset()), data.getNumComponents()
+
+	return 0, 0
+
+jumpTables = []
+for key, codeBlock in jumpSites.items():
+	caseCount = len([item for item in cfg[key] if isinstance(item, (int, long))])
+	if caseCount < 2:
+		continue
+
+	table, entryCount = findJumpTable(codeBlock)
+	jumpTables.append('@jumptable ' + key + ' ' + hex(table) + ' ' + hex(entryCount))
+
+# Per-function attributes, used by the client to leave functions that cannot overwrite their own return address out
+# of the shadow stack. Each check is conservative: anything not understood drops the attribute.
+stackRegisters = set()
+for registerName in [currentProgram.getCompilerSpec().getStackPointer().getName(), 'RBP', 'EBP']:
+	register = currentProgram.getRegister(registerName)
+	if register is not None:
+		stackRegisters.add(register.getBaseRegister())
+
+def isStackRegisterOperand(instruction, index):
+	operandType = instruction.getOperandType(index)
+	if not OperandType.isRegister(operandType) or OperandType.isDynamic(operandType):
+		return False
+
+	for operandObject in instruction.getOpObjects(index):
+		if hasattr(operandObject, 'getBaseRegister') and operandObject.getBaseRegister() in stackRegisters:
+			return True
+
+	return False
+
+def usesStackRegister(instruction, index):
+	for operandObject in instruction.getOpObjects(index):
+		if hasattr(operandObject, 'getBaseRegister') and operandObject.getBaseRegister() in stackRegisters:
+			return True
+
+	return False
+
+def isLeaf(function):
+	# No calls, and no jumps leaving the body (tail calls) or with unknown targets
+	body = function.getBody()
+	instructionIterator = currentProgram.getListing().getInstructions(body, True)
+	while instructionIterator.hasNext():
+		instruction = instructionIterator.next()
+		flowType = instruction.getFlowType()
+		if flowType.isCall() or (flowType.isJump() and flowType.isComputed()):
+			return False
+
+		for flow in instruction.getFlows():
+			if not body.contains(flow):
+				return False
+
+	return True
+
+def hasNoArray(function):
+	for variable in function.getStackFrame().getStackVariables():
+		dataType = variable.getDataType()
+		while isinstance(dataType, TypeDef):
+			dataType = dataType.getBaseDataType()
+
+		if isinstance(dataType, Array) or isinstance(dataType, Composite):
+			return False
+
+	return True
 
-		if isinstance(item, (int, long)):
-			output += ('O:' + hex(item))
+def hasNoEscape(function):
+	# A stack address escapes when it is computed (LEA) or copied out of the stack/frame pointer, except into the
+	# stack/frame pointer themselves and the usual frame pointer push/pop
+	instructionIterator = currentProgram.getListing().getInstructions(function.getBody(), True)
+	while instructionIterator.hasNext():
+		instruction = instructionIterator.next()
+		mnemonic = instruction.getMnemonicString().upper()
+		if mnemonic in ('PUSH', 'POP'):
 			continue
 
-		output += ('S:' + item)
+		if instruction.getNumOperands() > 0 and isStackRegisterOperand(instruction, 0):
+			continue
+
+		for index in range(1, instruction.getNumOperands()):
+			if mnemonic == 'LEA' and usesStackRegister(instruction, index):
+				return False
+
+			if isStackRegisterOperand(instruction, index):
+				return False
+
+	return True
+
+def isDirectOnly(function):
+	# Entered only through direct calls inside this module, so the client sees every call to it
+	entry = function.getEntryPoint()
+	if currentProgram.getSymbolTable().isExternalEntryPoint(entry):
+		return False
+
+	hasCall = False
+	for reference in referenceManager.getReferencesTo(entry):
+		referenceType = reference.getReferenceType()
+		if not referenceType.isCall() or referenceType.isComputed():
+			return False
+		hasCall = True
+
+	return hasCall
+
+# The instruction following each call is the only valid target of a return
+returnSites = set()
+instructionIterator = currentProgram.getListing().getInstructions(True)
+while instructionIterator.hasNext():
+	instruction = instructionIterator.next()
+	if instruction.getFlowType().isCall() and instruction.getFallThrough() is not None:
+		returnSite = int(instruction.getFallThrough().getOffset() - baseAddress.getOffset())
+		if isInRanges(returnSite):
+			returnSites.add(returnSite)
+
+functions = []
+functionIterator = functionManager.getFunctions(True)
+while functionIterator.hasNext():
+	function = functionIterator.next()
+	body = function.getBody()
+	if function.isThunk() or function.isExternal() or body.getNumAddressRanges() != 1 or body.getMinAddress() != function.getEntryPoint():
+		continue
+
+	if not isInRanges(int(function.getEntryPoint().getOffset() - baseAddress.getOffset())):
+		continue
+
+	attributes = []
+	if isLeaf(function):
+		attributes.append('leaf')
+	if hasNoArray(function):
+		attributes.append('noarray')
+	if hasNoEscape(function):
+		attributes.append('noescape')
+	if isDirectOnly(function):
+		attributes.append('directonly')
+
+	if attributes:
+		start = int(function.getEntryPoint().getOffset() - baseAddress.getOffset())
+		size = int(body.getNumAddresses())
+		functions.append('@func 0x%x 0x%x %s' % (start, size, ','.join(attributes)))
+
+# Targets of the same site share a class, so sites with overlapping targets are merged into one class. A site may
+# then branch to any target of its class.
+siteLabels = {}
+targetLabels = {}
+if isLabelMode:
+	parents = {}
+
+	def findClass(target):
+		root = target
+		while parents[root] != root:
+			root = parents[root]
+		while parents[target] != root:
+			parents[target], target = root, parents[target]
+		return root
+
+	for value in cfg.values():
+		targets = [item for item in value if isinstance(item, (int, long))]
+		for target in targets:
+			parents.setdefault(target, target)
+		for target in targets[1:]:
+			parents[findClass(target)] = findClass(targets[0])
+
+	# Labels are 16 bits in the client, sites of further classes keep their offset edges instead, since folding classes
+	# together would let their sites reach each other's targets
+	classLabels = {}
+	unlabeledClasses = set()
+	for target in sorted(parents.keys()):
+		root = findClass(target)
+		if root not in classLabels and root not in unlabeledClasses:
+			if len(classLabels) < LABEL_MAX:
+				classLabels[root] = len(classLabels) + 1
+			else:
+				unlabeledClasses.add(root)
+		if root in classLabels:
+			targetLabels[target] = classLabels[root]
+
+	if unlabeledClasses:
+		print('[' + getScriptName() + '] WARNING: more than %d target classes, %d classes are exported as offset edges' % (LABEL_MAX, len(unlabeledClasses)))
+
+	for key, value in cfg.items():
+		for item in value:
+			if isinstance(item, (int, long)):
+				if item in targetLabels:
+					siteLabels[key] = targetLabels[item]
+				break
+
+# Lines are written as they are produced, large programs would otherwise build the whole CFG as one string
+def writeCfg(file):
+	for key, value in cfg.items():
+		edges = []
+		if key in siteLabels:
+			edges.append('L:' + hex(siteLabels[key]))
+
+		for item in value:
+			if isinstance(item, (int, long)):
+				if key not in siteLabels:
+					edges.append('O:' + hex(item))
+				continue
+
+			edges.append('S:' + item)
+
+		file.write(key + ' ' + ','.join(edges) + '\n')
+
+	for target in sorted(targetLabels.keys()):
+		file.write('@label ' + hex(target) + ' ' + hex(targetLabels[target]) + '\n')
+
+	for line in functions:
+		file.write(line + '\n')
+
+	for returnSite in sorted(returnSites):
+		file.write('@retsite ' + hex(returnSite) + '\n')
 
-	output += '\n'
+	for line in jumpTables:
+		file.write(line + '\n')
 
 if len(args) <= 0:
-	print('[' + getScriptName() + ']\n' + output)
+	print('[' + getScriptName() + ']')
+	writeCfg(sys.stdout)
 	sys.exit(0)
 
 filename = os.path.normpath(os.path.abspath(args[0]))
@@ -76,6 +337,6 @@ filename = os.path.normpath(os.path.abspath(args[0]))
 # 	sys.exit(1)
 
 with open(filename, 'w') as file:
-	file.write(output)
+	writeCfg(file)
 
 print('[' + getScriptName() + ']' + ' Output filename - \"' + filename + '\"')
@@ -0,0 +1,274 @@
+#include <string.h>
+#include <unordered_map>
+
+#include "cfgbuilder.h"
+
+// Optional sections are only written when used, so older CFGs stay byte-identical
+#define CFG_BUILDER_SECTION_COUNT 5
+
+CfgBuilder::CfgBuilder()
+{
+    _hasModuleId = false;
+    memset(&_moduleId, 0, sizeof(CfgFileModuleId));
+}
+
+/**
+ * Add an indirect branch site.
+ * 
+ * @param[in] offset The module relative offset of the branch instruction.
+ * @return true if the site was added, false if it already exists.
+*/
+bool CfgBuilder::addSite(uint64 offset)
+{
+    return _sites.emplace(offset, Site()).second;
+}
+
+void CfgBuilder::addOffsetEdge(uint64 siteOffset, uint64 offset)
+{
+    _sites[siteOffset].offsetEdges.insert(offset);
+}
+
+void CfgBuilder::addSymbolEdge(uint64 siteOffset, std::string name, std::string library)
+{
+    _sites[siteOffset].symbolEdges.insert(std::make_pair(library, name));
+}
+
+/**
+ * Add the attributes of a function.
+ * 
+ * @param[in] start The module relative offset of the function entry.
+ * @param[in] size The size of the function body.
+ * @param[in] attributes The CfgFunctionAttribute flags of the function.
+ * @return true if the function was added, false if it already exists.
+*/
+bool CfgBuilder::addFunction(uint64 start, uint32 size, uint32 attributes)
+{
+    return _functions.emplace(start, Function { size, attributes }).second;
+}
+
+void CfgBuilder::setSiteLabel(uint64 siteOffset, uint32 label)
+{
+    _sites[siteOffset].label = label;
+}
+
+/**
+ * Add the equivalence class label of a valid target.
+ * 
+ * @param[in] offset The module relative offset of the target.
+ * @param[in] label The label, greater than 0.
+ * @return true if the target was added, false if it already has a label.
+*/
+bool CfgBuilder::addTargetLabel(uint64 offset, uint32 label)
+{
+    return _targetLabels.emplace(offset, label).second;
+}
+
+/**
+ * Add the offset following a call instruction.
+ * 
+ * @param[in] offset The module relative offset of the return site.
+*/
+void CfgBuilder::addReturnSite(uint64 offset)
+{
+    _returnSites.insert(offset);
+}
+
+/**
+ * Mark a site as a switch dispatch through a jump table.
+ * 
+ * @param[in] siteOffset The module relative offset of the jump instruction.
+ * @param[in] table The module relative offset of the table, 0 if unknown.
+ * @param[in] entryCount The number of entries of the table, 0 if unknown.
+ * @return true if the jump table was added, false if the site already has one.
+*/
+bool CfgBuilder::addJumpTable(uint64 siteOffset, uint64 table, uint32 entryCount)
+{
+    return _jumpTables.emplace(siteOffset, std::make_pair(table, entryCount)).second;
+}
+
+/**
+ * Record the identity of the module the CFG describes.
+ * 
+ * @param[in] id The build-id and text hash of the module.
+*/
+void CfgBuilder::setModuleId(const CfgFileModuleId &id)
+{
+    _moduleId = id;
+    _hasModuleId = true;
+}
+
+/**
+ * Lay out the collected sites in the binary CFG format.
+ * 
+ * @param[out] sizePtr Pointer to receive the size of the image.
+ * @return The image. It needs to be released by caller with CfgBuilder::freeImage.
+*/
+void *CfgBuilder::build(size_t *sizePtr)
+{
+    uint64 offsetEdgeCount = 0;
+    uint64 symbolEdgeCount = 0;
+    std::string strings(1, '\0');
+    std::unordered_map<std::string, uint32> stringOffsets;
+    stringOffsets[""] = 0;
+
+    bool hasLabels = !_targetLabels.empty();
+    for (auto &pair : _sites) {
+        hasLabels |= pair.second.label != 0;
+        offsetEdgeCount += pair.second.offsetEdges.size();
+        symbolEdgeCount += pair.second.symbolEdges.size();
+
+        for (auto &edge : pair.second.symbolEdges) {
+            for (const std::string *str : { &edge.second, &edge.first }) {
+                if (stringOffsets.find(*str) == stringOffsets.end()) {
+                    stringOffsets[*str] = strings.size();
+                    strings.append(*str);
+                    strings.push_back('\0');
+                }
+            }
+        }
+    }
+
+    uint64 directoryCount = 1;
+    if (!_sites.empty()) {
+        directoryCount = (_sites.rbegin()->first >> CFG_SITE_DIRECTORY_SHIFT) + 2;
+    }
+
+    uint32 sectionCount = CFG_BUILDER_SECTION_COUNT + (_functions.empty() ? 0 : 1) + (hasLabels ? 2 : 0) + (_returnSites.empty() ? 0 : 1) + (_jumpTables.empty() ? 0 : 1) + (_hasModuleId ? 1 : 0);
+
+    size_t sitesOffset = ALIGN_FORWARD(sizeof(CfgFileHeader) + sectionCount * sizeof(CfgFileSection), sizeof(uint64));
+    size_t directoryOffset = ALIGN_FORWARD(sitesOffset + _sites.size() * sizeof(CfgFileSite), sizeof(uint64));
+    size_t offsetEdgesOffset = ALIGN_FORWARD(directoryOffset + directoryCount * sizeof(uint32), sizeof(uint64));
+    size_t symbolEdgesOffset = ALIGN_FORWARD(offsetEdgesOffset + offsetEdgeCount * sizeof(uint64), sizeof(uint64));
+    size_t stringsOffset = ALIGN_FORWARD(symbolEdgesOffset + symbolEdgeCount * sizeof(CfgFileSymbolEdge), sizeof(uint64));
+    size_t functionsOffset = ALIGN_FORWARD(stringsOffset + strings.size(), sizeof(uint64));
+    size_t siteLabelsOffset = ALIGN_FORWARD(functionsOffset + _functions.size() * sizeof(CfgFileFunction), sizeof(uint64));
+    size_t siteLabelCount = hasLabels ? _sites.size() : 0;
+    size_t targetLabelsOffset = ALIGN_FORWARD(siteLabelsOffset + siteLabelCount * sizeof(uint32), sizeof(uint64));
+    size_t returnSitesOffset = ALIGN_FORWARD(targetLabelsOffset + _targetLabels.size() * sizeof(CfgFileTargetLabel), sizeof(uint64));
+    size_t jumpTablesOffset = ALIGN_FORWARD(returnSitesOffset + _returnSites.size() * sizeof(uint64), sizeof(uint64));
+    size_t moduleIdOffset = ALIGN_FORWARD(jumpTablesOffset + _jumpTables.size() * sizeof(CfgFileJumpTable), sizeof(uint64));
+    size_t size = ALIGN_FORWARD(moduleIdOffset + (_hasModuleId ? sizeof(CfgFileModuleId) : 0), sizeof(uint64));
+
+    // Fresh pages are zeroed, so padding needs no initialization
+    byte *data = (byte *) dr_raw_mem_alloc(size, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(data != NULL);
+
+    CfgFileHeader *header = (CfgFileHeader *) data;
+    memcpy(header->magic, CFG_FILE_MAGIC, CFG_FILE_MAGIC_SIZE);
+    header->version = CFG_FILE_VERSION;
+    header->sectionCount = sectionCount;
+
+    CfgFileSection *sections = (CfgFileSection *) (data + sizeof(CfgFileHeader));
+    sections[0] = { CFG_SECTION_SITES, sizeof(CfgFileSite), sitesOffset, _sites.size() };
+    sections[1] = { CFG_SECTION_SITE_DIRECTORY, sizeof(uint32), directoryOffset, directoryCount };
+    sections[2] = { CFG_SECTION_OFFSET_EDGES, sizeof(uint64), offsetEdgesOffset, offsetEdgeCount };
+    sections[3] = { CFG_SECTION_SYMBOL_EDGES, sizeof(CfgFileSymbolEdge), symbolEdgesOffset, symbolEdgeCount };
+    sections[4] = { CFG_SECTION_STRINGS, sizeof(char), stringsOffset, strings.size() };
+    uint32 sectionIndex = CFG_BUILDER_SECTION_COUNT;
+    if (!_functions.empty()) {
+        sections[sectionIndex++] = { CFG_SECTION_FUNCTIONS, sizeof(CfgFileFunction), functionsOffset, _functions.size() };
+    }
+    if (hasLabels) {
+        sections[sectionIndex++] = { CFG_SECTION_SITE_LABELS, sizeof(uint32), siteLabelsOffset, siteLabelCount };
+        sections[sectionIndex++] = { CFG_SECTION_TARGET_LABELS, sizeof(CfgFileTargetLabel), targetLabelsOffset, _targetLabels.size() };
+    }
+    if (!_returnSites.empty()) {
+        sections[sectionIndex++] = { CFG_SECTION_RETURN_SITES, sizeof(uint64), returnSitesOffset, _returnSites.size() };
+    }
+    if (!_jumpTables.empty()) {
+        sections[sectionIndex++] = { CFG_SECTION_JUMP_TABLES, sizeof(CfgFileJumpTable), jumpTablesOffset, _jumpTables.size() };
+    }
+    if (_hasModuleId) {
+        sections[sectionIndex++] = { CFG_SECTION_MODULE_ID, sizeof(CfgFileModuleId), moduleIdOffset, 1 };
+    }
+
+    CfgFileSite *site = (CfgFileSite *) (data + sitesOffset);
+    uint32 *directory = (uint32 *) (data + directoryOffset);
+    uint64 bucket = 0;
+    uint32 siteIndex = 0;
+    uint64 *offsetEdge = (uint64 *) (data + offsetEdgesOffset);
+    CfgFileSymbolEdge *symbolEdge = (CfgFileSymbolEdge *) (data + symbolEdgesOffset);
+    uint32 offsetEdgeIndex = 0;
+    uint32 symbolEdgeIndex = 0;
+
+    // std::map and std::set keep sites and offset edges sorted as the format requires
+    for (auto &pair : _sites) {
+        while (bucket <= (pair.first >> CFG_SITE_DIRECTORY_SHIFT)) {
+            directory[bucket++] = siteIndex;
+        }
+        siteIndex++;
+
+        site->offset = pair.first;
+        site->offsetEdgeStart = offsetEdgeIndex;
+        site->offsetEdgeCount = pair.second.offsetEdges.size();
+        site->symbolEdgeStart = symbolEdgeIndex;
+        site->symbolEdgeCount = pair.second.symbolEdges.size();
+        site++;
+
+        for (uint64 offset : pair.second.offsetEdges) {
+            *offsetEdge++ = offset;
+        }
+        offsetEdgeIndex += pair.second.offsetEdges.size();
+
+        for (auto &edge : pair.second.symbolEdges) {
+            symbolEdge->name = stringOffsets[edge.second];
+            symbolEdge->library = stringOffsets[edge.first];
+            symbolEdge++;
+        }
+        symbolEdgeIndex += pair.second.symbolEdges.size();
+    }
+
+    while (bucket < directoryCount) {
+        directory[bucket++] = siteIndex;
+    }
+
+    memcpy(data + stringsOffset, strings.data(), strings.size());
+
+    CfgFileFunction *function = (CfgFileFunction *) (data + functionsOffset);
+    for (auto &pair : _functions) {
+        function->start = pair.first;
+        function->size = pair.second.size;
+        function->attributes = pair.second.attributes;
+        function++;
+    }
+
+    if (hasLabels) {
+        uint32 *siteLabel = (uint32 *) (data + siteLabelsOffset);
+        for (auto &pair : _sites) {
+            *siteLabel++ = pair.second.label;
+        }
+
+        CfgFileTargetLabel *targetLabel = (CfgFileTargetLabel *) (data + targetLabelsOffset);
+        for (auto &pair : _targetLabels) {
+            targetLabel->offset = pair.first;
+            targetLabel->label = pair.second;
+            targetLabel++;
+        }
+    }
+
+    uint64 *returnSite = (uint64 *) (data + returnSitesOffset);
+    for (uint64 offset : _returnSites) {
+        *returnSite++ = offset;
+    }
+
+    CfgFileJumpTable *jumpTable = (CfgFileJumpTable *) (data + jumpTablesOffset);
+    for (auto &pair : _jumpTables) {
+        jumpTable->site = pair.first;
+        jumpTable->table = pair.second.first;
+        jumpTable->entryCount = pair.second.second;
+        jumpTable++;
+    }
+
+    if (_hasModuleId) {
+        memcpy(data + moduleIdOffset, &_moduleId, sizeof(CfgFileModuleId));
+    }
+
+    *sizePtr = size;
+
+    return data;
+}
+
+void CfgBuilder::freeImage(void *data, size_t size)
+{
+    dr_raw_mem_free(data, size);
+}
@@ -0,0 +1,55 @@
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgformat.h"
+
+#ifndef CFGBUILDER_H
+#define CFGBUILDER_H
+
+/*
+ * Collects sites and edges, then lays them out in the binary CFG format so a
+ * parsed text CFG is looked up the same way as a mapped binary one.
+ */
+class CfgBuilder {
+private:
+    typedef struct {
+        std::set<uint64> offsetEdges;
+        std::set<std::pair<std::string, std::string>> symbolEdges;
+        uint32 label;
+    } Site;
+
+    typedef struct {
+        uint32 size;
+        uint32 attributes;
+    } Function;
+
+    std::map<uint64, Site> _sites;
+    std::map<uint64, Function> _functions;
+    std::map<uint64, uint32> _targetLabels;
+    std::set<uint64> _returnSites;
+    std::map<uint64, std::pair<uint64, uint32>> _jumpTables;
+    bool _hasModuleId;
+    CfgFileModuleId _moduleId;
+
+public:
+    CfgBuilder();
+    bool addSite(uint64 offset);
+    void addOffsetEdge(uint64 siteOffset, uint64 offset);
+    void addSymbolEdge(uint64 siteOffset, std::string name, std::string library);
+    bool addFunction(uint64 start, uint32 size, uint32 attributes);
+    void setSiteLabel(uint64 siteOffset, uint32 label);
+    bool addTargetLabel(uint64 offset, uint32 label);
+    void addReturnSite(uint64 offset);
+    bool addJumpTable(uint64 siteOffset, uint64 table, uint32 entryCount);
+    void setModuleId(const CfgFileModuleId &id);
+    void *build(size_t *sizePtr);
+
+    static void freeImage(void *data, size_t size);
+};
+
+#endif
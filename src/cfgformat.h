@@ -0,0 +1,149 @@
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef CFGFORMAT_H
+#define CFGFORMAT_H
+
+/*
+ * Binary CFG file layout. The file is a header followed by a table of section
+ * descriptors, each pointing at an array of fixed-size entries. All offsets are
+ * from the start of the file, and sections are 8-byte aligned so the file can
+ * be mapped and used in place. Readers skip section types they do not know.
+ *
+ * Must be kept in sync with cfgconvert.py.
+ */
+
+#define CFG_FILE_MAGIC "DETCFG\0\0"
+#define CFG_FILE_MAGIC_SIZE 8
+#define CFG_FILE_VERSION 1
+
+typedef enum {
+    CFG_SECTION_SITES = 1,
+    CFG_SECTION_OFFSET_EDGES = 2,
+    CFG_SECTION_SYMBOL_EDGES = 3,
+    CFG_SECTION_STRINGS = 4,
+    CFG_SECTION_SITE_DIRECTORY = 5,
+    CFG_SECTION_FUNCTIONS = 6,
+    CFG_SECTION_SITE_LABELS = 7,
+    CFG_SECTION_TARGET_LABELS = 8,
+    CFG_SECTION_RETURN_SITES = 9,
+    CFG_SECTION_JUMP_TABLES = 10,
+    CFG_SECTION_MODULE_ID = 11
+} CfgSectionType;
+
+typedef struct {
+    char magic[CFG_FILE_MAGIC_SIZE];
+    uint32 version;
+    uint32 sectionCount;
+} CfgFileHeader;
+
+typedef struct {
+    uint32 type;
+    uint32 entrySize;
+    uint64 offset;
+    uint64 count;
+} CfgFileSection;
+
+/*
+ * Indirect branch site, sorted by offset. Edges of a site are the ranges
+ * [start, start + count) of the edge sections. Offset edges of a site are
+ * sorted in ascending order.
+ */
+typedef struct {
+    uint64 offset;
+    uint32 offsetEdgeStart;
+    uint32 offsetEdgeCount;
+    uint32 symbolEdgeStart;
+    uint32 symbolEdgeCount;
+} CfgFileSite;
+
+/*
+ * Name and library are offsets into the string section. Strings are NUL
+ * terminated, and an edge without a library points at an empty string.
+ */
+typedef struct {
+    uint32 name;
+    uint32 library;
+} CfgFileSymbolEdge;
+
+/*
+ * Optional uint32 array narrowing the site search. Entry k is the index of the
+ * first site whose offset >> CFG_SITE_DIRECTORY_SHIFT is at least k, and the
+ * last entry is the number of sites.
+ */
+#define CFG_SITE_DIRECTORY_SHIFT 10
+
+/*
+ * Optional function attributes, sorted by start. A function covers the offsets
+ * [start, start + size). Only functions with at least one attribute are listed.
+ */
+typedef enum {
+    // Makes no calls
+    CFG_FUNCTION_LEAF = 1 << 0,
+    // Has no arrays or structures among its stack variables
+    CFG_FUNCTION_NO_ARRAY = 1 << 1,
+    // Never computes the address of a stack slot into another register
+    CFG_FUNCTION_NO_ESCAPE = 1 << 2,
+    // Only referenced by direct calls, so every entry goes through a call the client sees
+    CFG_FUNCTION_DIRECT_ONLY = 1 << 3
+} CfgFunctionAttribute;
+
+// A function with all of these cannot overwrite its own return address
+#define CFG_FUNCTION_SAFE (CFG_FUNCTION_LEAF | CFG_FUNCTION_NO_ARRAY | CFG_FUNCTION_NO_ESCAPE | CFG_FUNCTION_DIRECT_ONLY)
+
+typedef struct {
+    uint64 start;
+    uint32 size;
+    uint32 attributes;
+} CfgFileFunction;
+
+/*
+ * Optional equivalence class labels. The site label section is a uint32
+ * array parallel to the site section, with the label of the targets each site
+ * may branch to, 0 if the site has none. Target labels are sorted by offset.
+ * Labels start at 1.
+ */
+typedef struct {
+    uint64 offset;
+    uint32 label;
+    uint32 reserved;
+} CfgFileTargetLabel;
+
+/*
+ * Optional sorted uint64 array with the offset following every call
+ * instruction, the only valid targets of a return.
+ */
+
+/*
+ * Optional jump tables of switch dispatch sites, sorted by site. The offset
+ * edges of the site are the cases. Table is the offset of the table of
+ * entryCount entries read by the site, both 0 if the table is unknown.
+ */
+typedef struct {
+    uint64 site;
+    uint64 table;
+    uint32 entryCount;
+    uint32 reserved;
+} CfgFileJumpTable;
+
+/*
+ * Optional identity of the module the CFG was exported from, a single entry.
+ * The build-id is the descriptor of the NT_GNU_BUILD_ID note, buildIdSize 0
+ * if the module has none. The text hash covers the file bytes of every
+ * executable PT_LOAD segment in program header order, see
+ * ModuleId::hashText. A CFG with an identity is only used for a module
+ * with the same one.
+ */
+#define CFG_BUILD_ID_MAX_SIZE 64
+#define CFG_TEXT_HASH_SEED 0xcbf29ce484222325ULL
+#define CFG_TEXT_HASH_PRIME 0x100000001b3ULL
+
+typedef struct {
+    uint64 textSize;
+    uint64 textHash;
+    uint32 buildIdSize;
+    uint32 reserved;
+    byte buildId[CFG_BUILD_ID_MAX_SIZE];
+} CfgFileModuleId;
+
+#endif
@@ -0,0 +1,506 @@
+#include <string.h>
+
+#include "cfgimage.h"
+
+CfgImage::CfgImage(const void *data, size_t size)
+{
+    _data = (const byte *) data;
+    _size = size;
+
+    _sites = nullptr;
+    _siteCount = 0;
+    _siteDirectory = nullptr;
+    _siteDirectoryCount = 0;
+    _offsetEdges = nullptr;
+    _offsetEdgeCount = 0;
+    _symbolEdges = nullptr;
+    _symbolEdgeCount = 0;
+    _strings = nullptr;
+    _stringsSize = 0;
+    _functions = nullptr;
+    _functionCount = 0;
+    _siteLabels = nullptr;
+    _siteLabelCount = 0;
+    _targetLabels = nullptr;
+    _targetLabelCount = 0;
+    _returnSites = nullptr;
+    _returnSiteCount = 0;
+    _jumpTables = nullptr;
+    _jumpTableCount = 0;
+    _moduleId = nullptr;
+
+    _isValid = validate();
+}
+
+bool CfgImage::isValid()
+{
+    return _isValid;
+}
+
+/**
+ * Find the entry of an indirect branch site.
+ * 
+ * @param[in] offset The module relative offset of the branch instruction.
+ * @return Pointer to the site if found, otherwise, nullptr.
+*/
+const CfgFileSite *CfgImage::findSite(uint64 offset)
+{
+    uint64 low = 0;
+    uint64 high = _siteCount;
+    if (_siteDirectory != nullptr) {
+        uint64 bucket = offset >> CFG_SITE_DIRECTORY_SHIFT;
+        if (bucket + 1 >= _siteDirectoryCount) {
+            return nullptr;
+        }
+
+        low = _siteDirectory[bucket];
+        high = _siteDirectory[bucket + 1];
+        if (high > _siteCount || low > high) {
+            return nullptr;
+        }
+    }
+
+    while (low < high) {
+        uint64 mid = low + (high - low) / 2;
+        if (_sites[mid].offset < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low < _siteCount && _sites[low].offset == offset) {
+        return &_sites[low];
+    }
+
+    return nullptr;
+}
+
+/**
+ * Check if a site has an edge to an offset. Short edge lists are scanned linearly without early exit so the loop can
+ * be vectorized, longer ones are binary searched.
+ * 
+ * @param[in] site The site returned by findSite.
+ * @param[in] offset The module relative offset of the target.
+ * @return true if the edge exists, otherwise, false.
+*/
+bool CfgImage::hasOffsetEdge(const CfgFileSite *site, uint64 offset)
+{
+    uint64 start = site->offsetEdgeStart;
+    uint64 count = site->offsetEdgeCount;
+    if (start + count > _offsetEdgeCount) {
+        return false;
+    }
+
+    const uint64 *edges = _offsetEdges + start;
+    if (count <= CFG_LINEAR_SCAN_MAX) {
+        bool found = false;
+        for (uint64 i = 0; i < count; i++) {
+            found |= edges[i] == offset;
+        }
+
+        return found;
+    }
+
+    uint64 low = 0;
+    uint64 high = count;
+    while (low < high) {
+        uint64 mid = low + (high - low) / 2;
+        if (edges[mid] < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low < count && edges[low] == offset;
+}
+
+/**
+ * Same matching rules as the text CFG: an edge without a library matches any library, and with findSimilarName
+ * the edge name only has to be a substring of name.
+*/
+bool CfgImage::hasSymbolEdge(const CfgFileSite *site, std::string name, std::string library, bool findSimilarName)
+{
+    uint64 start = site->symbolEdgeStart;
+    uint64 end = start + site->symbolEdgeCount;
+    if (end > _symbolEdgeCount) {
+        return false;
+    }
+
+    for (uint64 i = start; i < end; i++) {
+        const char *edgeName = getString(_symbolEdges[i].name);
+        const char *edgeLibrary = getString(_symbolEdges[i].library);
+        if (edgeName == nullptr || edgeLibrary == nullptr) {
+            continue;
+        }
+
+        if (edgeLibrary[0] != '\0' && library != edgeLibrary) {
+            continue;
+        }
+
+        if (name == edgeName) {
+            return true;
+        }
+
+        if (findSimilarName) {
+            // Check if edge name is a substring of name
+            if (name.find(edgeName) != std::string::npos) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Get a site by its position in the sorted site table.
+ * 
+ * @param[in] index The index of the site, less than getSiteCount().
+ * @return Pointer to the site.
+*/
+const CfgFileSite *CfgImage::getSite(uint64 index)
+{
+    DR_ASSERT(index < _siteCount);
+    return &_sites[index];
+}
+
+bool CfgImage::containsSite(const CfgFileSite *site)
+{
+    return site >= _sites && site < _sites + _siteCount;
+}
+
+/**
+ * Get the strings of one of the symbol edges of a site.
+ * 
+ * @param[in] site The site returned by findSite or getSite.
+ * @param[in] index The index of the edge within the site.
+ * @param[out] namePtr The function name of the edge.
+ * @param[out] libraryPtr The library name of the edge, empty if any library matches.
+ * @return true if the edge exists and its strings are valid, otherwise, false.
+*/
+bool CfgImage::getSymbolEdge(const CfgFileSite *site, uint64 index, const char **namePtr, const char **libraryPtr)
+{
+    if (index >= site->symbolEdgeCount || site->symbolEdgeStart + index >= _symbolEdgeCount) {
+        return false;
+    }
+
+    const CfgFileSymbolEdge *edge = &_symbolEdges[site->symbolEdgeStart + index];
+    *namePtr = getString(edge->name);
+    *libraryPtr = getString(edge->library);
+
+    return *namePtr != nullptr && *libraryPtr != nullptr;
+}
+
+/**
+ * Find the function containing an offset.
+ * 
+ * @param[in] offset The module relative offset.
+ * @return Pointer to the function if the offset is inside one with attributes, otherwise, nullptr.
+*/
+const CfgFileFunction *CfgImage::findFunction(uint64 offset)
+{
+    // Find the last function starting at or before offset
+    uint64 low = 0;
+    uint64 high = _functionCount;
+    while (low < high) {
+        uint64 mid = low + (high - low) / 2;
+        if (_functions[mid].start <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low > 0 && offset - _functions[low - 1].start < _functions[low - 1].size) {
+        return &_functions[low - 1];
+    }
+
+    return nullptr;
+}
+
+/**
+ * Get the label of the targets a site may branch to.
+ * 
+ * @param[in] site The site returned by findSite or getSite.
+ * @return The label, or 0 if the site has none.
+*/
+uint32 CfgImage::getSiteLabel(const CfgFileSite *site)
+{
+    if (_siteLabels == nullptr) {
+        return 0;
+    }
+
+    return _siteLabels[site - _sites];
+}
+
+/**
+ * Find the label of a target.
+ * 
+ * @param[in] offset The module relative offset of the target.
+ * @return The label, or 0 if the offset is not a labeled target.
+*/
+uint32 CfgImage::findTargetLabel(uint64 offset)
+{
+    uint64 low = 0;
+    uint64 high = _targetLabelCount;
+    while (low < high) {
+        uint64 mid = low + (high - low) / 2;
+        if (_targetLabels[mid].offset < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low < _targetLabelCount && _targetLabels[low].offset == offset) {
+        return _targetLabels[low].label;
+    }
+
+    return 0;
+}
+
+const CfgFileTargetLabel *CfgImage::getTargetLabels(uint64 *countPtr)
+{
+    *countPtr = _targetLabelCount;
+    return _targetLabels;
+}
+
+/**
+ * Get the offset edges of all sites. Edges are only sorted within each site.
+ * 
+ * @param[out] countPtr Pointer to receive the number of edges.
+ * @return The edges.
+*/
+const uint64 *CfgImage::getOffsetEdges(uint64 *countPtr)
+{
+    *countPtr = _offsetEdgeCount;
+    return _offsetEdges;
+}
+
+/**
+ * Get the offsets following every call instruction, sorted.
+ * 
+ * @param[out] countPtr Pointer to receive the number of return sites.
+ * @return The return sites.
+*/
+const uint64 *CfgImage::getReturnSites(uint64 *countPtr)
+{
+    *countPtr = _returnSiteCount;
+    return _returnSites;
+}
+
+const CfgFileJumpTable *CfgImage::getJumpTables(uint64 *countPtr)
+{
+    *countPtr = _jumpTableCount;
+    return _jumpTables;
+}
+
+/**
+ * Get the identity of the module the CFG was exported from.
+ * 
+ * @return The identity, or nullptr if the CFG does not record one.
+*/
+const CfgFileModuleId *CfgImage::getModuleId()
+{
+    return _moduleId;
+}
+
+/**
+ * Get the offset edges of a site, sorted in ascending order.
+ * 
+ * @param[in] site The site returned by findSite or getSite.
+ * @param[out] countPtr Pointer to receive the number of edges.
+ * @return The edges, or nullptr if they do not fit in the edge section.
+*/
+const uint64 *CfgImage::getSiteOffsetEdges(const CfgFileSite *site, uint64 *countPtr)
+{
+    uint64 start = site->offsetEdgeStart;
+    uint64 count = site->offsetEdgeCount;
+    if (start + count > _offsetEdgeCount) {
+        *countPtr = 0;
+        return nullptr;
+    }
+
+    *countPtr = count;
+
+    return _offsetEdges + start;
+}
+
+uint64 CfgImage::getSiteCount()
+{
+    return _siteCount;
+}
+
+uint64 CfgImage::getEdgeCount()
+{
+    return _offsetEdgeCount + _symbolEdgeCount;
+}
+
+size_t CfgImage::getSize()
+{
+    return _size;
+}
+
+/**
+ * Check if a buffer starts with the binary CFG magic.
+ * 
+ * @param[in] data The buffer.
+ * @param[in] size The size of the buffer.
+ * @return true if the buffer looks like a binary CFG, otherwise, false.
+*/
+bool CfgImage::isCfgImage(const void *data, size_t size)
+{
+    return size >= CFG_FILE_MAGIC_SIZE && memcmp(data, CFG_FILE_MAGIC, CFG_FILE_MAGIC_SIZE) == 0;
+}
+
+/**
+ * Check the header and section table, and locate the known sections. Only the bounds of each section are checked,
+ * so this does not depend on the size of the CFG.
+ * 
+ * @return true if the file is usable, otherwise, false.
+*/
+bool CfgImage::validate()
+{
+    if (_size < sizeof(CfgFileHeader) || !isCfgImage(_data, _size)) {
+        return false;
+    }
+
+    const CfgFileHeader *header = (const CfgFileHeader *) _data;
+    if (header->version != CFG_FILE_VERSION) {
+        return false;
+    }
+
+    if (header->sectionCount > (_size - sizeof(CfgFileHeader)) / sizeof(CfgFileSection)) {
+        return false;
+    }
+
+    const CfgFileSection *sections = (const CfgFileSection *) (_data + sizeof(CfgFileHeader));
+    for (uint32 i = 0; i < header->sectionCount; i++) {
+        const CfgFileSection *section = &sections[i];
+        switch (section->type) {
+            case CFG_SECTION_SITES:
+                _sites = (const CfgFileSite *) getSection(section, sizeof(CfgFileSite), &_siteCount);
+                if (_sites == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_OFFSET_EDGES:
+                _offsetEdges = (const uint64 *) getSection(section, sizeof(uint64), &_offsetEdgeCount);
+                if (_offsetEdges == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_SYMBOL_EDGES:
+                _symbolEdges = (const CfgFileSymbolEdge *) getSection(section, sizeof(CfgFileSymbolEdge), &_symbolEdgeCount);
+                if (_symbolEdges == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_SITE_DIRECTORY:
+                _siteDirectory = (const uint32 *) getSection(section, sizeof(uint32), &_siteDirectoryCount);
+                if (_siteDirectory == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_STRINGS:
+                _strings = (const char *) getSection(section, sizeof(char), &_stringsSize);
+                if (_strings == nullptr || (_stringsSize > 0 && _strings[_stringsSize - 1] != '\0')) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_FUNCTIONS:
+                _functions = (const CfgFileFunction *) getSection(section, sizeof(CfgFileFunction), &_functionCount);
+                if (_functions == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_SITE_LABELS:
+                _siteLabels = (const uint32 *) getSection(section, sizeof(uint32), &_siteLabelCount);
+                if (_siteLabels == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_TARGET_LABELS:
+                _targetLabels = (const CfgFileTargetLabel *) getSection(section, sizeof(CfgFileTargetLabel), &_targetLabelCount);
+                if (_targetLabels == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_RETURN_SITES:
+                _returnSites = (const uint64 *) getSection(section, sizeof(uint64), &_returnSiteCount);
+                if (_returnSites == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_JUMP_TABLES:
+                _jumpTables = (const CfgFileJumpTable *) getSection(section, sizeof(CfgFileJumpTable), &_jumpTableCount);
+                if (_jumpTables == nullptr) {
+                    return false;
+                }
+                break;
+
+            case CFG_SECTION_MODULE_ID: {
+                uint64 count = 0;
+                _moduleId = (const CfgFileModuleId *) getSection(section, sizeof(CfgFileModuleId), &count);
+                if (_moduleId == nullptr || count != 1 || _moduleId->buildIdSize > CFG_BUILD_ID_MAX_SIZE) {
+                    return false;
+                }
+                break;
+            }
+
+            default:
+                // Unknown section, skip
+                break;
+        }
+    }
+
+    // Site labels are looked up by site index
+    if (_siteLabels != nullptr && _siteLabelCount != _siteCount) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Get the contents of a section.
+ * 
+ * @param[in] section The section descriptor.
+ * @param[in] entrySize The expected size of each entry.
+ * @param[out] countPtr Pointer to receive the number of entries.
+ * @return Pointer to the first entry, or nullptr if the section does not fit in the file.
+*/
+const void *CfgImage::getSection(const CfgFileSection *section, size_t entrySize, uint64 *countPtr)
+{
+    if (section->entrySize != entrySize || section->offset % sizeof(uint64) != 0 || section->offset > _size) {
+        return nullptr;
+    }
+
+    if (section->count > (_size - section->offset) / entrySize) {
+        return nullptr;
+    }
+
+    *countPtr = section->count;
+
+    return _data + section->offset;
+}
+
+const char *CfgImage::getString(uint32 offset)
+{
+    if (offset >= _stringsSize) {
+        return nullptr;
+    }
+
+    return _strings + offset;
+}
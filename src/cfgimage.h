@@ -0,0 +1,76 @@
+#include <string>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgformat.h"
+
+#ifndef CFGIMAGE_H
+#define CFGIMAGE_H
+
+// Edge lists up to this length are scanned linearly instead of binary searched
+#define CFG_LINEAR_SCAN_MAX 16
+
+/*
+ * Read-only view over a CFG in the binary format (see cfgformat.h), either a
+ * mapped file or an image built by CfgBuilder. Sites and their edges are laid
+ * out as sorted contiguous arrays, and lookups work directly on them.
+ */
+class CfgImage {
+private:
+    const byte *_data;
+    size_t _size;
+    bool _isValid;
+
+    const CfgFileSite *_sites;
+    uint64 _siteCount;
+    const uint32 *_siteDirectory;
+    uint64 _siteDirectoryCount;
+    const uint64 *_offsetEdges;
+    uint64 _offsetEdgeCount;
+    const CfgFileSymbolEdge *_symbolEdges;
+    uint64 _symbolEdgeCount;
+    const char *_strings;
+    uint64 _stringsSize;
+    const CfgFileFunction *_functions;
+    uint64 _functionCount;
+    const uint32 *_siteLabels;
+    uint64 _siteLabelCount;
+    const CfgFileTargetLabel *_targetLabels;
+    uint64 _targetLabelCount;
+    const uint64 *_returnSites;
+    uint64 _returnSiteCount;
+    const CfgFileJumpTable *_jumpTables;
+    uint64 _jumpTableCount;
+    const CfgFileModuleId *_moduleId;
+
+    const void *getSection(const CfgFileSection *section, size_t entrySize, uint64 *countPtr);
+    bool validate();
+    const char *getString(uint32 offset);
+
+public:
+    CfgImage(const void *data, size_t size);
+    bool isValid();
+    const CfgFileSite *findSite(uint64 offset);
+    bool hasOffsetEdge(const CfgFileSite *site, uint64 offset);
+    bool hasSymbolEdge(const CfgFileSite *site, std::string name, std::string library, bool findSimilarName);
+    const CfgFileSite *getSite(uint64 index);
+    bool containsSite(const CfgFileSite *site);
+    bool getSymbolEdge(const CfgFileSite *site, uint64 index, const char **namePtr, const char **libraryPtr);
+    const CfgFileFunction *findFunction(uint64 offset);
+    uint32 getSiteLabel(const CfgFileSite *site);
+    uint32 findTargetLabel(uint64 offset);
+    const CfgFileTargetLabel *getTargetLabels(uint64 *countPtr);
+    const uint64 *getOffsetEdges(uint64 *countPtr);
+    const uint64 *getReturnSites(uint64 *countPtr);
+    const CfgFileJumpTable *getJumpTables(uint64 *countPtr);
+    const CfgFileModuleId *getModuleId();
+    const uint64 *getSiteOffsetEdges(const CfgFileSite *site, uint64 *countPtr);
+    uint64 getSiteCount();
+    uint64 getEdgeCount();
+    size_t getSize();
+
+    static bool isCfgImage(const void *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "cfgbuilder.h"
+
+#include "cfgmodule.h"
+
+/**
+ * @param[in] name The preferred name of the module.
+ * @param[in] start The start address of the module.
+ * @param[in] end The end address of the module (exclusive).
+ * @param[in] data The CFG image, ownership is taken.
+ * @param[in] size The size of the CFG image.
+ * @param[in] isMapped true if data is a mapped file, false if it was built by CfgBuilder.
+ * @pre data is a valid CFG image.
+*/
+CfgModule::CfgModule(std::string name, app_pc start, app_pc end, void *data, size_t size, bool isMapped)
+{
+    _name = name;
+    _start = start;
+    _end = end;
+    _data = data;
+    _size = size;
+    _isMapped = isMapped;
+
+    _image = new CfgImage(data, size);
+    DR_ASSERT(_image->isValid());
+
+    _labelTable = nullptr;
+    _targetBitmap = nullptr;
+    _returnSiteBitmap = nullptr;
+
+    uint64 count;
+    const CfgFileJumpTable *jumpTables = _image->getJumpTables(&count);
+    for (uint64 i = 0; i < count; i++) {
+        const CfgFileSite *site = _image->findSite(jumpTables[i].site);
+        uint64 targetCount;
+        const uint64 *targets = site != nullptr ? _image->getSiteOffsetEdges(site, &targetCount) : nullptr;
+        if (targets != nullptr && targetCount > 0) {
+            _jumpTables[site] = new JumpTable(targets, targetCount, &jumpTables[i]);
+        }
+    }
+}
+
+CfgModule::~CfgModule()
+{
+    for (auto &pair : _jumpTables) {
+        delete pair.second;
+    }
+
+    delete _returnSiteBitmap;
+    delete _targetBitmap;
+    delete _labelTable;
+    delete _image;
+
+    if (_isMapped) {
+        dr_unmap_file(_data, _size);
+    } else {
+        CfgBuilder::freeImage(_data, _size);
+    }
+}
+
+std::string CfgModule::getName()
+{
+    return _name;
+}
+
+app_pc CfgModule::getStart()
+{
+    return _start;
+}
+
+app_pc CfgModule::getEnd()
+{
+    return _end;
+}
+
+CfgImage *CfgModule::getImage()
+{
+    return _image;
+}
+
+/**
+ * Build the dense label table of the module, for inline label checks.
+ * 
+ * @pre The label table has not been built yet.
+*/
+void CfgModule::buildLabelTable()
+{
+    DR_ASSERT(_labelTable == nullptr);
+    _labelTable = new LabelTable(_image, _end - _start);
+}
+
+/**
+ * @return The label table, or nullptr if it was not built.
+*/
+LabelTable *CfgModule::getLabelTable()
+{
+    return _labelTable;
+}
+
+/**
+ * Build the valid target bitmap of the module, for coarse inline checks. Offset edges, labeled targets and return
+ * sites are all valid targets.
+ * 
+ * @pre The bitmap has not been built yet.
+*/
+void CfgModule::buildTargetBitmap()
+{
+    DR_ASSERT(_targetBitmap == nullptr);
+    _targetBitmap = new TargetBitmap(_end - _start);
+
+    uint64 count;
+    const uint64 *offsets = _image->getOffsetEdges(&count);
+    for (uint64 i = 0; i < count; i++) {
+        _targetBitmap->add(offsets[i]);
+    }
+
+    const CfgFileTargetLabel *labels = _image->getTargetLabels(&count);
+    for (uint64 i = 0; i < count; i++) {
+        _targetBitmap->add(labels[i].offset);
+    }
+
+    const uint64 *returnSites = _image->getReturnSites(&count);
+    for (uint64 i = 0; i < count; i++) {
+        _targetBitmap->add(returnSites[i]);
+    }
+
+    _targetBitmap->seal();
+}
+
+/**
+ * @return The valid target bitmap, or nullptr if it was not built.
+*/
+TargetBitmap *CfgModule::getTargetBitmap()
+{
+    return _targetBitmap;
+}
+
+/**
+ * Build the return site bitmap of the module, for inline return checks.
+ * 
+ * @return true if the bitmap was built, false if the CFG has no return sites.
+ * @pre The bitmap has not been built yet.
+*/
+bool CfgModule::buildReturnSiteBitmap()
+{
+    DR_ASSERT(_returnSiteBitmap == nullptr);
+
+    uint64 count;
+    const uint64 *returnSites = _image->getReturnSites(&count);
+    if (count == 0) {
+        return false;
+    }
+
+    _returnSiteBitmap = new TargetBitmap(_end - _start);
+    for (uint64 i = 0; i < count; i++) {
+        _returnSiteBitmap->add(returnSites[i]);
+    }
+    _returnSiteBitmap->seal();
+
+    return true;
+}
+
+/**
+ * @return The return site bitmap, or nullptr if it was not built.
+*/
+TargetBitmap *CfgModule::getReturnSiteBitmap()
+{
+    return _returnSiteBitmap;
+}
+
+/**
+ * Find the jump table of a switch dispatch site.
+ * 
+ * @param[in] site The CFG entry of the site.
+ * @return The jump table, or nullptr if the site is not a switch dispatch.
+*/
+JumpTable *CfgModule::findJumpTable(const CfgFileSite *site)
+{
+    auto it = _jumpTables.find(site);
+    if (it == _jumpTables.end()) {
+        return nullptr;
+    }
+
+    return it->second;
+}
+
+bool CfgModule::contains(app_pc addr)
+{
+    return addr >= _start && addr < _end;
+}
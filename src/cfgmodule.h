@@ -0,0 +1,51 @@
+#include <string>
+#include <unordered_map>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgimage.h"
+#include "labeltable.h"
+#include "targetbitmap.h"
+#include "jumptable.h"
+
+#ifndef CFGMODULE_H
+#define CFGMODULE_H
+
+/*
+ * The CFG of one loaded module together with the address range it applies
+ * to. Owns the image memory, either a mapped binary CFG file or an image
+ * built from a text CFG.
+ */
+class CfgModule {
+private:
+    std::string _name;
+    app_pc _start;
+    app_pc _end;
+    void *_data;
+    size_t _size;
+    bool _isMapped;
+    CfgImage *_image;
+    LabelTable *_labelTable;
+    TargetBitmap *_targetBitmap;
+    TargetBitmap *_returnSiteBitmap;
+    std::unordered_map<const CfgFileSite *, JumpTable *> _jumpTables;
+
+public:
+    CfgModule(std::string name, app_pc start, app_pc end, void *data, size_t size, bool isMapped);
+    ~CfgModule();
+    std::string getName();
+    app_pc getStart();
+    app_pc getEnd();
+    CfgImage *getImage();
+    void buildLabelTable();
+    LabelTable *getLabelTable();
+    void buildTargetBitmap();
+    TargetBitmap *getTargetBitmap();
+    bool buildReturnSiteBitmap();
+    TargetBitmap *getReturnSiteBitmap();
+    JumpTable *findJumpTable(const CfgFileSite *site);
+    bool contains(app_pc addr);
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "cfgmoduletable.h"
+
+CfgModuleTable::CfgModuleTable()
+{
+    _lock = dr_rwlock_create();
+}
+
+CfgModuleTable::~CfgModuleTable()
+{
+    for (auto it : _modules) {
+        delete it.second;
+    }
+
+    for (auto module : _retiredModules) {
+        delete module;
+    }
+
+    dr_rwlock_destroy(_lock);
+}
+
+/**
+ * Add the CFG of a loaded module, ownership is taken.
+ * 
+ * @param[in] module The module.
+ * @pre No module in the table overlaps module.
+*/
+void CfgModuleTable::add(CfgModule *module)
+{
+    dr_rwlock_write_lock(_lock);
+
+    bool isAdded = _modules.insert({ module->getStart(), module }).second;
+    DR_ASSERT(isAdded);
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Remove the CFG of an unloaded module. It is kept allocated until the table is destroyed, as threads that found it
+ * before may still be using it.
+ * 
+ * @param[in] start The start address of the module.
+ * @return The module if found, otherwise, nullptr.
+*/
+CfgModule *CfgModuleTable::remove(app_pc start)
+{
+    CfgModule *module = nullptr;
+
+    dr_rwlock_write_lock(_lock);
+
+    auto it = _modules.find(start);
+    if (it != _modules.end()) {
+        module = it->second;
+        _modules.erase(it);
+        _retiredModules.push_back(module);
+    }
+
+    dr_rwlock_write_unlock(_lock);
+
+    return module;
+}
+
+/**
+ * Find the module containing an address.
+ * 
+ * @param[in] addr The address.
+ * @return The module if found, otherwise, nullptr.
+*/
+CfgModule *CfgModuleTable::find(app_pc addr)
+{
+    CfgModule *module = nullptr;
+
+    dr_rwlock_read_lock(_lock);
+
+    auto it = _modules.upper_bound(addr);
+    if (it != _modules.begin()) {
+        --it;
+        if (it->second->contains(addr)) {
+            module = it->second;
+        }
+    }
+
+    dr_rwlock_read_unlock(_lock);
+
+    return module;
+}
+
+size_t CfgModuleTable::getCount()
+{
+    dr_rwlock_read_lock(_lock);
+    size_t count = _modules.size();
+    dr_rwlock_read_unlock(_lock);
+
+    return count;
+}
@@ -0,0 +1,34 @@
+#include <map>
+#include <vector>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgmodule.h"
+
+#ifndef CFGMODULETABLE_H
+#define CFGMODULETABLE_H
+
+/*
+ * Loaded modules that have a CFG, ordered by start address so the module
+ * containing an address can be found. Lookups only take a read lock, the
+ * table changes on module load and unload. Modules found by other threads
+ * may still be in use after they are removed, so removed modules are only
+ * freed with the table.
+ */
+class CfgModuleTable {
+private:
+    std::map<app_pc, CfgModule *> _modules;
+    std::vector<CfgModule *> _retiredModules;
+    void *_lock;
+
+public:
+    CfgModuleTable();
+    ~CfgModuleTable();
+    void add(CfgModule *module);
+    CfgModule *remove(app_pc start);
+    CfgModule *find(app_pc addr);
+    size_t getCount();
+};
+
+#endif
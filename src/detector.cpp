@@ -1,51 +1,343 @@
 #include "detector.h"
 
 static int tls_idx;
-static std::list<HeapNode *> heapList;
-static std::unordered_map<uint64, CfgNode *> cfgMap;
+static reg_id_t tls_seg;
+static uint tls_offs;
+static drvector_t scratchRegs;
+static HeapTracker *heapTracker;
+static InlineCache *inlineCache;
+static PltCache *pltCache;
+static CfgModuleTable *cfgModules;
+static SymbolEdgeIndex *symbolEdgeIndex;
+static ExportIndex *exportIndex;
+static const char *cfgDirectory;
+static bool isAsync;
+static bool isLabelMode;
+static bool isBitmapMode;
+static bool isReturnSiteMode;
+static bool isOfflineMode;
+static std::vector<EventRing *> *eventRings;
+static void *eventRingsMutex;
+static volatile bool isCheckerStopping;
+static void *checkerStoppedEvent;
+static Statistics *statistics;
+static reg_id_t stats_tls_seg;
+static uint stats_tls_offs;
+static volatile int checkedSiteCount;
+static volatile int elidedModuleSiteCount;
+static volatile int elidedCfgNodeSiteCount;
+static volatile int elidedCallCount;
+static volatile int elidedReturnCount;
 
 DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
 {
-    if (argc != 2) {
-        dr_fprintf(STDERR, "DynamoRIO Client Usage: -c %s <CFG Filename>\n", argv[0]);
+    const char *cfgPath = NULL;
+    isAsync = false;
+    isLabelMode = false;
+    isBitmapMode = false;
+    isReturnSiteMode = false;
+    isOfflineMode = false;
+    bool isStatsEnabled = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-async") == 0) {
+            isAsync = true;
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            isStatsEnabled = true;
+        } else if (strcmp(argv[i], "-labels") == 0) {
+            isLabelMode = true;
+        } else if (strcmp(argv[i], "-bitmap") == 0) {
+            isBitmapMode = true;
+        } else if (strcmp(argv[i], "-retsites") == 0) {
+            isReturnSiteMode = true;
+        } else if (strcmp(argv[i], "-offline") == 0) {
+            isOfflineMode = true;
+        } else if (argv[i][0] != '-' && cfgPath == NULL) {
+            cfgPath = argv[i];
+        } else {
+            printUsage(argv[0]);
+            dr_abort();
+        }
+    }
+
+    // Label and bitmap checks replace each other, only one can be selected
+    if (cfgPath == NULL || (isLabelMode && isBitmapMode)) {
+        printUsage(argv[0]);
         dr_abort();
     }
 
-    const char *cfgFilename = argv[1];
-    if (!dr_file_exists(cfgFilename)) {
-        dr_fprintf(STDERR, "CFG file does not exist - %s\n", cfgFilename);
+    heapTracker = new HeapTracker();
+    inlineCache = new InlineCache();
+    pltCache = new PltCache();
+
+    dr_set_client_name("DynamoRIO Client 'Detector'", "");
+
+    drmgr_init();
+
+    drreg_options_t ops = { sizeof(ops), 4, false };
+    if (drreg_init(&ops) != DRREG_SUCCESS) {
+        dr_fprintf(STDERR, "Unable to initialize drreg\n");
         dr_abort();
     }
 
-    file_t file = dr_open_file(cfgFilename, DR_FILE_READ);
+    // Inline instrumentation stores the application's bp, so it can never be used as a scratch register
+    drreg_init_and_fill_vector(&scratchRegs, true);
+    drreg_set_vector_entry(&scratchRegs, DR_REG_XBP, false);
+
+    // Offline, reports are symbolized by tools/symbolize and debug info is never loaded into the process
+    if (!isOfflineMode && drsym_init(0) != DRSYM_SUCCESS) {
+        dr_log(NULL, DR_LOG_ALL, 1, "WARNING: unable to initialize symbol translation\n");
+    }
+    drwrap_init();
+
+    cfgModules = new CfgModuleTable();
+    symbolEdgeIndex = new SymbolEdgeIndex(!isOfflineMode);
+    exportIndex = isOfflineMode ? new ExportIndex() : nullptr;
+
+    // Symbol edges are resolved with drsyms, so CFGs are loaded after it is initialized
+    if (dr_directory_exists(cfgPath)) {
+        // CFGs of the executable and its libraries are loaded as the modules are loaded
+        cfgDirectory = cfgPath;
+    } else {
+        // A single CFG file applies to the executable
+        cfgDirectory = NULL;
+
+        if (!dr_file_exists(cfgPath)) {
+            dr_fprintf(STDERR, "CFG file does not exist - %s\n", cfgPath);
+            dr_abort();
+        }
+
+        module_data_t *appModule = dr_get_main_module();
+        DR_ASSERT(appModule != NULL);
+
+        CfgModule *module = loadCfgModule(cfgPath, appModule);
+        if (module == nullptr) {
+            dr_abort();
+        }
+        cfgModules->add(module);
+        symbolEdgeIndex->addImage(module->getImage());
+
+        dr_free_module_data(appModule);
+    }
+
+    dr_fprintf(STDERR, "Client Detector is running\n");
+
+    dr_register_exit_event(event_exit);
+    drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL);
+    drmgr_register_thread_init_event(event_thread_init);
+    drmgr_register_thread_exit_event(event_thread_exit);
+    drmgr_register_module_load_event(module_load_event);
+    drmgr_register_module_unload_event(module_unload_event);
+    dr_register_filter_syscall_event(event_filter_syscall);
+    drmgr_register_pre_syscall_event(event_pre_syscall);
+
+    tls_idx = drmgr_register_tls_field();
+    DR_ASSERT(tls_idx > -1);
+
+    bool ok = dr_raw_tls_calloc(&tls_seg, &tls_offs, SHADOW_STACK_TLS_SLOTS, 0);
+    DR_ASSERT(ok);
+
+    if (isStatsEnabled) {
+        std::string statsPath = std::string(STATS_FILE_PREFIX) + std::to_string(dr_get_process_id());
+        statistics = new Statistics(statsPath);
+        if (!statistics->isValid()) {
+            dr_fprintf(STDERR, "Unable to create statistics segment - %s\n", statsPath.c_str());
+            dr_abort();
+        }
+
+        // Holds the ThreadStats of the thread, read by the inline counters
+        ok = dr_raw_tls_calloc(&stats_tls_seg, &stats_tls_offs, 1, 0);
+        DR_ASSERT(ok);
+    }
+
+    if (isAsync) {
+        eventRings = new std::vector<EventRing *>();
+        eventRingsMutex = dr_mutex_create();
+        checkerStoppedEvent = dr_event_create();
+
+        ok = dr_create_client_thread(checker_thread, NULL);
+        DR_ASSERT(ok);
+    }
+}
+
+static void printUsage(const char *clientName)
+{
+    dr_fprintf(STDERR, "DynamoRIO Client Usage: -c %s [-async] [-stats] [-labels | -bitmap] [-retsites] [-offline] <CFG Filename or Directory>\n", clientName);
+    dr_fprintf(STDERR, "  -async     Check indirect branches on a separate thread, see README\n");
+    dr_fprintf(STDERR, "  -stats     Export live statistics to " STATS_FILE_PREFIX "<pid> and dump them to " STATS_JSON_PREFIX "<pid>.json at exit\n");
+    dr_fprintf(STDERR, "  -labels    Check labeled sites inline against the target label table, see README\n");
+    dr_fprintf(STDERR, "  -bitmap    Only check that targets are valid targets of any site, see README\n");
+    dr_fprintf(STDERR, "  -retsites  Check returns against the return sites instead of a shadow stack, see README\n");
+    dr_fprintf(STDERR, "  -offline   Report raw addresses and a module map for tools/symbolize instead of looking up symbols\n");
+}
+
+/**
+ * Find the CFG of a module in the CFG directory. A CFG named after the build-id of the module is preferred, so
+ * one directory can hold the CFGs of several builds of a module.
+ * 
+ * @param[in] mod The loaded module.
+ * @return The path of the CFG file, or an empty string if the module has none.
+*/
+static std::string findCfgFile(const module_data_t *mod)
+{
+    ModuleId moduleId(mod->start, mod->end - mod->start, true);
+    std::string buildId = moduleId.getBuildIdString();
+    if (!buildId.empty()) {
+        std::string cfgFilename = std::string(cfgDirectory) + "/" + buildId + CFG_FILE_EXTENSION;
+        if (dr_file_exists(cfgFilename.c_str())) {
+            return cfgFilename;
+        }
+    }
+
+    const char *modname = dr_module_preferred_name(mod);
+    if (modname != NULL) {
+        std::string cfgFilename = std::string(cfgDirectory) + "/" + modname + CFG_FILE_EXTENSION;
+        if (dr_file_exists(cfgFilename.c_str())) {
+            return cfgFilename;
+        }
+    }
+
+    return "";
+}
+
+/**
+ * Load a CFG file, in the text or binary format, for a module.
+ * 
+ * @param[in] filename The path of the CFG file.
+ * @param[in] mod The module the CFG describes.
+ * @return The loaded CFG, or nullptr if it was exported from another build of the module.
+ * @pre filename exists.
+*/
+static CfgModule *loadCfgModule(const char *filename, const module_data_t *mod)
+{
+    file_t file = dr_open_file(filename, DR_FILE_READ);
     if (file == INVALID_FILE) {
-        dr_fprintf(STDERR, "Unable to open file - %s\n", cfgFilename);
+        dr_fprintf(STDERR, "Unable to open file - %s\n", filename);
         dr_abort();
     }
 
-    std::string data;
-    char buffer[BUFFER_SIZE];
-    size_t readSize = BUFFER_SIZE - 1;
-    size_t size;
-    do {
-        size = dr_read_file(file, buffer, readSize);
-        if (size <= 0) {
-            continue;
+    uint64 fileSize;
+    bool ok = dr_file_size(file, &fileSize);
+    DR_ASSERT(ok);
+
+    size_t mapSize = fileSize;
+    void *map = NULL;
+    if (mapSize > 0) {
+        map = dr_map_file(file, &mapSize, 0, NULL, DR_MEMPROT_READ, DR_MAP_PRIVATE);
+        if (map == NULL) {
+            dr_fprintf(STDERR, "Unable to map file - %s\n", filename);
+            dr_abort();
         }
+    }
+    dr_close_file(file);
 
-        DR_ASSERT(size <= readSize);
-        buffer[size] = '\0';
+    std::string moduleName = "";
+    const char *modname = dr_module_preferred_name(mod);
+    if (modname != NULL) {
+        moduleName = std::string(modname);
+    }
 
-        data += buffer;
-    } while (size == readSize);
-    dr_close_file(file);
+    if (CfgImage::isCfgImage(map, fileSize)) {
+        // Binary CFG is used in place
+        CfgImage image(map, fileSize);
+        if (!image.isValid()) {
+            dr_fprintf(STDERR, "Invalid binary CFG file - %s\n", filename);
+            dr_abort();
+        }
+
+        if (!isCfgOfModule(&image, mod)) {
+            dr_fprintf(STDERR, "CFG is stale, %s was rebuilt since its export - %s\n", moduleName.c_str(), filename);
+            dr_unmap_file(map, mapSize);
+            return nullptr;
+        }
+
+        return createCfgModule(moduleName, mod, map, mapSize, true);
+    }
+
+    // Text CFG is laid out in the same format as a binary one
+    CfgBuilder builder;
+    if (map != NULL) {
+        parseTextCfg(std::string((const char *) map, fileSize), &builder);
+        dr_unmap_file(map, mapSize);
+    }
+
+    size_t imageSize;
+    void *imageData = builder.build(&imageSize);
+
+    CfgImage image(imageData, imageSize);
+    if (!isCfgOfModule(&image, mod)) {
+        dr_fprintf(STDERR, "CFG is stale, %s was rebuilt since its export - %s\n", moduleName.c_str(), filename);
+        CfgBuilder::freeImage(imageData, imageSize);
+        return nullptr;
+    }
+
+    return createCfgModule(moduleName, mod, imageData, imageSize, false);
+}
 
+/**
+ * Check that a CFG was exported from the loaded build of a module, by its build-id and text hash. A CFG without the
+ * identity of its module is trusted.
+ * 
+ * @param[in] image The CFG.
+ * @param[in] mod The loaded module.
+ * @return true if the CFG applies to the module, false if it is stale.
+*/
+static bool isCfgOfModule(CfgImage *image, const module_data_t *mod)
+{
+    const CfgFileModuleId *id = image->getModuleId();
+    if (id == nullptr) {
+        return true;
+    }
+
+    ModuleId moduleId(mod->start, mod->end - mod->start, true);
+
+    return moduleId.matches(id);
+}
+
+/**
+ * Create the CFG of a module, with its label table or target bitmap in the matching mode.
+ * 
+ * @param[in] name The preferred name of the module.
+ * @param[in] mod The module the CFG describes.
+ * @param[in] data The CFG image, ownership is taken.
+ * @param[in] size The size of the CFG image.
+ * @param[in] isMapped true if data is a mapped file, false if it was built by CfgBuilder.
+ * @return The CFG of the module.
+*/
+static CfgModule *createCfgModule(std::string name, const module_data_t *mod, void *data, size_t size, bool isMapped)
+{
+    CfgModule *module = new CfgModule(name, mod->start, mod->end, data, size, isMapped);
+    if (isLabelMode) {
+        module->buildLabelTable();
+    } else if (isBitmapMode) {
+        module->buildTargetBitmap();
+    }
+
+    if (isReturnSiteMode && !module->buildReturnSiteBitmap()) {
+        dr_fprintf(STDERR, "CFG has no return sites, returns of %s are not checked\n", name.c_str());
+    }
+
+    return module;
+}
+
+/**
+ * Parse a CFG in the text format.
+ * 
+ * @param[in] data The contents of the CFG file.
+ * @param[in] builder The builder to add the sites and edges to.
+*/
+static void parseTextCfg(std::string data, CfgBuilder *builder)
+{
     std::vector<std::string> *lines = splitString(data, "\n");
     for (auto line : *lines) {
         if (line.empty()) {
             continue;
         }
 
+        if (trim(line).compare(0, strlen(CFG_DIRECTIVE_PREFIX), CFG_DIRECTIVE_PREFIX) == 0) {
+            parseCfgDirective(trim(line), builder);
+            continue;
+        }
+
         std::vector<std::string> *lineSplit = splitString(trim(line), " ", 1);
         DR_ASSERT(lineSplit->size() == 2);
 
@@ -56,8 +348,8 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
         uint64 offset = strtoull(offsetStr.c_str(), &endptr, 16);
         DR_ASSERT(!(offset == ULONG_MAX && errno == ERANGE));
 
-        DR_ASSERT(cfgMap.find(offset) == cfgMap.end());
-        CfgNode *node = new CfgNode(offset);
+        bool isAdded = builder->addSite(offset);
+        DR_ASSERT(isAdded);
 
         std::vector<std::string> *edgesStrSplit = splitString(edgesStr, ",");
         for (auto edgeStr : *edgesStrSplit) {
@@ -74,7 +366,7 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
                 uint64 valueOffset = strtoull(value.c_str(), &endptr, 16);
                 DR_ASSERT(!(valueOffset == ULONG_MAX && errno == ERANGE));
 
-                node->addOffsetEdge(valueOffset);
+                builder->addOffsetEdge(offset, valueOffset);
             } else if (type == "S") {
                 std::vector<std::string> *valueSplit = splitString(value, "::", 1);
                 DR_ASSERT(edgeStrSplit->size() <= 2);
@@ -89,9 +381,15 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
                     library = "";
                 }
                 
-                node->addSymbolEdge(name, library);
+                builder->addSymbolEdge(offset, name, library);
 
                 delete valueSplit;
+            } else if (type == "L") {
+                char *endptr;
+                uint64 label = strtoull(value.c_str(), &endptr, 16);
+                DR_ASSERT(label > 0 && label <= LABEL_TABLE_MAX_LABEL);
+
+                builder->setSiteLabel(offset, (uint32) label);
             } else {
                 // Unknown type
                 DR_ASSERT(false);
@@ -101,51 +399,197 @@ DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[])
         }
         delete edgesStrSplit;
         delete lineSplit;
-
-        cfgMap[offset] = node;
     }
     delete lines;
+}
 
-    dr_set_client_name("DynamoRIO Client 'Detector'", "");
+/**
+ * Parse a directive line of a text CFG. Directives the client does not know are skipped, so newer exports still load.
+ * 
+ * @param[in] line The trimmed line, starting with CFG_DIRECTIVE_PREFIX.
+ * @param[in] builder The builder to add the directive to.
+*/
+static void parseCfgDirective(std::string line, CfgBuilder *builder)
+{
+    std::vector<std::string> *lineSplit = splitString(line, " ");
+    if (lineSplit->at(0) == CFG_FUNCTION_DIRECTIVE) {
+        // @func <start> <size> <attribute>,...
+        DR_ASSERT(lineSplit->size() == 4);
 
-    drmgr_init();
-    if (drsym_init(0) != DRSYM_SUCCESS) {
-        dr_log(NULL, DR_LOG_ALL, 1, "WARNING: unable to initialize symbol translation\n");
-    }
-    drwrap_init();
+        char *endptr;
+        uint64 start = strtoull(lineSplit->at(1).c_str(), &endptr, 16);
+        DR_ASSERT(!(start == ULONG_MAX && errno == ERANGE));
+        uint64 size = strtoull(lineSplit->at(2).c_str(), &endptr, 16);
+        DR_ASSERT(size <= UINT_MAX);
+
+        uint32 attributes = 0;
+        std::vector<std::string> *attributesSplit = splitString(lineSplit->at(3), ",");
+        for (auto attribute : *attributesSplit) {
+            if (attribute == "leaf") {
+                attributes |= CFG_FUNCTION_LEAF;
+            } else if (attribute == "noarray") {
+                attributes |= CFG_FUNCTION_NO_ARRAY;
+            } else if (attribute == "noescape") {
+                attributes |= CFG_FUNCTION_NO_ESCAPE;
+            } else if (attribute == "directonly") {
+                attributes |= CFG_FUNCTION_DIRECT_ONLY;
+            }
+        }
+        delete attributesSplit;
 
-    dr_fprintf(STDERR, "Client Detector is running\n");
+        bool isAdded = builder->addFunction(start, (uint32) size, attributes);
+        DR_ASSERT(isAdded);
+    } else if (lineSplit->at(0) == CFG_RETURN_SITE_DIRECTIVE) {
+        // @retsite <offset>
+        DR_ASSERT(lineSplit->size() == 2);
 
-    dr_register_exit_event(event_exit);
-    drmgr_register_bb_instrumentation_event(NULL, event_app_instruction, NULL);
-    drmgr_register_thread_init_event(event_thread_init);
-    drmgr_register_thread_exit_event(event_thread_exit);
-    drmgr_register_module_load_event(module_load_event);
+        char *endptr;
+        uint64 offset = strtoull(lineSplit->at(1).c_str(), &endptr, 16);
+        DR_ASSERT(!(offset == ULONG_MAX && errno == ERANGE));
 
-    tls_idx = drmgr_register_tls_field();
-    DR_ASSERT(tls_idx > -1);
+        builder->addReturnSite(offset);
+    } else if (lineSplit->at(0) == CFG_JUMP_TABLE_DIRECTIVE) {
+        // @jumptable <site> <table> <entry count>
+        DR_ASSERT(lineSplit->size() == 4);
+
+        char *endptr;
+        uint64 site = strtoull(lineSplit->at(1).c_str(), &endptr, 16);
+        DR_ASSERT(!(site == ULONG_MAX && errno == ERANGE));
+        uint64 table = strtoull(lineSplit->at(2).c_str(), &endptr, 16);
+        DR_ASSERT(!(table == ULONG_MAX && errno == ERANGE));
+        uint64 entryCount = strtoull(lineSplit->at(3).c_str(), &endptr, 16);
+        DR_ASSERT(entryCount <= UINT_MAX);
+
+        bool isAdded = builder->addJumpTable(site, table, (uint32) entryCount);
+        DR_ASSERT(isAdded);
+    } else if (lineSplit->at(0) == CFG_MODULE_DIRECTIVE) {
+        // @module <text size> <text hash> [<build-id>]
+        DR_ASSERT(lineSplit->size() == 3 || lineSplit->size() == 4);
+
+        CfgFileModuleId id;
+        memset(&id, 0, sizeof(CfgFileModuleId));
+
+        char *endptr;
+        id.textSize = strtoull(lineSplit->at(1).c_str(), &endptr, 16);
+        DR_ASSERT(!(id.textSize == ULONG_MAX && errno == ERANGE));
+        id.textHash = strtoull(lineSplit->at(2).c_str(), &endptr, 16);
+        DR_ASSERT(!(id.textHash == ULONG_MAX && errno == ERANGE));
+
+        if (lineSplit->size() == 4) {
+            std::string buildId = lineSplit->at(3);
+            DR_ASSERT(buildId.size() % 2 == 0 && buildId.size() <= CFG_BUILD_ID_MAX_SIZE * 2);
+
+            for (size_t i = 0; i < buildId.size(); i += 2) {
+                id.buildId[i / 2] = (byte) strtoul(buildId.substr(i, 2).c_str(), &endptr, 16);
+                DR_ASSERT(*endptr == '\0');
+            }
+            id.buildIdSize = buildId.size() / 2;
+        }
+
+        builder->setModuleId(id);
+    } else if (lineSplit->at(0) == CFG_LABEL_DIRECTIVE) {
+        // @label <target> <label>
+        DR_ASSERT(lineSplit->size() == 3);
+
+        char *endptr;
+        uint64 offset = strtoull(lineSplit->at(1).c_str(), &endptr, 16);
+        DR_ASSERT(!(offset == ULONG_MAX && errno == ERANGE));
+        uint64 label = strtoull(lineSplit->at(2).c_str(), &endptr, 16);
+        DR_ASSERT(label > 0 && label <= LABEL_TABLE_MAX_LABEL);
+
+        bool isAdded = builder->addTargetLabel(offset, (uint32) label);
+        DR_ASSERT(isAdded);
+    }
+    delete lineSplit;
 }
 
 static void event_exit(void)
 {
-    for (auto node : heapList) {
-        delete node;
+    if (isAsync) {
+        // The checker must be out of the CFGs before they are freed, branches queued right before the exit are then
+        // checked here
+        isCheckerStopping = true;
+        dr_event_wait(checkerStoppedEvent);
+        checkEventRings();
+
+        dr_event_destroy(checkerStoppedEvent);
+        dr_mutex_destroy(eventRingsMutex);
+        delete eventRings;
     }
 
-    for (auto pair : cfgMap) {
-        delete pair.second;
+    if (statistics != nullptr) {
+        dr_fprintf(STDERR, "Indirect branch sites: %d checked, %d elided (%d in modules without CFG, %d without CFG entry)\n",
+                    checkedSiteCount, elidedModuleSiteCount + elidedCfgNodeSiteCount, elidedModuleSiteCount, elidedCfgNodeSiteCount);
+        dr_fprintf(STDERR, "Shadow stack: %d direct call sites and %d return sites elided in safe functions\n", elidedCallCount, elidedReturnCount);
+
+        std::string jsonPath = std::string(STATS_JSON_PREFIX) + std::to_string(dr_get_process_id()) + ".json";
+        file_t file = dr_open_file(jsonPath.c_str(), DR_FILE_WRITE_OVERWRITE);
+        if (file != INVALID_FILE) {
+            statistics->writeJson(file);
+            dr_close_file(file);
+        } else {
+            dr_fprintf(STDERR, "Unable to write statistics - %s\n", jsonPath.c_str());
+        }
+
+        delete statistics;
+        dr_raw_tls_cfree(stats_tls_offs, 1);
     }
 
+    delete heapTracker;
+    delete inlineCache;
+    delete pltCache;
+
+    delete symbolEdgeIndex;
+    delete exportIndex;
+    delete cfgModules;
+
     drmgr_unregister_tls_field(tls_idx);
+    dr_raw_tls_cfree(tls_offs, SHADOW_STACK_TLS_SLOTS);
+
+    drvector_delete(&scratchRegs);
 
     drwrap_exit();
-    drsym_exit();
+    drreg_exit();
+    if (!isOfflineMode) {
+        drsym_exit();
+    }
     drmgr_exit();
 }
 
+static bool event_filter_syscall(void *drcontext, int sysnum)
+{
+    return isAsync && (sysnum == SYS_execve || sysnum == SYS_execveat || sysnum == SYS_exit_group);
+}
+
+/**
+ * Check the queued branches before the process image is replaced or the process exits, as the checker thread does
+ * not get to run afterwards.
+ * 
+ * @param[in] drcontext The context of the thread.
+ * @param[in] sysnum The number of the system call.
+ * @return true to execute the system call.
+*/
+static bool event_pre_syscall(void *drcontext, int sysnum)
+{
+    checkEventRings();
+
+    return true;
+}
+
 static void event_thread_init(void *drcontext)
 {
-    ThreadContext *threadContext = new ThreadContext(drcontext);
+    ShadowStackTls *shadowStackTls = (ShadowStackTls *) ((byte *) dr_get_dr_segment_base(tls_seg) + tls_offs);
+    ThreadContext *threadContext = new ThreadContext(drcontext, shadowStackTls, isAsync);
+
+    if (statistics != nullptr) {
+        setThreadStats(statistics->acquire(dr_get_thread_id(drcontext)));
+    }
+
+    if (isAsync) {
+        dr_mutex_lock(eventRingsMutex);
+        eventRings->push_back(threadContext->getEventRing());
+        dr_mutex_unlock(eventRingsMutex);
+    }
 
     //printf("[%d] New Thread with ID %d\n", dr_get_process_id(), threadContext->getThreadId());
 
@@ -157,79 +601,123 @@ static void event_thread_exit(void *drcontext)
 {
     ThreadContext *threadContext = (ThreadContext *) drmgr_get_tls_field(drcontext, tls_idx);
     DR_ASSERT(threadContext != NULL);
-    
+
+    if (isAsync) {
+        // Branches of the thread are checked before its ring goes away, the checker may not run anymore at process exit
+        checkEventRings();
+
+        EventRing *eventRing = threadContext->getEventRing();
+        dr_mutex_lock(eventRingsMutex);
+        eventRings->erase(std::find(eventRings->begin(), eventRings->end(), eventRing));
+        dr_mutex_unlock(eventRingsMutex);
+    }
+
+    if (statistics != nullptr) {
+        statistics->release(getThreadStats());
+        setThreadStats(nullptr);
+    }
+
     delete threadContext;
 }
 
 static dr_emit_flags_t event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr, bool for_trace, bool translating, void *user_data)
 {
+    dr_emit_flags_t flags = DR_EMIT_DEFAULT;
+
     if (instr_is_call_direct(instr)) {
         // direct call instructions
-        dr_insert_call_instrumentation(drcontext, bb, instr, (app_pc) at_call);
+        insertCounterIncrement(drcontext, bb, instr, STAT_DIRECT_CALL);
+
+        app_pc pc = instr_get_app_pc(instr);
+        if (isReturnSiteMode) {
+            // Returns are checked against the return sites, calls need no work
+        } else if (isSafeFunction(instr_get_branch_target_pc(instr), true)) {
+            // Returns of safe functions are not checked, so their frames are not pushed either
+            if (!for_trace && !translating) {
+                dr_atomic_add32_return_sum(&elidedCallCount, 1);
+            }
+        } else {
+            insertShadowStackPush(drcontext, bb, instr, pc, pc + instr_length(drcontext, instr));
+        }
     } else if (instr_is_call_indirect(instr)) {
         // indirect call instructions
-        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_call_ind, SPILL_SLOT_1);
+        insertCounterIncrement(drcontext, bb, instr, STAT_INDIRECT_CALL);
+
+        CfgModule *module;
+        const CfgFileSite *site;
+        if (getCheckedSite(instr_get_app_pc(instr), for_trace || translating, &module, &site) &&
+            insertIndirectBranchCheck(drcontext, bb, instr, module, site)) {
+            flags = DR_EMIT_STORE_TRANSLATIONS;
+        }
+
+        if (!isReturnSiteMode) {
+            app_pc pc = instr_get_app_pc(instr);
+            insertShadowStackPush(drcontext, bb, instr, pc, pc + instr_length(drcontext, instr));
+        }
     } else if (instr_is_return(instr)) {
         // return instructions
-        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_return, SPILL_SLOT_1);
+        insertCounterIncrement(drcontext, bb, instr, STAT_RETURN);
+        if (isReturnSiteMode) {
+            insertReturnSiteCheck(drcontext, bb, instr);
+        } else if (isSafeFunction(instr_get_app_pc(instr), false)) {
+            if (!for_trace && !translating) {
+                dr_atomic_add32_return_sum(&elidedReturnCount, 1);
+            }
+        } else {
+            insertShadowStackCheck(drcontext, bb, instr);
+        }
     } else if (instr_is_mbr(instr) && isInstrIndirectJump(instr)) {
         // indirect jump instructions
-        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_jump_ind, SPILL_SLOT_1);
-    }
-
-    return DR_EMIT_DEFAULT;
-}
+        insertCounterIncrement(drcontext, bb, instr, STAT_INDIRECT_JUMP);
 
-static void at_call(app_pc instr_addr, app_pc target_addr)
-{
-    dr_mcontext_t mc = { sizeof(mc), DR_MC_ALL };
-    dr_get_mcontext(dr_get_current_drcontext(), &mc);
-    
-    //dr_fprintf(STDERR, "CALL @ " PFX " to " PFX ", TOS is " PFX "\n", instr_addr, target_addr, mc.xsp);
-
-    saveCall(instr_addr, mc.xbp, mc.xsp);
-}
-
-static void at_call_ind(app_pc instr_addr, app_pc target_addr)
-{
-    dr_mcontext_t mc = { sizeof(mc), DR_MC_ALL };
-    dr_get_mcontext(dr_get_current_drcontext(), &mc);
-
-    //dr_fprintf(STDERR, "CALL INDIRECT @ " PFX " to " PFX "\n", instr_addr, target_addr);
-    //dr_fprintf(STDERR, "Indirect call @ %s to %s, checkCfg=%d\n", getSymbolString(instr_addr).c_str(), getSymbolString(target_addr).c_str(), checkCfg(instr_addr, target_addr));
+        CfgModule *module;
+        const CfgFileSite *site;
+        if (getCheckedSite(instr_get_app_pc(instr), for_trace || translating, &module, &site) &&
+            insertIndirectBranchCheck(drcontext, bb, instr, module, site)) {
+            flags = DR_EMIT_STORE_TRANSLATIONS;
+        }
+    }
 
-    processIndirectJump(instr_addr, target_addr);
-    saveCall(instr_addr, mc.xbp, mc.xsp);
+    // Inline cache contents change between builds of the same block, so translations cannot be recreated
+    return flags;
 }
 
-static void at_return(app_pc instr_addr, app_pc target_addr)
+/**
+ * Slow path of the inline return check. Only reached when the top of the shadow stack does not match the return.
+ * 
+ * @param[in] instr_addr The address of the return instruction.
+ * @param[in] sp The stack pointer before the return.
+ * @param[in] bp The base pointer before the return.
+*/
+static void at_return(app_pc instr_addr, reg_t sp, reg_t bp)
 {
-    dr_mcontext_t mc = { sizeof(mc), DR_MC_ALL };
-    dr_get_mcontext(dr_get_current_drcontext(), &mc);
-
-    //dr_fprintf(STDERR, "RETURN @ " PFX " to " PFX ", TOS is " PFX "\n", instr_addr, target_addr, mc.xsp);
+    app_pc target_addr = *((app_pc *) sp);
 
-    std::string symbolString = getSymbolString(instr_addr);
+    //dr_fprintf(STDERR, "RETURN @ " PFX " to " PFX ", TOS is " PFX "\n", instr_addr, target_addr, sp);
 
     bool hasLongJmp;
-    CheckReturnResult res = checkReturn(mc.xsp, mc.xbp, target_addr, &hasLongJmp);
+    uint64 start = readTimestamp();
+    CheckReturnResult res = checkReturn(sp, bp, target_addr, &hasLongJmp);
+    recordLatency(STAT_TIMER_CHECK_RETURN, start);
+    countEvent((StatCounter) (STAT_RETURN_EMPTY_CALLSTACK + res));
+
     switch (res) {
         case EMPTY_CALLSTACK:
-            dr_fprintf(STDERR, "Empty call stack @ %s, SP=" PFX "\n", symbolString.c_str(), mc.xsp);
+            dr_fprintf(STDERR, "Empty call stack @ %s, SP=" PFX "\n", getSymbolString(instr_addr).c_str(), sp);
             break;
 
         case SP_NOT_FOUND:
-            dr_fprintf(STDERR, "Skipping check for instruction @ %s, SP=" PFX "\n", symbolString.c_str(), mc.xsp);
+            dr_fprintf(STDERR, "Skipping check for instruction @ %s, SP=" PFX "\n", getSymbolString(instr_addr).c_str(), sp);
             break;
 
         case SUCCESS:
             if (hasLongJmp) {
-                dr_fprintf(STDERR, "Detected longjmp @ %s\n", symbolString.c_str());
+                dr_fprintf(STDERR, "Detected longjmp @ %s\n", getSymbolString(instr_addr).c_str());
             }
             break;
             
         case FAIL:
-            dr_fprintf(STDERR, "!!!Stack Overflow Detected @ %s\n", symbolString.c_str());
+            dr_fprintf(STDERR, "!!!Stack Overflow Detected @ %s\n", getSymbolString(instr_addr).c_str());
             printCallTrace();
             dr_abort();
             break;
@@ -239,14 +727,214 @@ static void at_return(app_pc instr_addr, app_pc target_addr)
     }
 }
 
-static void at_jump_ind(app_pc instr_addr, app_pc target_addr)
+/**
+ * Slow path of the inline return site check, reached when the return target is not a return site of the module
+ * containing the return. The target is valid if it is a return site of its own module, or in a module whose return
+ * sites are unknown.
+ * 
+ * @param[in] instr_addr The address of the return instruction.
+ * @param[in] sp The stack pointer before the return.
+*/
+static void at_return_site(app_pc instr_addr, reg_t sp)
+{
+    app_pc target_addr = *((app_pc *) sp);
+
+    CfgModule *module = cfgModules->find(target_addr);
+    if (module == nullptr || module->getReturnSiteBitmap() == nullptr) {
+        return;
+    }
+
+    // Signal handlers return to the sigreturn trampoline registered as sa_restorer, which no call precedes
+    if (!module->getReturnSiteBitmap()->contains(target_addr - module->getStart()) && !isSigreturnTrampoline(target_addr)) {
+        dr_fprintf(STDERR, "!!!Invalid Return Target Detected @ %s to %s\n", getSymbolString(instr_addr).c_str(), getSymbolString(target_addr).c_str());
+        printModuleMap();
+        dr_abort();
+    }
+}
+
+static void at_branch_ind(app_pc instr_addr, app_pc target_addr)
 {
-    //dr_fprintf(STDERR, "Indirect jump @ %s to %s, checkCfg=%d\n", getSymbolString(instr_addr).c_str(), getSymbolString(target_addr).c_str(), checkCfg(instr_addr, target_addr));
+    //dr_fprintf(STDERR, "Indirect branch @ %s to %s, checkCfg=%d\n", getSymbolString(instr_addr).c_str(), getSymbolString(target_addr).c_str(), checkCfg(instr_addr, target_addr));
     processIndirectJump(instr_addr, target_addr);
 }
 
+/**
+ * Slow path of the inline cache check. Only reached when the target is not one of the cached targets of the site.
+ * 
+ * @param[in] instr_addr The address of the indirect call/jump instruction.
+ * @param[in] module The CFG of the module containing the instruction, bound when the block was built.
+ * @param[in] site The CFG entry of the instruction, bound when the block was built.
+ * @param[in] target_addr The address of the destination.
+*/
+static void at_inline_cache_miss(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr)
+{
+    countEvent(STAT_INLINE_CACHE_MISS);
+
+    uint64 start = readTimestamp();
+    CheckCfgResult res = checkCfgEdge(module, site, target_addr);
+    recordLatency(STAT_TIMER_CHECK_CFG, start);
+
+    enforceCfgResult(instr_addr, target_addr, res);
+    cacheTarget(instr_addr, target_addr, res);
+}
+
+/**
+ * Asynchronous slow path of the inline cache check. The branch is queued for the checker thread and the application
+ * continues right away. When the queue is full, the thread waits for the checker to catch up.
+ * 
+ * @param[in] instr_addr The address of the indirect call/jump instruction.
+ * @param[in] module The CFG of the module containing the instruction, bound when the block was built.
+ * @param[in] site The CFG entry of the instruction, bound when the block was built.
+ * @param[in] target_addr The address of the destination.
+*/
+static void at_inline_cache_miss_async(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr)
+{
+    countEvent(STAT_INLINE_CACHE_MISS);
+
+    BranchEvent event = { instr_addr, module, site, target_addr };
+
+    ThreadContext *threadContext = (ThreadContext *) drmgr_get_tls_field(dr_get_current_drcontext(), tls_idx);
+    DR_ASSERT(threadContext != NULL);
+
+    EventRing *eventRing = threadContext->getEventRing();
+    while (!eventRing->tryPush(&event)) {
+        dr_thread_yield();
+    }
+}
+
+/**
+ * Slow path of a PLT stub check. Only reached when the GOT slot does not hold the target validated last for the stub,
+ * that is until lazy binding resolves the slot and whenever the slot is rebound. Misses are rare, so they are checked
+ * right away in asynchronous mode too.
+ * 
+ * @param[in] instr_addr The address of the indirect jump of the stub.
+ * @param[in] module The CFG of the module containing the stub, bound when the block was built.
+ * @param[in] site The CFG entry of the stub, bound when the block was built.
+ * @param[in] target_addr The address of the destination.
+*/
+static void at_plt_miss(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr)
+{
+    countEvent(STAT_INLINE_CACHE_MISS);
+
+    // Until the slot is resolved it points back into the PLT, the target is checked again once it is
+    if (isLazyBindingStub(module, target_addr, getPltSlot(instr_addr))) {
+        return;
+    }
+
+    uint64 start = readTimestamp();
+    CheckCfgResult res = checkCfgEdge(module, site, target_addr);
+    recordLatency(STAT_TIMER_CHECK_CFG, start);
+
+    enforceCfgResult(instr_addr, target_addr, res);
+    if (res != UNKNOWN_TARGET) {
+        pltCache->setTarget(instr_addr, target_addr);
+    }
+}
+
+/**
+ * Add a checked target to the inline cache of its site, unless the result cannot be reused.
+ * 
+ * @param[in] instr_addr The address of the indirect call/jump instruction.
+ * @param[in] target_addr The address of the destination.
+ * @param[in] res The result of the check, the transfer was allowed.
+*/
+static void cacheTarget(app_pc instr_addr, app_pc target_addr, CheckCfgResult res)
+{
+    if (res == UNKNOWN_TARGET) {
+        // Target may become part of a module later (eg. JIT or dlopen), so the result cannot be reused
+        return;
+    }
+
+    if (inlineCache->addTarget(instr_addr, target_addr)) {
+        // Rebuild the fragments containing the site so the new target is emitted
+        dr_delay_flush_region(instr_addr, 1, 0, NULL);
+    }
+}
+
+/**
+ * Check the branches queued by the application threads in asynchronous mode, until the client exits. The thread is not
+ * suspendable, so DR never stops it while it holds eventRingsMutex, and it signals checkerStoppedEvent once it no
+ * longer touches any CFG.
+ * 
+ * @param[in] arg Unused.
+*/
+static void checker_thread(void *arg)
+{
+    dr_client_thread_set_suspendable(false);
+
+    if (statistics != nullptr && getThreadStats() == nullptr) {
+        setThreadStats(statistics->acquire(dr_get_thread_id(dr_get_current_drcontext())));
+    }
+
+    while (!isCheckerStopping) {
+        if (checkEventRings() == 0) {
+            dr_sleep(ASYNC_CHECK_INTERVAL_MS);
+        }
+    }
+
+    dr_event_signal(checkerStoppedEvent);
+}
+
+/**
+ * Check the branches queued in every event ring. Aborts on the first invalid edge, the application thread has moved
+ * on so there is no call trace to print.
+ * 
+ * @return The number of branches checked.
+*/
+static size_t checkEventRings()
+{
+    size_t count = 0;
+
+    dr_mutex_lock(eventRingsMutex);
+
+    for (auto eventRing : *eventRings) {
+        BranchEvent event;
+        while (eventRing->tryPop(&event)) {
+            uint64 start = readTimestamp();
+            CheckCfgResult res = checkCfgEdge(event.module, event.site, event.target);
+            recordLatency(STAT_TIMER_CHECK_CFG, start);
+            countEvent((StatCounter) (STAT_CFG_UNKNOWN_MODULE + res));
+
+            if (res == NOT_BEGINNING || res == CFGEDGE_NOT_FOUND) {
+                dr_fprintf(STDERR, "!!!Invalid edge detect @ %s to %s\n", getSymbolString(event.pc).c_str(), getSymbolString(event.target).c_str());
+                printModuleMap();
+                dr_abort();
+            }
+
+            cacheTarget(event.pc, event.target, res);
+            count++;
+        }
+    }
+
+    dr_mutex_unlock(eventRingsMutex);
+
+    return count;
+}
+
+static void at_shadow_stack_full()
+{
+    getShadowStack()->grow();
+}
+
 static void module_load_event(void *drcontext, const module_data_t *mod, bool loaded)
 {
+    if (cfgDirectory != NULL) {
+        std::string cfgFilename = findCfgFile(mod);
+        if (!cfgFilename.empty()) {
+            // A stale CFG is skipped, the module is left unchecked as if it had none
+            CfgModule *module = loadCfgModule(cfgFilename.c_str(), mod);
+            if (module != nullptr) {
+                cfgModules->add(module);
+                symbolEdgeIndex->addImage(module->getImage());
+            }
+        }
+    }
+
+    symbolEdgeIndex->addModule(mod);
+    if (exportIndex != nullptr) {
+        exportIndex->addModule(mod);
+    }
+
     app_pc malloc_address = (app_pc) dr_get_proc_address(mod->handle, MALLOC_ROUTINE_NAME);
     if (malloc_address != NULL) {
         bool ok = drwrap_wrap(malloc_address, wrap_malloc_pre, wrap_malloc_post);
@@ -303,8 +991,37 @@ static void module_load_event(void *drcontext, const module_data_t *mod, bool lo
     }
 }
 
+static void module_unload_event(void *drcontext, const module_data_t *mod)
+{
+    symbolEdgeIndex->removeModule(mod);
+    if (exportIndex != nullptr) {
+        exportIndex->removeModule(mod);
+    }
+
+    CfgModule *module = cfgModules->remove(mod->start);
+    if (module != nullptr) {
+        if (isAsync) {
+            // Queued branches of the module are checked while its symbol edges are still resolved
+            checkEventRings();
+        }
+
+        // Freed with cfgModules, other threads may still hold the module they found
+        symbolEdgeIndex->removeImage(module->getImage());
+    }
+
+    std::vector<app_pc> staleSites;
+    inlineCache->invalidateRange(mod->start, mod->end, &staleSites);
+    pltCache->invalidateRange(mod->start, mod->end);
+
+    for (auto site : staleSites) {
+        dr_delay_flush_region(site, 1, 0, NULL);
+    }
+}
+
 static void wrap_malloc_pre(void *wrapcxt, OUT void **user_data)
 {
+    countEvent(STAT_MALLOC);
+
     size_t size = (size_t) drwrap_get_arg(wrapcxt, 0);
     *user_data = (void *) size;
 }
@@ -318,14 +1035,15 @@ static void wrap_malloc_post(void *wrapcxt, void *user_data)
 
     size_t size = (size_t) user_data;
 
-    HeapNode *node = new HeapNode(address, size);
-    addNodeToHeapList(&heapList, node);
+    heapTracker->insert(address, size);
 
     //dr_fprintf(STDERR, "[malloc] Address: %p, Size: %ld\n", address, size);
 }
 
 static void wrap_calloc_pre(void *wrapcxt, OUT void **user_data)
 {
+    countEvent(STAT_CALLOC);
+
     size_t nmemb = (size_t) drwrap_get_arg(wrapcxt, 0);
     size_t size = (size_t) drwrap_get_arg(wrapcxt, 1);
 
@@ -352,263 +1070,871 @@ static void wrap_calloc_post(void *wrapcxt, void *user_data)
     size_t size = callocArguments->size;
     dr_thread_free(dr_get_current_drcontext(), callocArguments, sizeof(CallocArguments));
 
-    HeapNode *node = new HeapNode(address, nmemb * size);
-    addNodeToHeapList(&heapList, node);
+    heapTracker->insert(address, nmemb * size);
 
     //dr_fprintf(STDERR, "[calloc] Address: %p, nmemb = %ld, size = %ld\n", address, nmemb, size);
 }
 
 static void wrap_realloc_pre(void *wrapcxt, OUT void **user_data)
 {
+    countEvent(STAT_REALLOC);
+
     void *ptr = (void *) drwrap_get_arg(wrapcxt, 0);
     size_t size = (size_t) drwrap_get_arg(wrapcxt, 1);
 
-    if (ptr != NULL && findNodeInHeapList(&heapList, ptr) == nullptr) {
+    // Take ptr out before realloc can free it, otherwise another thread may be handed the same address and have its record removed in post
+    size_t oldSize = 0;
+    uint64 start = readTimestamp();
+    bool isRemoved = ptr == NULL || heapTracker->remove(ptr, &oldSize);
+    recordLatency(STAT_TIMER_HEAP_LOOKUP, start);
+    if (!isRemoved) {
+        dr_fprintf(STDERR, "Using reallocarray on unallocated memory: %p\n", ptr);
+        printCallTrace();
+        dr_abort();
+    }
+
+    ReallocArguments *reallocArguments = (ReallocArguments *) dr_thread_alloc(dr_get_current_drcontext(), sizeof(ReallocArguments));
+    DR_ASSERT(reallocArguments != NULL);
+
+    reallocArguments->ptr = ptr;
+    reallocArguments->size = size;
+    reallocArguments->oldSize = oldSize;
+
+    *user_data = (void *) reallocArguments;
+}
+
+static void wrap_realloc_post(void *wrapcxt, void *user_data)
+{
+    ReallocArguments *reallocArguments = (ReallocArguments *) user_data;
+    DR_ASSERT(reallocArguments != NULL);
+
+    void *ptr = reallocArguments->ptr;
+    size_t size = reallocArguments->size;
+    size_t oldSize = reallocArguments->oldSize;
+    dr_thread_free(dr_get_current_drcontext(), reallocArguments, sizeof(ReallocArguments));
+
+    void *address = drwrap_get_retval(wrapcxt);
+    if (address == NULL) {
+        // Failed realloc leaves ptr allocated, except realloc to size 0 which frees it
+        if (ptr != NULL && size != 0) {
+            heapTracker->insert(ptr, oldSize);
+        }
+        return;
+    }
+
+    heapTracker->insert(address, size);
+
+    //dr_fprintf(STDERR, "[realloc] Address: %p, ptr = %p, size = %ld\n", address, ptr, size);
+}
+
+static void wrap_reallocarray_pre(void *wrapcxt, OUT void **user_data)
+{
+    countEvent(STAT_REALLOCARRAY);
+
+    void *ptr = (void *) drwrap_get_arg(wrapcxt, 0);
+    size_t nmemb = (size_t) drwrap_get_arg(wrapcxt, 1);
+    size_t size = (size_t) drwrap_get_arg(wrapcxt, 2);
+
+    // Take ptr out before reallocarray can free it, see wrap_realloc_pre
+    size_t oldSize = 0;
+    uint64 start = readTimestamp();
+    bool isRemoved = ptr == NULL || heapTracker->remove(ptr, &oldSize);
+    recordLatency(STAT_TIMER_HEAP_LOOKUP, start);
+    if (!isRemoved) {
         dr_fprintf(STDERR, "Using reallocarray on unallocated memory: %p\n", ptr);
         printCallTrace();
         dr_abort();
     }
 
-    ReallocArguments *reallocArguments = (ReallocArguments *) dr_thread_alloc(dr_get_current_drcontext(), sizeof(ReallocArguments));
-    DR_ASSERT(reallocArguments != NULL);
+    ReallocarrayArguments *reallocarrayArguments = (ReallocarrayArguments *) dr_thread_alloc(dr_get_current_drcontext(), sizeof(ReallocarrayArguments));
+    DR_ASSERT(reallocarrayArguments != NULL);
+
+    reallocarrayArguments->ptr = ptr;
+    reallocarrayArguments->nmemb = nmemb;
+    reallocarrayArguments->size = size;
+    reallocarrayArguments->oldSize = oldSize;
+
+    *user_data = (void *) reallocarrayArguments;
+}
+
+static void wrap_reallocarray_post(void *wrapcxt, void *user_data)
+{
+    ReallocarrayArguments *reallocarrayArguments = (ReallocarrayArguments *) user_data;
+    DR_ASSERT(reallocarrayArguments != NULL);
+
+    void *ptr = reallocarrayArguments->ptr;
+    size_t nmemb = reallocarrayArguments->nmemb;
+    size_t size = reallocarrayArguments->size;
+    size_t oldSize = reallocarrayArguments->oldSize;
+    dr_thread_free(dr_get_current_drcontext(), reallocarrayArguments, sizeof(ReallocarrayArguments));
+
+    void *address = drwrap_get_retval(wrapcxt);
+    if (address == NULL) {
+        // Failed reallocarray leaves ptr allocated, except a request for 0 bytes which frees it
+        if (ptr != NULL && nmemb * size != 0) {
+            heapTracker->insert(ptr, oldSize);
+        }
+        return;
+    }
+
+    heapTracker->insert(address, nmemb * size);
+
+    //dr_fprintf(STDERR, "[reallocarray] Address: %p, ptr = %p, nmemb = %ld, size = %ld\n", address, ptr, nmemb, size);
+}
+
+static void wrap_free_pre(void *wrapcxt, OUT void **user_data)
+{
+    countEvent(STAT_FREE);
+
+    void *ptr = drwrap_get_arg(wrapcxt, 0);
+    if (ptr == NULL) {
+        return;
+    }
+
+    uint64 start = readTimestamp();
+    bool isRemoved = heapTracker->remove(ptr, nullptr);
+    recordLatency(STAT_TIMER_HEAP_LOOKUP, start);
+    if (!isRemoved) {
+        dr_fprintf(STDERR, "Freeing unallocated memory: " PFX "\n", ptr);
+        printCallTrace();
+        dr_abort();
+    }
+
+    //dr_fprintf(STDERR, "[free] ptr: %p\n", ptr);
+}
+
+/**
+ * Insert inline instrumentation that pushes a frame onto the shadow stack. Assume instr is a call.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The call instruction.
+ * @param[in] pc The address of the call instruction.
+ * @param[in] return_address The address of the instruction after the call.
+*/
+static void insertShadowStackPush(void *drcontext, instrlist_t *bb, instr_t *instr, app_pc pc, app_pc return_address)
+{
+    reg_id_t top;
+    reg_id_t scratch;
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &top) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &scratch) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+        return;
+    }
+
+    instr_t *pushLabel = INSTR_CREATE_label(drcontext);
+
+    // Grow the stack in a clean call only when it is full
+    dr_insert_read_raw_tls(drcontext, bb, instr, tls_seg, tls_offs + offsetof(ShadowStackTls, top), top);
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(top), getShadowStackTlsOpnd(offsetof(ShadowStackTls, limit))));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jb, opnd_create_instr(pushLabel)));
+    dr_insert_clean_call(drcontext, bb, instr, (void *) at_shadow_stack_full, false, 0);
+    dr_insert_read_raw_tls(drcontext, bb, instr, tls_seg, tls_offs + offsetof(ShadowStackTls, top), top);
+    instrlist_meta_preinsert(bb, instr, pushLabel);
+
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) pc, opnd_create_reg(scratch), bb, instr, NULL, NULL);
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_store(drcontext, OPND_CREATE_MEMPTR(top, offsetof(ShadowFrame, pc)), opnd_create_reg(scratch)));
+
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) return_address, opnd_create_reg(scratch), bb, instr, NULL, NULL);
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_store(drcontext, OPND_CREATE_MEMPTR(top, offsetof(ShadowFrame, returnAddress)), opnd_create_reg(scratch)));
+
+    // SP after call
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_lea(drcontext, opnd_create_reg(scratch), OPND_CREATE_MEM_lea(DR_REG_XSP, DR_REG_NULL, 0, -(int) sizeof(app_pc))));
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_store(drcontext, OPND_CREATE_MEMPTR(top, offsetof(ShadowFrame, sp)), opnd_create_reg(scratch)));
+
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_store(drcontext, OPND_CREATE_MEMPTR(top, offsetof(ShadowFrame, bp)), opnd_create_reg(DR_REG_XBP)));
+
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_lea(drcontext, opnd_create_reg(top), OPND_CREATE_MEM_lea(top, DR_REG_NULL, 0, sizeof(ShadowFrame))));
+    dr_insert_write_raw_tls(drcontext, bb, instr, tls_seg, tls_offs + offsetof(ShadowStackTls, top), top);
+
+    if (drreg_unreserve_register(drcontext, bb, instr, scratch) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, top) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+    }
+}
+
+/**
+ * Insert inline instrumentation that compares a return against the top of the shadow stack. The frame is popped if
+ * sp, bp and the return address all match, otherwise, at_return is called to handle the mismatch. Assume instr is a return.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The return instruction.
+*/
+static void insertShadowStackCheck(void *drcontext, instrlist_t *bb, instr_t *instr)
+{
+    reg_id_t top;
+    reg_id_t scratch;
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &top) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &scratch) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+        return;
+    }
+
+    instr_t *slowLabel = INSTR_CREATE_label(drcontext);
+    instr_t *doneLabel = INSTR_CREATE_label(drcontext);
+    int frameOffset = -(int) sizeof(ShadowFrame);
+
+    dr_insert_read_raw_tls(drcontext, bb, instr, tls_seg, tls_offs + offsetof(ShadowStackTls, top), top);
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(top), getShadowStackTlsOpnd(offsetof(ShadowStackTls, base))));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_je, opnd_create_instr(slowLabel)));
+
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_load(drcontext, opnd_create_reg(scratch), OPND_CREATE_MEMPTR(top, frameOffset + (int) offsetof(ShadowFrame, sp))));
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), opnd_create_reg(DR_REG_XSP)));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jne, opnd_create_instr(slowLabel)));
+
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_load(drcontext, opnd_create_reg(scratch), OPND_CREATE_MEMPTR(top, frameOffset + (int) offsetof(ShadowFrame, bp))));
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), opnd_create_reg(DR_REG_XBP)));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jne, opnd_create_instr(slowLabel)));
+
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_load(drcontext, opnd_create_reg(scratch), OPND_CREATE_MEMPTR(DR_REG_XSP, 0)));
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), OPND_CREATE_MEMPTR(top, frameOffset + (int) offsetof(ShadowFrame, returnAddress))));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jne, opnd_create_instr(slowLabel)));
+
+    // Match, pop the frame
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_lea(drcontext, opnd_create_reg(top), OPND_CREATE_MEM_lea(top, DR_REG_NULL, 0, frameOffset)));
+    dr_insert_write_raw_tls(drcontext, bb, instr, tls_seg, tls_offs + offsetof(ShadowStackTls, top), top);
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_jump(drcontext, opnd_create_instr(doneLabel)));
+
+    instrlist_meta_preinsert(bb, instr, slowLabel);
+    dr_insert_clean_call(drcontext, bb, instr, (void *) at_return, false, 3, OPND_CREATE_INTPTR(instr_get_app_pc(instr)), opnd_create_reg(DR_REG_XSP), opnd_create_reg(DR_REG_XBP));
+    instrlist_meta_preinsert(bb, instr, doneLabel);
+
+    if (drreg_unreserve_register(drcontext, bb, instr, scratch) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, top) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+    }
+}
+
+/**
+ * Decide at block build time whether an indirect call/jump needs a check. processIndirectJump passes every transfer
+ * from a site in a module without CFG or without a CFG entry, whatever the target, so those are left
+ * uninstrumented. The bitmap check needs no CFG entry though, so in bitmap mode every site of a module with a bitmap
+ * is checked. The CFG entry of a checked site is looked up here once and bound into the instrumentation.
+ * 
+ * @param[in] pc The address of the call/jump instruction.
+ * @param[in] isRebuild true if the block was already counted (trace or translation), so counters are left unchanged.
+ * @param[out] modulePtr The CFG of the module containing the instruction.
+ * @param[out] sitePtr The CFG entry of the site, nullptr if it has none.
+ * @return true if the site needs a check, otherwise, false.
+*/
+static bool getCheckedSite(app_pc pc, bool isRebuild, CfgModule **modulePtr, const CfgFileSite **sitePtr)
+{
+    CfgModule *module = cfgModules->find(pc);
+    if (module == nullptr) {
+        if (!isRebuild) {
+            dr_atomic_add32_return_sum(&elidedModuleSiteCount, 1);
+        }
+
+        return false;
+    }
+
+    *modulePtr = module;
+    *sitePtr = module->getImage()->findSite(pc - module->getStart());
+
+    bool isChecked = *sitePtr != nullptr || module->getTargetBitmap() != nullptr;
+    if (!isRebuild) {
+        dr_atomic_add32_return_sum(isChecked ? &checkedSiteCount : &elidedCfgNodeSiteCount, 1);
+    }
+
+    return isChecked;
+}
+
+/**
+ * Insert an inline check that a return lands on a return site, the offset following a call, of the module containing
+ * the return. Other targets are handled by at_return_site. Returns in modules without return sites are not checked.
+ * Assume instr is a return.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The return instruction.
+*/
+static void insertReturnSiteCheck(void *drcontext, instrlist_t *bb, instr_t *instr)
+{
+    app_pc pc = instr_get_app_pc(instr);
+    CfgModule *module = cfgModules->find(pc);
+    if (module == nullptr || module->getReturnSiteBitmap() == nullptr) {
+        return;
+    }
+
+    // The bitmap is indexed with a 32 bit compare, larger modules always take the clean call
+    TargetBitmap *returnSiteBitmap = module->getReturnSiteBitmap();
+    bool hasInlineCheck = returnSiteBitmap->getSpan() <= INT_MAX;
+
+    reg_id_t target;
+    reg_id_t table;
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &target) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &table) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+        return;
+    }
+
+    instr_t *slowLabel = INSTR_CREATE_label(drcontext);
+    instr_t *doneLabel = INSTR_CREATE_label(drcontext);
+
+    if (hasInlineCheck) {
+        // Targets outside the module wrap around past the span
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_load(drcontext, opnd_create_reg(target), OPND_CREATE_MEMPTR(DR_REG_XSP, 0)));
+        instrlist_insert_mov_immed_ptrsz(drcontext, -(ptr_int_t) module->getStart(), opnd_create_reg(table), bb, instr, NULL, NULL);
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_add(drcontext, opnd_create_reg(target), opnd_create_reg(table)));
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(target), OPND_CREATE_INT32((int) returnSiteBitmap->getSpan())));
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jae, opnd_create_instr(slowLabel)));
+
+        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) returnSiteBitmap->getBits(), opnd_create_reg(table), bb, instr, NULL, NULL);
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_bt(drcontext, OPND_CREATE_MEMPTR(table, 0), opnd_create_reg(target)));
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jb, opnd_create_instr(doneLabel)));
+    }
+
+    instrlist_meta_preinsert(bb, instr, slowLabel);
+    dr_insert_clean_call(drcontext, bb, instr, (void *) at_return_site, false, 2, OPND_CREATE_INTPTR(pc), opnd_create_reg(DR_REG_XSP));
+    instrlist_meta_preinsert(bb, instr, doneLabel);
+
+    if (drreg_unreserve_register(drcontext, bb, instr, table) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, target) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+    }
+}
+
+/**
+ * Check if a function is safe to leave out of the shadow stack. A safe function (see CFG_FUNCTION_SAFE) makes no
+ * calls and cannot overwrite its own return address, and is only entered through direct calls. Calls to it and its
+ * returns are elided together, so the shadow stack stays balanced.
+ * 
+ * @param[in] pc The call target if isEntry, otherwise, the address of an instruction in the function.
+ * @param[in] isEntry true if pc has to be the entry of the function.
+ * @return true if pc is in (or at the entry of) a safe function, otherwise, false.
+*/
+static bool isSafeFunction(app_pc pc, bool isEntry)
+{
+    CfgModule *module = cfgModules->find(pc);
+    if (module == nullptr) {
+        return false;
+    }
+
+    uint64 offset = pc - module->getStart();
+    const CfgFileFunction *function = module->getImage()->findFunction(offset);
+    if (function == nullptr || (isEntry && function->start != offset)) {
+        return false;
+    }
+
+    return (function->attributes & CFG_FUNCTION_SAFE) == CFG_FUNCTION_SAFE;
+}
+
+/**
+ * Insert an inline cache check in front of an indirect call/jump. The target is compared against the targets already
+ * validated for the site, and at_inline_cache_miss is called only when none match. Branches whose target cannot be
+ * loaded inline (eg. far jumps), or whose scratch registers cannot be reserved, are checked by a clean call on every
+ * execution instead. In label mode, the label of a target in the module is compared with the label of the site first, a
+ * single table load and compare. In bitmap mode, the bit of a target in the module is tested first instead. Otherwise,
+ * switch dispatch sites check the index into their jump table or test the bit of the target among the cases, so sites
+ * with many cases do not miss the cache. PLT stubs compare their GOT slot with the target validated for it instead, and
+ * at_plt_miss is called only when the slot changes.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The indirect call/jump instruction.
+ * @param[in] module The CFG of the module containing the instruction.
+ * @param[in] site The CFG entry of the instruction, nullptr in bitmap mode if it has none.
+ * @return true if an inline cache was emitted, otherwise, false.
+*/
+static bool insertIndirectBranchCheck(void *drcontext, instrlist_t *bb, instr_t *instr, CfgModule *module, const CfgFileSite *site)
+{
+    opnd_t targetOpnd = instr_get_target(instr);
+    if (!opnd_is_reg(targetOpnd) && (!opnd_is_memory_reference(targetOpnd) || opnd_is_far_memory_reference(targetOpnd))) {
+        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_branch_ind, SPILL_SLOT_1);
+        return false;
+    }
+
+    app_pc pc = instr_get_app_pc(instr);
+    app_pc targets[INLINE_CACHE_SIZE];
+    uint count = inlineCache->getTargets(pc, targets);
+
+    // The GOT slot of a PLT stub is compared with the target validated for it, so the in-module checks do not apply
+    app_pc *pltCell = isPltStub(instr, module) ? pltCache->getCell(pc) : nullptr;
+
+    // Scratch registers must not alias any register used to compute the target
+    drvector_t allowed;
+    drreg_init_and_fill_vector(&allowed, true);
+    for (int i = 0; i < opnd_num_regs_used(targetOpnd); i++) {
+        drreg_set_vector_entry(&allowed, reg_to_pointer_sized(opnd_get_reg_used(targetOpnd, i)), false);
+    }
+
+    // The tables are indexed with a 32 bit compare, larger modules only use the inline cache
+    LabelTable *labelTable = module->getLabelTable();
+    uint32 siteLabel = site != nullptr ? module->getImage()->getSiteLabel(site) : 0;
+    bool hasLabelCheck = pltCell == nullptr && labelTable != nullptr && siteLabel != 0 && labelTable->getSpan() <= INT_MAX;
+    TargetBitmap *targetBitmap = module->getTargetBitmap();
+    bool hasBitmapCheck = pltCell == nullptr && targetBitmap != nullptr && targetBitmap->getSpan() <= INT_MAX;
+    JumpTable *jumpTable = module->findJumpTable(site);
+    bool hasJumpTableCheck = pltCell == nullptr && jumpTable != nullptr && jumpTable->getSpan() <= INT_MAX;
+    reg_id_t tableIndex = getJumpTableIndex(targetOpnd, module, jumpTable);
+
+    reg_id_t target = DR_REG_NULL;
+    reg_id_t scratch = DR_REG_NULL;
+    reg_id_t table = DR_REG_NULL;
+    bool isReserved = drreg_reserve_register(drcontext, bb, instr, &allowed, &target) == DRREG_SUCCESS &&
+                      drreg_reserve_register(drcontext, bb, instr, &allowed, &scratch) == DRREG_SUCCESS &&
+                      (!(hasLabelCheck || hasBitmapCheck || hasJumpTableCheck) || drreg_reserve_register(drcontext, bb, instr, &allowed, &table) == DRREG_SUCCESS);
+    drvector_delete(&allowed);
+
+    if (!isReserved) {
+        // Fall back to a clean call on every execution
+        unreserveRegisters(drcontext, bb, instr, target, scratch, table);
+        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_branch_ind, SPILL_SLOT_1);
+        return false;
+    }
+
+    if (opnd_is_reg(targetOpnd)) {
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_move(drcontext, opnd_create_reg(target), targetOpnd));
+    } else {
+        // Faults the same way the branch itself would
+        instr_t *load = XINST_CREATE_load(drcontext, opnd_create_reg(target), targetOpnd);
+        instr_set_translation(load, pc);
+        instrlist_meta_fault_preinsert(bb, instr, load);
+    }
 
-    reallocArguments->ptr = ptr;
-    reallocArguments->size = size;
+    // Reserved after the load since the aflags spill may need a register the target operand uses
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        unreserveRegisters(drcontext, bb, instr, target, scratch, table);
+        dr_insert_mbr_instrumentation(drcontext, bb, instr, (app_pc) at_branch_ind, SPILL_SLOT_1);
+        return false;
+    }
 
-    *user_data = (void *) reallocArguments;
-}
+    instr_t *doneLabel = INSTR_CREATE_label(drcontext);
+    if (hasLabelCheck) {
+        // Targets in the module pass if their label is the label of the site, targets outside of it wrap around past
+        // the span and fall through to the inline cache
+        instr_t *cacheLabel = INSTR_CREATE_label(drcontext);
+        instrlist_insert_mov_immed_ptrsz(drcontext, -(ptr_int_t) module->getStart(), opnd_create_reg(scratch), bb, instr, NULL, NULL);
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_add(drcontext, opnd_create_reg(scratch), opnd_create_reg(target)));
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), OPND_CREATE_INT32((int) labelTable->getSpan())));
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jae, opnd_create_instr(cacheLabel)));
+
+        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) labelTable->getEntries(), opnd_create_reg(table), bb, instr, NULL, NULL);
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_movzx(drcontext, opnd_create_reg(reg_resize_to_opsz(table, OPSZ_4)),
+                                    opnd_create_base_disp(table, scratch, sizeof(uint16), 0, OPSZ_2)));
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(reg_resize_to_opsz(table, OPSZ_4)), OPND_CREATE_INT32(siteLabel)));
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_je, opnd_create_instr(doneLabel)));
+        instrlist_meta_preinsert(bb, instr, cacheLabel);
+    } else if (hasBitmapCheck) {
+        insertBitmapTest(drcontext, bb, instr, target, scratch, table, module->getStart(), targetBitmap->getSpan(), targetBitmap->getBits(), doneLabel);
+    } else if (hasJumpTableCheck) {
+        // The target was loaded from a read-only table, so an index within the table can only pick one of the cases
+        if (tableIndex != DR_REG_NULL) {
+            // The aflags spill may hold the index register, so its application value is copied out first. Without it,
+            // only the bit test is done
+            if (drreg_get_app_value(drcontext, bb, instr, tableIndex, scratch) == DRREG_SUCCESS) {
+                instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), OPND_CREATE_INT32((int) jumpTable->getEntryCount())));
+                instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jb, opnd_create_instr(doneLabel)));
+            }
+        }
 
-static void wrap_realloc_post(void *wrapcxt, void *user_data)
-{
-    void *address = drwrap_get_retval(wrapcxt);
-    if (address == NULL) {
-        return;
+        insertBitmapTest(drcontext, bb, instr, target, scratch, table, module->getStart() + jumpTable->getTargetStart(), jumpTable->getSpan(),
+                            jumpTable->getBits(), doneLabel);
     }
 
-    ReallocArguments *reallocArguments = (ReallocArguments *) user_data;
-    DR_ASSERT(reallocArguments != NULL);
-
-    void *ptr = reallocArguments->ptr;
-    size_t size = reallocArguments->size;
-    dr_thread_free(dr_get_current_drcontext(), reallocArguments, sizeof(ReallocArguments));
+    void *missCallee;
+    if (pltCell != nullptr) {
+        // The cell is read at run time, a rebound slot misses once without rebuilding the fragment
+        instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) pltCell, opnd_create_reg(scratch), bb, instr, NULL, NULL);
+        instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(target), OPND_CREATE_MEMPTR(scratch, 0)));
+        instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_je, opnd_create_instr(doneLabel)));
+        missCallee = (void *) at_plt_miss;
+    } else {
+        for (uint i = 0; i < count; i++) {
+            instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) targets[i], opnd_create_reg(scratch), bb, instr, NULL, NULL);
+            instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(target), opnd_create_reg(scratch)));
+            instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_je, opnd_create_instr(doneLabel)));
+        }
 
-    if (ptr != NULL) {
-        HeapNode *node = findNodeInHeapList(&heapList, ptr);
-        DR_ASSERT(node != nullptr);
+        missCallee = isAsync ? (void *) at_inline_cache_miss_async : (void *) at_inline_cache_miss;
+    }
 
-        bool isRemoved = removeNodeFromHeapList(&heapList, node);
-        DR_ASSERT(isRemoved);
+    dr_insert_clean_call(drcontext, bb, instr, missCallee, false, 4, OPND_CREATE_INTPTR(pc), OPND_CREATE_INTPTR(module), OPND_CREATE_INTPTR(site),
+                            opnd_create_reg(target));
+    instrlist_meta_preinsert(bb, instr, doneLabel);
 
-        delete node;
+    if (drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
     }
+    unreserveRegisters(drcontext, bb, instr, target, scratch, table);
 
-    HeapNode *node = new HeapNode(address, size);
-    addNodeToHeapList(&heapList, node);
+    return true;
+}
 
-    //dr_fprintf(STDERR, "[realloc] Address: %p, ptr = %p, size = %ld\n", address, ptr, size);
+/**
+ * Release the scratch registers of an inline check. Registers that were not reserved are DR_REG_NULL and skipped.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The instruction the registers were reserved for.
+ * @param[in] target The register holding the target.
+ * @param[in] scratch The scratch register.
+ * @param[in] table The table register.
+*/
+static void unreserveRegisters(void *drcontext, instrlist_t *bb, instr_t *instr, reg_id_t target, reg_id_t scratch, reg_id_t table)
+{
+    reg_id_t regs[] = { table, scratch, target };
+    for (reg_id_t reg : regs) {
+        if (reg != DR_REG_NULL && drreg_unreserve_register(drcontext, bb, instr, reg) != DRREG_SUCCESS) {
+            DR_ASSERT(false);
+        }
+    }
 }
 
-static void wrap_reallocarray_pre(void *wrapcxt, OUT void **user_data)
+/**
+ * Insert an inline bit test of a target against a bitmap over [start, start + span). Jumps to passLabel if the bit of
+ * the target is set, falls through if it is not or the target is outside the range.
+ * 
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The instruction to insert the test in front of.
+ * @param[in] target The register holding the target.
+ * @param[in] scratch A scratch register, receives the offset of the target from start.
+ * @param[in] table A scratch register, receives the address of the bitmap.
+ * @param[in] start The address of bit 0.
+ * @param[in] span The number of bits, at most INT_MAX.
+ * @param[in] bits The bitmap.
+ * @param[in] passLabel The label to jump to if the bit is set.
+ * @pre The arithmetic flags are reserved.
+*/
+static void insertBitmapTest(void *drcontext, instrlist_t *bb, instr_t *instr, reg_id_t target, reg_id_t scratch, reg_id_t table, app_pc start,
+                                size_t span, const byte *bits, instr_t *passLabel)
 {
-    void *ptr = (void *) drwrap_get_arg(wrapcxt, 0);
-    size_t nmemb = (size_t) drwrap_get_arg(wrapcxt, 1);
-    size_t size = (size_t) drwrap_get_arg(wrapcxt, 2);
+    // Targets below start wrap around past the span, bt shifts, loads and tests in one go
+    instr_t *failLabel = INSTR_CREATE_label(drcontext);
+    instrlist_insert_mov_immed_ptrsz(drcontext, -(ptr_int_t) start, opnd_create_reg(scratch), bb, instr, NULL, NULL);
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_add(drcontext, opnd_create_reg(scratch), opnd_create_reg(target)));
+    instrlist_meta_preinsert(bb, instr, XINST_CREATE_cmp(drcontext, opnd_create_reg(scratch), OPND_CREATE_INT32((int) span)));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jae, opnd_create_instr(failLabel)));
+
+    instrlist_insert_mov_immed_ptrsz(drcontext, (ptr_int_t) bits, opnd_create_reg(table), bb, instr, NULL, NULL);
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_bt(drcontext, OPND_CREATE_MEMPTR(table, 0), opnd_create_reg(scratch)));
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jb, opnd_create_instr(passLabel)));
+    instrlist_meta_preinsert(bb, instr, failLabel);
+}
 
-    if (ptr != NULL && findNodeInHeapList(&heapList, ptr) == nullptr) {
-        dr_fprintf(STDERR, "Using reallocarray on unallocated memory: %p\n", ptr);
-        printCallTrace();
-        dr_abort();
+/**
+ * Get the index register of a jump through a known jump table, eg. jmp [table + index * 8]. Only tables in read-only
+ * memory qualify, the entries of a writable table could be changed to point anywhere.
+ * 
+ * @param[in] targetOpnd The target operand of the jump.
+ * @param[in] module The CFG of the module containing the jump.
+ * @param[in] jumpTable The jump table of the site, may be nullptr.
+ * @return The index register, or DR_REG_NULL if the jump does not index the table directly.
+*/
+static reg_id_t getJumpTableIndex(opnd_t targetOpnd, CfgModule *module, JumpTable *jumpTable)
+{
+    if (jumpTable == nullptr || jumpTable->getTable() == 0 || jumpTable->getEntryCount() == 0 || jumpTable->getEntryCount() > INT_MAX) {
+        return DR_REG_NULL;
     }
 
-    ReallocarrayArguments *reallocarrayArguments = (ReallocarrayArguments *) dr_thread_alloc(dr_get_current_drcontext(), sizeof(ReallocarrayArguments));
-    DR_ASSERT(reallocarrayArguments != NULL);
+    if (!opnd_is_base_disp(targetOpnd) || opnd_get_base(targetOpnd) != DR_REG_NULL || opnd_get_index(targetOpnd) == DR_REG_NULL ||
+        opnd_get_scale(targetOpnd) != sizeof(app_pc)) {
+        return DR_REG_NULL;
+    }
 
-    reallocarrayArguments->ptr = ptr;
-    reallocarrayArguments->nmemb = nmemb;
-    reallocarrayArguments->size = size;
+    app_pc table = module->getStart() + jumpTable->getTable();
+    if ((app_pc) (ptr_int_t) opnd_get_disp(targetOpnd) != table) {
+        return DR_REG_NULL;
+    }
 
-    *user_data = (void *) reallocarrayArguments;
+    byte *base;
+    size_t size;
+    uint prot;
+    if (!dr_query_memory(table, &base, &size, &prot) || (prot & DR_MEMPROT_WRITE) != 0 ||
+        table + jumpTable->getEntryCount() * sizeof(app_pc) > base + size) {
+        return DR_REG_NULL;
+    }
+
+    return opnd_get_index(targetOpnd);
 }
 
-static void wrap_reallocarray_post(void *wrapcxt, void *user_data)
+/**
+ * Check if an indirect jump is a PLT stub, eg. jmp [rip + disp], loading its target from a GOT slot of its own module.
+ * 
+ * @param[in] instr The indirect jump instruction.
+ * @param[in] module The CFG of the module containing the jump.
+ * @return true if the jump is a PLT stub, otherwise, false.
+*/
+static bool isPltStub(instr_t *instr, CfgModule *module)
 {
-    void *address = drwrap_get_retval(wrapcxt);
-    if (address == NULL) {
-        return;
+    if (instr_is_call(instr)) {
+        return false;
     }
 
-    ReallocarrayArguments *reallocarrayArguments = (ReallocarrayArguments *) user_data;
-    DR_ASSERT(reallocarrayArguments != NULL);
+    opnd_t targetOpnd = instr_get_target(instr);
+    if (!opnd_is_rel_addr(targetOpnd) && !opnd_is_abs_addr(targetOpnd)) {
+        return false;
+    }
 
-    void *ptr = reallocarrayArguments->ptr;
-    size_t nmemb = reallocarrayArguments->nmemb;
-    size_t size = reallocarrayArguments->size;
-    dr_thread_free(dr_get_current_drcontext(), reallocarrayArguments, sizeof(ReallocarrayArguments));
+    return module->contains((app_pc) opnd_get_addr(targetOpnd));
+}
 
-    if (ptr != NULL) {
-        HeapNode *node = findNodeInHeapList(&heapList, ptr);
-        DR_ASSERT(node != nullptr);
+/**
+ * Get the GOT slot a PLT stub loads its target from.
+ * 
+ * @param[in] pc The address of the PLT stub, as accepted by isPltStub.
+ * @return The address of the slot, or nullptr if the stub cannot be decoded.
+*/
+static app_pc getPltSlot(app_pc pc)
+{
+    void *drcontext = dr_get_current_drcontext();
 
-        bool isRemoved = removeNodeFromHeapList(&heapList, node);
-        DR_ASSERT(isRemoved);
+    instr_t instr;
+    instr_init(drcontext, &instr);
+    app_pc next = decode(drcontext, pc, &instr);
 
-        delete node;
+    app_pc slot = nullptr;
+    if (next != NULL && instr_is_mbr(&instr)) {
+        opnd_t targetOpnd = instr_get_target(&instr);
+        if (opnd_is_rel_addr(targetOpnd) || opnd_is_abs_addr(targetOpnd)) {
+            slot = (app_pc) opnd_get_addr(targetOpnd);
+        }
     }
+    instr_free(drcontext, &instr);
 
-    HeapNode *node = new HeapNode(address, nmemb * size);
-    addNodeToHeapList(&heapList, node);
-
-    //dr_fprintf(STDERR, "[reallocarray] Address: %p, ptr = %p, nmemb = %ld, size = %ld\n", address, ptr, nmemb, size);
+    return slot;
 }
 
-static void wrap_free_pre(void *wrapcxt, OUT void **user_data)
+/**
+ * Get the GOT slot a PLT relocation of a module binds, from the DT_JMPREL table of its dynamic section.
+ * 
+ * @param[in] module The CFG of the module.
+ * @param[in] index The index of the relocation, as pushed by the lazy binding entry.
+ * @return The address of the slot, or nullptr if the module has no such relocation.
+*/
+static app_pc getJumpSlot(CfgModule *module, uint64 index)
 {
-    void *ptr = drwrap_get_arg(wrapcxt, 0);
-    if (ptr == NULL) {
-        return;
+    app_pc start = module->getStart();
+    const Elf64_Ehdr *header = (const Elf64_Ehdr *) start;
+    if (!dr_memory_is_readable(start, sizeof(Elf64_Ehdr)) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_phentsize != sizeof(Elf64_Phdr) || !dr_memory_is_readable(start + header->e_phoff, header->e_phnum * sizeof(Elf64_Phdr))) {
+        return nullptr;
     }
 
-    HeapNode *node = findNodeInHeapList(&heapList, ptr);
-    if (node == nullptr) {
-        dr_fprintf(STDERR, "Freeing unallocated memory: " PFX "\n", ptr);
-        printCallTrace();
-        dr_abort();
+    // Offsets are taken from the start of the first mapped page, as CFG offsets are
+    const Elf64_Phdr *segments = (const Elf64_Phdr *) (start + header->e_phoff);
+    const Elf64_Phdr *dynamic = nullptr;
+    bool hasLoad = false;
+    uint64 base = 0;
+    for (uint32 i = 0; i < header->e_phnum; i++) {
+        if (segments[i].p_type == PT_LOAD && (!hasLoad || segments[i].p_vaddr < base)) {
+            base = segments[i].p_vaddr;
+            hasLoad = true;
+        } else if (segments[i].p_type == PT_DYNAMIC) {
+            dynamic = &segments[i];
+        }
     }
-    DR_ASSERT(node->getAddress() == ptr);
+    base = ALIGN_BACKWARD(base, MODULE_ID_PAGE_SIZE);
 
-    bool isRemoved = removeNodeFromHeapList(&heapList, node);
-    DR_ASSERT(isRemoved);
+    if (dynamic == nullptr || dynamic->p_vaddr < base || !dr_memory_is_readable(start + dynamic->p_vaddr - base, dynamic->p_filesz)) {
+        return nullptr;
+    }
 
-    //dr_fprintf(STDERR, "[free] ptr: %p\n", ptr);
+    uint64 table = 0;
+    uint64 tableSize = 0;
+    uint64 tableType = 0;
+    const Elf64_Dyn *entries = (const Elf64_Dyn *) (start + dynamic->p_vaddr - base);
+    for (uint64 i = 0; i < dynamic->p_filesz / sizeof(Elf64_Dyn) && entries[i].d_tag != DT_NULL; i++) {
+        if (entries[i].d_tag == DT_JMPREL) {
+            table = entries[i].d_un.d_ptr;
+        } else if (entries[i].d_tag == DT_PLTRELSZ) {
+            tableSize = entries[i].d_un.d_val;
+        } else if (entries[i].d_tag == DT_PLTREL) {
+            tableType = entries[i].d_un.d_val;
+        }
+    }
+
+    if (table == 0 || tableType != DT_RELA || index >= tableSize / sizeof(Elf64_Rela)) {
+        return nullptr;
+    }
+
+    // The loader may have relocated the address of the table in place
+    const Elf64_Rela *relocation = (const Elf64_Rela *) (module->contains((app_pc) table) ? (app_pc) table : start + table - base) + index;
+    if (!module->contains((app_pc) relocation) || !dr_memory_is_readable((app_pc) relocation, sizeof(Elf64_Rela)) ||
+        ELF64_R_TYPE(relocation->r_info) != R_X86_64_JUMP_SLOT) {
+        return nullptr;
+    }
 
-    delete node;
+    return start + relocation->r_offset - base;
 }
 
 /**
- * Add node to heap list.
+ * Check if an address is the lazy binding entry of a PLT stub, eg. push <relocation index>; jmp <PLT0>, which an
+ * unresolved GOT slot points to. Only the entry binding the slot itself is accepted, the entry of another import
+ * would have the loader resolve and call that import instead.
  * 
- * @param[in] heapList The pointer to the heap list object.
- * @param[in] node The pointer to the HeapNode object.
- * 
- * @pre heapList != nullptr && node != nullptr
+ * @param[in] module The CFG of the module containing the stub.
+ * @param[in] pc The address to check.
+ * @param[in] slot The GOT slot pc was loaded from.
+ * @return true if pc is the lazy binding entry of slot, otherwise, false.
 */
-static void addNodeToHeapList(std::list<HeapNode *> *heapList, HeapNode *node)
+static bool isLazyBindingStub(CfgModule *module, app_pc pc, app_pc slot)
 {
-    DR_ASSERT(heapList != nullptr && node != nullptr);
+    if (!module->contains(pc) || slot == nullptr) {
+        return false;
+    }
+
+    void *drcontext = dr_get_current_drcontext();
 
-    heapList->push_back(node);
+    instr_t instr;
+    instr_init(drcontext, &instr);
+    app_pc next = decode(drcontext, pc, &instr);
+    if (next != NULL && instr_get_opcode(&instr) == OP_endbr64) {
+        // Entries of IBT enabled PLTs start with an end branch
+        instr_reset(drcontext, &instr);
+        next = decode(drcontext, next, &instr);
+    }
+
+    bool isPush = next != NULL && instr_get_opcode(&instr) == OP_push_imm && opnd_is_immed_int(instr_get_src(&instr, 0));
+    uint64 index = isPush ? (uint64) opnd_get_immed_int(instr_get_src(&instr, 0)) : 0;
+    if (isPush) {
+        instr_reset(drcontext, &instr);
+        next = decode(drcontext, next, &instr);
+    }
+
+    bool res = isPush && next != NULL && instr_is_ubr(&instr) && module->contains(instr_get_branch_target_pc(&instr));
+    instr_free(drcontext, &instr);
+
+    return res && getJumpSlot(module, index) == slot;
 }
 
 /**
- * Remove node from heap list.
+ * Check if an address is a sigreturn trampoline, eg. mov rax, SYS_rt_sigreturn; syscall, such as __restore_rt of libc.
  * 
- * @param[in] heapList The pointer to the heap list object.
- * @return true if there successfully removed from list, otherwise, false.
- * 
- * @pre heapList != nullptr
+ * @param[in] pc The address to check.
+ * @return true if pc is a sigreturn trampoline, otherwise, false.
 */
-static bool removeNodeFromHeapList(std::list<HeapNode *> *heapList, HeapNode *node)
+static bool isSigreturnTrampoline(app_pc pc)
 {
-    DR_ASSERT(heapList != nullptr && node != nullptr);
+    void *drcontext = dr_get_current_drcontext();
 
-    if (std::find(heapList->begin(), heapList->end(), node) != heapList->end()) {
-        heapList->remove(node);
-        return true;
+    instr_t instr;
+    instr_init(drcontext, &instr);
+    app_pc next = decode(drcontext, pc, &instr);
+
+    // libc encodes the mov either with a sign extended or with a full immediate
+    ptr_int_t value;
+    bool isMov = next != NULL && instr_is_mov_constant(&instr, &value) && value == SYS_rt_sigreturn &&
+                 opnd_is_reg(instr_get_dst(&instr, 0)) && reg_to_pointer_sized(opnd_get_reg(instr_get_dst(&instr, 0))) == DR_REG_XAX;
+    if (isMov) {
+        instr_reset(drcontext, &instr);
+        next = decode(drcontext, next, &instr);
     }
 
-    return false;
+    bool res = isMov && next != NULL && instr_get_opcode(&instr) == OP_syscall;
+    instr_free(drcontext, &instr);
+
+    return res;
 }
 
 /**
- * Find node in heap list.
- * 
- * @param[in] heapList The pointer to the heap list object.
- * @param[in] address The address associated to the HeapNode object.
- * @return A HeapNode object if found, otherwise, nullptr.
+ * Insert inline instrumentation that increments a counter of the current thread. Does nothing if statistics are
+ * disabled.
  * 
- * @pre heapList != nullptr
+ * @param[in] drcontext The DynamoRIO context.
+ * @param[in] bb The basic block being instrumented.
+ * @param[in] instr The instruction to count.
+ * @param[in] counter The counter to increment.
 */
-static HeapNode *findNodeInHeapList(std::list<HeapNode *> *heapList, void *address)
+static void insertCounterIncrement(void *drcontext, instrlist_t *bb, instr_t *instr, StatCounter counter)
 {
-    DR_ASSERT(heapList != nullptr);
+    if (statistics == nullptr) {
+        return;
+    }
 
-    for (auto node : *heapList) {
-        if (node->getAddress() == address) {
-            return node;
-        }
+    reg_id_t reg;
+    if (drreg_reserve_register(drcontext, bb, instr, &scratchRegs, &reg) != DRREG_SUCCESS ||
+        drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
+    }
+
+    dr_insert_read_raw_tls(drcontext, bb, instr, stats_tls_seg, stats_tls_offs, reg);
+    instrlist_meta_preinsert(bb, instr, INSTR_CREATE_add(drcontext,
+        OPND_CREATE_MEM64(reg, offsetof(ThreadStats, counters) + counter * sizeof(uint64)), OPND_CREATE_INT8(1)));
+
+    if (drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, reg) != DRREG_SUCCESS) {
+        DR_ASSERT(false);
     }
-    
-    return nullptr;
 }
 
 /**
- * Push node to call stack.
- * 
- * @param[in] callStack The pointer to the call stack object.
- * @param[in] node The pointer to the CallNode object.
+ * Create a memory operand referring to a field of the current thread's ShadowStackTls.
  * 
- * @pre callStack != nullptr && node != nullptr
+ * @param[in] fieldOffset The offset of the field within ShadowStackTls.
+ * @return The operand.
 */
-static void pushNodeToCallStack(std::stack<CallNode *> *callStack, CallNode *node)
+static opnd_t getShadowStackTlsOpnd(size_t fieldOffset)
 {
-    DR_ASSERT(callStack != nullptr && node != nullptr);
-
-    callStack->push(node);
+    return opnd_create_far_base_disp(tls_seg, DR_REG_NULL, DR_REG_NULL, 0, tls_offs + fieldOffset, OPSZ_PTR);
 }
 
 /**
- * Pop node from call stack.
- * 
- * @param[in] callStack The pointer to the call stack object.
- * @return nullptr if there is nothing to pop, otherwise, pointer to the CallNode object. The object needs to be deleted by caller.
+ * Get the statistics of the current thread.
  * 
- * @pre callStack != nullptr
+ * @return Pointer to the statistics, nullptr if statistics are disabled or the thread has none.
 */
-static CallNode *popNodeFromCallStack(std::stack<CallNode *> *callStack)
+static ThreadStats *getThreadStats()
 {
-    DR_ASSERT(callStack != nullptr);
-
-    if (callStack->empty()) {
+    if (statistics == nullptr) {
         return nullptr;
     }
 
-    CallNode *node = callStack->top();
-    callStack->pop();
+    return *(ThreadStats **) ((byte *) dr_get_dr_segment_base(stats_tls_seg) + stats_tls_offs);
+}
+
+static void setThreadStats(ThreadStats *stats)
+{
+    *(ThreadStats **) ((byte *) dr_get_dr_segment_base(stats_tls_seg) + stats_tls_offs) = stats;
+}
 
-    return node;
+static void countEvent(StatCounter counter)
+{
+    ThreadStats *stats = getThreadStats();
+    if (stats != nullptr) {
+        stats->counters[counter]++;
+    }
 }
 
 /**
- * Saves the call information in the call stack. Assume current instruction is a call.
+ * Read the TSC for a latency measurement.
  * 
- * @param[in] pc The current pc value.
- * @param[in] bp The current base pointer value.
- * @param[in] sp The current sp value.
+ * @return The TSC, or 0 if statistics are disabled.
 */
-static void saveCall(app_pc pc, reg_t bp, reg_t sp)
+static uint64 readTimestamp()
 {
-    void *drcontext = dr_get_current_drcontext();
-
-    // SP after call
-    reg_t next_sp = sp - sizeof(app_pc);
-
-    instr_t instr;
-    instr_init(drcontext, &instr);
-    app_pc res = decode(drcontext, pc, &instr);
-    DR_ASSERT(res != NULL);
-
-    // Return address
-    app_pc return_address = pc + instr_length(drcontext, &instr);
+    return statistics == nullptr ? 0 : __rdtsc();
+}
 
-    instr_free(drcontext, &instr);
+/**
+ * Record the latency of an operation started at readTimestamp() in the histogram of the current thread.
+ * 
+ * @param[in] timer The timer of the operation.
+ * @param[in] start The value returned by readTimestamp() before the operation.
+*/
+static void recordLatency(StatTimer timer, uint64 start)
+{
+    ThreadStats *stats = getThreadStats();
+    if (stats != nullptr) {
+        Statistics::recordLatency(stats, timer, __rdtsc() - start);
+    }
+}
 
+static ShadowStack *getShadowStack()
+{
+    void *drcontext = dr_get_current_drcontext();
     ThreadContext *threadContext = (ThreadContext *) drmgr_get_tls_field(drcontext, tls_idx);
     DR_ASSERT(threadContext != NULL);
 
-    std::stack<CallNode *> *callStack = threadContext->getCallStack();
-
-    CallNode *node = new CallNode(pc, next_sp, bp, return_address);
-    pushNodeToCallStack(callStack, node);
+    return threadContext->getShadowStack();
 }
 
 /**
@@ -623,48 +1949,37 @@ static void saveCall(app_pc pc, reg_t bp, reg_t sp)
 */
 static CheckReturnResult checkReturn(reg_t sp, reg_t bp, app_pc target_addr, bool *hasLongJmpPtr)
 {
-    void *drcontext = dr_get_current_drcontext();
-    ThreadContext *threadContext = (ThreadContext *) drmgr_get_tls_field(drcontext, tls_idx);
-    DR_ASSERT(threadContext != NULL);
+    ShadowStack *shadowStack = getShadowStack();
 
-    std::stack<CallNode *> *callStack = threadContext->getCallStack();
-
-    bool found = false;
     bool hasLongJmp = false;
-    CallNode *node;
-    while (!found) {
-        node = popNodeFromCallStack(callStack);
-        if (node == nullptr) {
+    ShadowFrame *frame;
+    while (true) {
+        frame = shadowStack->top();
+        if (frame == nullptr) {
             return EMPTY_CALLSTACK;
         }
 
-        if (node->getSp() > sp) {
-            pushNodeToCallStack(callStack, node); // Push node back to callstack
+        if (frame->sp > sp) {
             return SP_NOT_FOUND;
         }
 
-        DR_ASSERT(node != nullptr && node->getSp() <= sp);
-
-        if (node->getSp() == sp) {
-            found = true;
-            continue;
+        if (frame->sp == sp) {
+            break;
         }
 
         // Unwinding stack
         hasLongJmp = true;
-        delete node;
+        shadowStack->pop();
     }
 
-    DR_ASSERT(node != nullptr && node->getSp() == sp);
+    DR_ASSERT(frame != nullptr && frame->sp == sp);
 
-    if (node->getBp() == bp && node->getReturnAddress() == target_addr) {
-        delete node;
+    if (frame->bp == bp && frame->returnAddress == target_addr) {
+        shadowStack->pop();
         *hasLongJmpPtr = hasLongJmp;
         return SUCCESS;
     }
 
-    pushNodeToCallStack(callStack, node); // Push node back to callstack
-
     return FAIL;
 }
 
@@ -677,74 +1992,148 @@ static CheckReturnResult checkReturn(reg_t sp, reg_t bp, app_pc target_addr, boo
 */
 static CheckCfgResult checkCfg(app_pc instr_addr, app_pc target_addr)
 {
-    SymbolInfo *symbolInfo = getSymbolInfo(instr_addr);
-    if (symbolInfo == nullptr) {
-        return UNKNOWN_MODULE;
+    CfgModule *module = cfgModules->find(instr_addr);
+    if (module == nullptr) {
+        // No CFG for the module of instr_addr, if any
+        module_data_t *data = dr_lookup_module(instr_addr);
+        if (data == NULL) {
+            return UNKNOWN_MODULE;
+        }
+
+        dr_free_module_data(data);
+        return DIFFERENT_MODULE;
     }
 
-    std::string moduleName = symbolInfo->getModuleName();
-    if (moduleName.empty()) {
-        delete symbolInfo;
-        return UNKNOWN_MODULE;
+    const CfgFileSite *site = module->getImage()->findSite(instr_addr - module->getStart());
+    if (site == nullptr && module->getTargetBitmap() == nullptr) {
+        return CFGNODE_NOT_FOUND;
     }
 
-    std::string appname = std::string(dr_get_application_name());
-    if (moduleName != appname) {
-        delete symbolInfo;
-        return DIFFERENT_MODULE;
+    return checkCfgEdge(module, site, target_addr);
+}
+
+/**
+ * Check if the control flow transfer from a site with a CFG entry is valid. In bitmap mode, sites without a CFG entry
+ * are checked too, against the bitmap within the module and only for the start of a function outside of it.
+ * 
+ * @param[in] module The CFG of the module containing the call/jump instruction.
+ * @param[in] site The CFG entry of the call/jump instruction, nullptr in bitmap mode if it has none.
+ * @param[in] target_addr The address of the destination.
+ * @return A CheckCfgResult value.
+*/
+static CheckCfgResult checkCfgEdge(CfgModule *module, const CfgFileSite *site, app_pc target_addr)
+{
+    if (module->contains(target_addr)) {
+        // Target within same binary, either an exact edge or a target in the class of the site
+        uint64 offset = target_addr - module->getStart();
+        TargetBitmap *targetBitmap = module->getTargetBitmap();
+        if (targetBitmap != nullptr) {
+            // Coarse mode, any valid target is allowed
+            return targetBitmap->contains(offset) ? CFGEDGE_FOUND : CFGEDGE_NOT_FOUND;
+        }
+
+        if (module->getImage()->hasOffsetEdge(site, offset)) {
+            return CFGEDGE_FOUND;
+        }
+
+        uint32 siteLabel = module->getImage()->getSiteLabel(site);
+        if (siteLabel == 0) {
+            return CFGEDGE_NOT_FOUND;
+        }
+
+        LabelTable *labelTable = module->getLabelTable();
+        uint32 targetLabel = labelTable != nullptr ? labelTable->get(offset) : module->getImage()->findTargetLabel(offset);
+
+        return targetLabel == siteLabel ? CFGEDGE_FOUND : CFGEDGE_NOT_FOUND;
     }
 
-    std::unordered_map<uint64, CfgNode *>::const_iterator it = cfgMap.find(symbolInfo->getModuleRelativeOffset());
-    if (it == cfgMap.end()) {
-        delete symbolInfo;
-        return CFGNODE_NOT_FOUND;
+    if (symbolEdgeIndex->hasEdge(site, target_addr)) {
+        // Target is a resolved external function
+        return CFGEDGE_FOUND;
     }
 
-    DR_ASSERT(it->first == symbolInfo->getModuleRelativeOffset());
-    CfgNode *node = it->second;
+    // Labeled sites, and sites without a CFG entry in bitmap mode, may call any address-taken function, eg. a callback
+    // passed in by another module
+    if ((site == nullptr || module->getImage()->getSiteLabel(site) != 0) && isAddressTakenFunction(target_addr)) {
+        return CFGEDGE_FOUND;
+    }
 
     SymbolInfo *targetSymbolInfo = getSymbolInfo(target_addr);
     if (targetSymbolInfo == nullptr) {
-        delete symbolInfo;
         return UNKNOWN_TARGET;
     }
 
+    // Without a symbol, eg. offline or in a stripped module, whether the target starts a function is unknown
     std::string targetModuleName = targetSymbolInfo->getModuleName();
-    if (targetModuleName.empty()) {
+    if (targetModuleName.empty() || targetSymbolInfo->getSymbolName().empty()) {
         delete targetSymbolInfo;
-        delete symbolInfo;
         return UNKNOWN_TARGET;
     }
 
+    // External target
     CheckCfgResult res = CFGEDGE_NOT_FOUND;
-    if (targetModuleName == moduleName) {
-        // Target within same binary
-        if (node->hasOffsetEdge(targetSymbolInfo->getModuleRelativeOffset())) {
+    if (site == nullptr) {
+        // No edges to match, any function start is allowed
+        res = targetSymbolInfo->getSymbolRelativeOffset() == 0 ? CFGEDGE_FOUND : NOT_BEGINNING;
+    } else if (targetSymbolInfo->getSymbolRelativeOffset() == 0) {
+        // Start of function, names that did not resolve to an address (eg. versioned symbols) are matched by name
+        if (module->getImage()->hasSymbolEdge(site, targetSymbolInfo->getSymbolName(), targetModuleName, true)) {
+            // Found similar name
             res = CFGEDGE_FOUND;
         }
     } else {
-        // External target
-        if (targetSymbolInfo->getSymbolRelativeOffset() == 0) {
-            // Start of function
-            if (node->hasSymbolEdge(targetSymbolInfo->getSymbolName(), targetModuleName, true)) {
-                // Found similar name
-                res = CFGEDGE_FOUND;
-            }
-        } else {
-            // Jumping to middle of function (possibly ROP)
-            res = NOT_BEGINNING;
-        }
+        // Jumping to middle of function (possibly ROP)
+        res = NOT_BEGINNING;
     }
 
     delete targetSymbolInfo;
-    delete symbolInfo;
 
     return res;
 }
 
-static void processIndirectJump(app_pc instr_addr, app_pc target_addr)
+/**
+ * Check if the start of a function in another module may be the target of a labeled site, its address being taken
+ * there, as the CFG of that module tells by labeling it. Imported functions whose address is taken by the module of
+ * the site, and functions of modules without a CFG, are only allowed through the S: edges of the site.
+ * 
+ * @param[in] target_addr The start of the function.
+ * @return true if the function may be the target of a labeled site, otherwise, false.
+*/
+static bool isAddressTakenFunction(app_pc target_addr)
+{
+    CfgModule *targetModule = cfgModules->find(target_addr);
+
+    return targetModule != nullptr && targetModule->getImage()->findTargetLabel(target_addr - targetModule->getStart()) != 0;
+}
+
+/**
+ * Check an indirect call/jump against the CFG and abort if it is invalid.
+ * 
+ * @param[in] instr_addr The address of the call/jump instruction.
+ * @param[in] target_addr The address of the destination.
+ * @return The CheckCfgResult value of a transfer that is allowed.
+*/
+static CheckCfgResult processIndirectJump(app_pc instr_addr, app_pc target_addr)
 {
+    uint64 start = readTimestamp();
     CheckCfgResult res = checkCfg(instr_addr, target_addr);
+    recordLatency(STAT_TIMER_CHECK_CFG, start);
+
+    return enforceCfgResult(instr_addr, target_addr, res);
+}
+
+/**
+ * Abort if the result of a CFG check is an invalid edge.
+ * 
+ * @param[in] instr_addr The address of the call/jump instruction.
+ * @param[in] target_addr The address of the destination.
+ * @param[in] res The result of checkCfg or checkCfgEdge.
+ * @return The CheckCfgResult value of a transfer that is allowed.
+*/
+static CheckCfgResult enforceCfgResult(app_pc instr_addr, app_pc target_addr, CheckCfgResult res)
+{
+    countEvent((StatCounter) (STAT_CFG_UNKNOWN_MODULE + res));
+
     switch (res) {
         case UNKNOWN_MODULE: // Cannot determine instr_addr module
             // Fallthrough
@@ -756,7 +2145,7 @@ static void processIndirectJump(app_pc instr_addr, app_pc target_addr)
             // Fallthrough
 
         case CFGNODE_NOT_FOUND: // Static analysis did find any edges for instr_addr
-            return; // Pass for now until we find a better way to handle
+            return res; // Pass for now until we find a better way to handle
 
         case NOT_BEGINNING:
             // Fallthrough
@@ -767,26 +2156,52 @@ static void processIndirectJump(app_pc instr_addr, app_pc target_addr)
             dr_abort();
 
         case CFGEDGE_FOUND: // target_addr match a valid edge
-            return;
+            return res;
     }
+
+    DR_ASSERT(false); // Should not be here
+    return res;
 }
 
 static void printCallTrace()
 {
-    void *drcontext = dr_get_current_drcontext();
-    ThreadContext *threadContext = (ThreadContext *) drmgr_get_tls_field(drcontext, tls_idx);
-    DR_ASSERT(threadContext != NULL);
-
-    std::stack<CallNode *> *callStack = threadContext->getCallStack();
+    ShadowStack *shadowStack = getShadowStack();
 
     dr_fprintf(STDERR, "Call Trace:\n");
 
-    CallNode *node;
-    while ((node = popNodeFromCallStack(callStack)) != nullptr) {
-        dr_fprintf(STDERR, "#%ld  %s\n", callStack->size(), getSymbolString(node->getPc()).c_str());
+    for (size_t i = shadowStack->size(); i > 0; i--) {
+        dr_fprintf(STDERR, "#%ld  %s\n", i - 1, getSymbolString(shadowStack->frameAt(i - 1)->pc).c_str());
+    }
+
+    printModuleMap();
+}
+
+/**
+ * Print the loaded modules after an offline report, so tools/symbolize can find the file and build-id behind each
+ * address (see reportformat.h). Nothing is printed when symbols are looked up at run time.
+*/
+static void printModuleMap()
+{
+    if (!isOfflineMode) {
+        return;
+    }
+
+    dr_fprintf(STDERR, REPORT_MODULE_MAP_HEADER "\n");
 
-        delete node;
+    dr_module_iterator_t *iter = dr_module_iterator_start();
+    while (dr_module_iterator_hasnext(iter)) {
+        module_data_t *mod = dr_module_iterator_next(iter);
+
+        ModuleId moduleId(mod->start, mod->end - mod->start, true);
+        std::string buildId = moduleId.getBuildIdString();
+        if (buildId.empty()) {
+            buildId = REPORT_NO_BUILD_ID;
+        }
+
+        dr_fprintf(STDERR, PFX "-" PFX " %s %s\n", mod->start, mod->end, buildId.c_str(), mod->full_path != NULL ? mod->full_path : "");
+        dr_free_module_data(mod);
     }
+    dr_module_iterator_stop(iter);
 }
 
 /**
@@ -813,7 +2228,19 @@ static SymbolInfo *getSymbolInfo(app_pc addr)
     sym.file = file;
     sym.file_size = MAXIMUM_PATH;
 
-    drsym_error_t symres = drsym_lookup_address(data->full_path, addr - data->start, &sym, DRSYM_DEFAULT_FLAGS);
+    drsym_error_t symres = DRSYM_ERROR;
+    if (isOfflineMode) {
+        // Only the exported functions are known without drsyms, and only by their start
+        std::string exportName;
+        if (exportIndex->find(addr, &exportName)) {
+            dr_snprintf(name, MAX_SYM_RESULT, "%s", exportName.c_str());
+            NULL_TERMINATE_BUFFER(name);
+            sym.start_offs = addr - data->start;
+            symres = DRSYM_SUCCESS;
+        }
+    } else {
+        symres = drsym_lookup_address(data->full_path, addr - data->start, &sym, DRSYM_DEFAULT_FLAGS);
+    }
 
     std::string moduleName = "";
     const char *modname = dr_module_preferred_name(data);
@@ -837,13 +2264,33 @@ static SymbolInfo *getSymbolInfo(app_pc addr)
     return symbolInfo;
 }
 
+/**
+ * Describe an address for a report, in the format of reportformat.h. Offline, the symbol is left to tools/symbolize.
+ * 
+ * @param[in] addr The address.
+ * @return The description.
+*/
 static std::string getSymbolString(app_pc addr)
 {
     std::stringstream ss;
 
+    if (isOfflineMode) {
+        module_data_t *data = dr_lookup_module(addr);
+        if (data == NULL) {
+            ss << "0x" << std::hex << reinterpret_cast<intptr_t>(addr) << " " REPORT_UNKNOWN_MODULE;
+            return ss.str();
+        }
+
+        const char *modname = dr_module_preferred_name(data);
+        ss << "0x" << std::hex << reinterpret_cast<intptr_t>(addr) << " " << (modname != NULL ? modname : "<noname>") << ":0x" << std::hex << (uint64) (addr - data->start);
+        dr_free_module_data(data);
+
+        return ss.str();
+    }
+
     SymbolInfo *symbolInfo = getSymbolInfo(addr);
     if (symbolInfo == nullptr) {
-        ss << "0x" << std::hex << reinterpret_cast<intptr_t>(addr) << " ??:0";
+        ss << "0x" << std::hex << reinterpret_cast<intptr_t>(addr) << " " REPORT_UNKNOWN_MODULE;
 
         return ss.str();
     }
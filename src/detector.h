@@ -1,23 +1,33 @@
-#include <stack>
+#include <string.h>
 #include <string>
 #include <sstream>
 #include <iostream>
-#include <list>
-#include <algorithm>
-#include <unordered_map>
 #include <vector>
+#include <algorithm>
+#include <x86intrin.h>
+#include <sys/syscall.h>
 
 #include "dr_api.h"
 #include "drmgr.h"
+#include "drreg.h"
 #include "drsyms.h"
 #include "drwrap.h"
 #include "dr_defines.h"
 #include "dr_ir_opcodes.h"
 
-#include "heapnode.h"
+#include "heaptracker.h"
 #include "threadcontext.h"
-#include "cfgnode.h"
+#include "cfgimage.h"
+#include "cfgbuilder.h"
 #include "symbolinfo.h"
+#include "inlinecache.h"
+#include "pltcache.h"
+#include "moduleid.h"
+#include "symboledgeindex.h"
+#include "exportindex.h"
+#include "cfgmoduletable.h"
+#include "statistics.h"
+#include "reportformat.h"
 
 #ifndef DETECTOR_H
 #define DETECTOR_H
@@ -28,9 +38,25 @@
 #define REALLOCARRAY_ROUTINE_NAME "reallocarray"
 #define FREE_ROUTINE_NAME "free"
 
-#define BUFFER_SIZE 1024
 #define WHITESPACE " \n\r\t\f\v"
 
+// CFG of a module in a CFG directory is <directory>/<build-id>.cfg, or <directory>/<module name>.cfg
+#define CFG_FILE_EXTENSION ".cfg"
+
+// Lines of a text CFG starting with the prefix are directives instead of sites
+#define CFG_DIRECTIVE_PREFIX "@"
+#define CFG_FUNCTION_DIRECTIVE "@func"
+#define CFG_LABEL_DIRECTIVE "@label"
+#define CFG_RETURN_SITE_DIRECTIVE "@retsite"
+#define CFG_JUMP_TABLE_DIRECTIVE "@jumptable"
+#define CFG_MODULE_DIRECTIVE "@module"
+
+// Sleep of the checker thread when no branches are queued, in asynchronous mode
+#define ASYNC_CHECK_INTERVAL_MS 1
+
+// Statistics are dumped to <prefix><pid>.json in the working directory at exit
+#define STATS_JSON_PREFIX "detector-stats."
+
 typedef enum {
     EMPTY_CALLSTACK,
     SP_NOT_FOUND,
@@ -56,26 +82,44 @@ typedef struct {
 typedef struct {
     void *ptr;
     size_t size;
+    size_t oldSize;
 } ReallocArguments;
 
 typedef struct {
     void *ptr;
     size_t nmemb;
     size_t size;
+    size_t oldSize;
 } ReallocarrayArguments;
 
 DR_EXPORT void dr_client_main(client_id_t id, int argc, const char *argv[]);
+static void printUsage(const char *clientName);
+static std::string findCfgFile(const module_data_t *mod);
+static CfgModule *loadCfgModule(const char *filename, const module_data_t *mod);
+static bool isCfgOfModule(CfgImage *image, const module_data_t *mod);
+static CfgModule *createCfgModule(std::string name, const module_data_t *mod, void *data, size_t size, bool isMapped);
+static void parseTextCfg(std::string data, CfgBuilder *builder);
+static void parseCfgDirective(std::string line, CfgBuilder *builder);
 static void event_exit(void);
+static bool event_filter_syscall(void *drcontext, int sysnum);
+static bool event_pre_syscall(void *drcontext, int sysnum);
 static void event_thread_init(void *drcontext);
 static void event_thread_exit(void *drcontext);
 static dr_emit_flags_t event_app_instruction(void *drcontext, void *tag, instrlist_t *bb, instr_t *instr, bool for_trace, bool translating, void *user_data);
 
-static void at_call(app_pc instr_addr, app_pc target_addr);
-static void at_call_ind(app_pc instr_addr, app_pc target_addr);
-static void at_return(app_pc instr_addr, app_pc target_addr);
-static void at_jump_ind(app_pc instr_addr, app_pc target_addr);
+static void at_return(app_pc instr_addr, reg_t sp, reg_t bp);
+static void at_return_site(app_pc instr_addr, reg_t sp);
+static void at_shadow_stack_full();
+static void at_branch_ind(app_pc instr_addr, app_pc target_addr);
+static void at_inline_cache_miss(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr);
+static void at_inline_cache_miss_async(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr);
+static void at_plt_miss(app_pc instr_addr, CfgModule *module, const CfgFileSite *site, app_pc target_addr);
+static void cacheTarget(app_pc instr_addr, app_pc target_addr, CheckCfgResult res);
+static void checker_thread(void *arg);
+static size_t checkEventRings();
 
 static void module_load_event(void *drcontext, const module_data_t *mod, bool loaded);
+static void module_unload_event(void *drcontext, const module_data_t *mod);
 static void wrap_malloc_pre(void *wrapcxt, OUT void **user_data);
 static void wrap_malloc_post(void *wrapcxt, void *user_data);
 static void wrap_calloc_pre(void *wrapcxt, OUT void **user_data);
@@ -86,18 +130,38 @@ static void wrap_reallocarray_pre(void *wrapcxt, OUT void **user_data);
 static void wrap_reallocarray_post(void *wrapcxt, void *user_data);
 static void wrap_free_pre(void *wrapcxt, OUT void **user_data);
 
-static void addNodeToHeapList(std::list<HeapNode *> *heapList, HeapNode *node);
-static bool removeNodeFromHeapList(std::list<HeapNode *> *heapList, HeapNode *node);
-static HeapNode *findNodeInHeapList(std::list<HeapNode *> *heapList, void *address);
-
-static void pushNodeToCallStack(std::stack<CallNode *> *callStack, CallNode *node);
-static CallNode *popNodeFromCallStack(std::stack<CallNode *> *callStack);
+static void insertShadowStackPush(void *drcontext, instrlist_t *bb, instr_t *instr, app_pc pc, app_pc return_address);
+static void insertShadowStackCheck(void *drcontext, instrlist_t *bb, instr_t *instr);
+static void insertReturnSiteCheck(void *drcontext, instrlist_t *bb, instr_t *instr);
+static bool isSafeFunction(app_pc pc, bool isEntry);
+static bool getCheckedSite(app_pc pc, bool isRebuild, CfgModule **modulePtr, const CfgFileSite **sitePtr);
+static bool insertIndirectBranchCheck(void *drcontext, instrlist_t *bb, instr_t *instr, CfgModule *module, const CfgFileSite *site);
+static void unreserveRegisters(void *drcontext, instrlist_t *bb, instr_t *instr, reg_id_t target, reg_id_t scratch, reg_id_t table);
+static opnd_t getShadowStackTlsOpnd(size_t fieldOffset);
+static ShadowStack *getShadowStack();
+static ThreadStats *getThreadStats();
+static void setThreadStats(ThreadStats *stats);
+static void countEvent(StatCounter counter);
+static uint64 readTimestamp();
+static void recordLatency(StatTimer timer, uint64 start);
+static void insertBitmapTest(void *drcontext, instrlist_t *bb, instr_t *instr, reg_id_t target, reg_id_t scratch, reg_id_t table, app_pc start,
+                                size_t span, const byte *bits, instr_t *passLabel);
+static reg_id_t getJumpTableIndex(opnd_t targetOpnd, CfgModule *module, JumpTable *jumpTable);
+static bool isPltStub(instr_t *instr, CfgModule *module);
+static app_pc getPltSlot(app_pc pc);
+static app_pc getJumpSlot(CfgModule *module, uint64 index);
+static bool isLazyBindingStub(CfgModule *module, app_pc pc, app_pc slot);
+static bool isSigreturnTrampoline(app_pc pc);
+static void insertCounterIncrement(void *drcontext, instrlist_t *bb, instr_t *instr, StatCounter counter);
 
-static void saveCall(app_pc pc, reg_t bp, reg_t sp);
 static CheckReturnResult checkReturn(reg_t sp, reg_t bp, app_pc target_addr, bool *hasLongJmpPtr);
 static CheckCfgResult checkCfg(app_pc instr_addr, app_pc target_addr);
-static void processIndirectJump(app_pc instr_addr, app_pc target_addr);
+static CheckCfgResult checkCfgEdge(CfgModule *module, const CfgFileSite *site, app_pc target_addr);
+static CheckCfgResult processIndirectJump(app_pc instr_addr, app_pc target_addr);
+static bool isAddressTakenFunction(app_pc target_addr);
+static CheckCfgResult enforceCfgResult(app_pc instr_addr, app_pc target_addr, CheckCfgResult res);
 static void printCallTrace();
+static void printModuleMap();
 
 static SymbolInfo *getSymbolInfo(app_pc addr);
 static std::string getSymbolString(app_pc addr);
@@ -0,0 +1,54 @@
+#include "eventring.h"
+
+EventRing::EventRing()
+{
+    _head = 0;
+    _tail = 0;
+}
+
+/**
+ * Append an event, only called by the owning thread.
+ * 
+ * @param[in] event The event.
+ * @return true if the event was appended, false if the ring is full.
+*/
+bool EventRing::tryPush(const BranchEvent *event)
+{
+    int64 head = _head;
+    if (head - dr_atomic_load64(&_tail) == EVENT_RING_CAPACITY) {
+        return false;
+    }
+
+    _events[head & (EVENT_RING_CAPACITY - 1)] = *event;
+
+    // Publishes the event before the new head
+    dr_atomic_store64(&_head, head + 1);
+
+    return true;
+}
+
+/**
+ * Remove the oldest event, only called by the checker thread.
+ * 
+ * @param[out] event The event.
+ * @return true if an event was removed, false if the ring is empty.
+*/
+bool EventRing::tryPop(BranchEvent *event)
+{
+    int64 tail = _tail;
+    if (dr_atomic_load64(&_head) == tail) {
+        return false;
+    }
+
+    *event = _events[tail & (EVENT_RING_CAPACITY - 1)];
+
+    // Releases the slot only after the event was copied out
+    dr_atomic_store64(&_tail, tail + 1);
+
+    return true;
+}
+
+bool EventRing::isEmpty()
+{
+    return dr_atomic_load64(&_head) == dr_atomic_load64(&_tail);
+}
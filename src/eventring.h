@@ -0,0 +1,43 @@
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgmodule.h"
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#define EVENT_RING_CAPACITY 4096
+#define CACHE_LINE_SIZE 64
+
+/*
+ * An indirect branch waiting to be checked by the checker thread, with the
+ * CFG module and site bound when the block was built.
+ */
+typedef struct {
+    app_pc pc;
+    CfgModule *module;
+    const CfgFileSite *site;
+    app_pc target;
+} BranchEvent;
+
+/*
+ * Single-producer single-consumer ring of branch events. The owning
+ * application thread pushes, the checker thread pops, and neither takes a
+ * lock. head and tail only increase and are kept on separate cache lines.
+ */
+class EventRing {
+private:
+    volatile int64 _head;
+    char _headPadding[CACHE_LINE_SIZE - sizeof(int64)];
+    volatile int64 _tail;
+    char _tailPadding[CACHE_LINE_SIZE - sizeof(int64)];
+    BranchEvent _events[EVENT_RING_CAPACITY];
+
+public:
+    EventRing();
+    bool tryPush(const BranchEvent *event);
+    bool tryPop(BranchEvent *event);
+    bool isEmpty();
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "exportindex.h"
+
+ExportIndex::ExportIndex()
+{
+    _lock = dr_rwlock_create();
+}
+
+ExportIndex::~ExportIndex()
+{
+    dr_rwlock_destroy(_lock);
+}
+
+/**
+ * Add the exported functions of a newly loaded module.
+ * 
+ * @param[in] mod The loaded module.
+*/
+void ExportIndex::addModule(const module_data_t *mod)
+{
+    std::unordered_map<app_pc, std::string> exports;
+    dr_symbol_export_iterator_t *iter = dr_symbol_export_iterator_start(mod->handle);
+    while (dr_symbol_export_iterator_hasnext(iter)) {
+        dr_symbol_export_t *symbolExport = dr_symbol_export_iterator_next(iter);
+        if (symbolExport->is_code && symbolExport->addr != NULL) {
+            // Aliases share an address, the first name is kept
+            exports.insert({ symbolExport->addr, symbolExport->name });
+        }
+    }
+    dr_symbol_export_iterator_stop(iter);
+
+    dr_rwlock_write_lock(_lock);
+    _exports.insert(exports.begin(), exports.end());
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Drop the exports of an unloaded module, its addresses may be reused by another module.
+ * 
+ * @param[in] mod The unloaded module.
+*/
+void ExportIndex::removeModule(const module_data_t *mod)
+{
+    dr_rwlock_write_lock(_lock);
+
+    for (auto it = _exports.begin(); it != _exports.end();) {
+        if (it->first >= mod->start && it->first < mod->end) {
+            it = _exports.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Find the exported function starting at an address.
+ * 
+ * @param[in] addr The address.
+ * @param[out] namePtr Pointer to receive the name of the function.
+ * @return true if a function is exported at addr, otherwise, false.
+*/
+bool ExportIndex::find(app_pc addr, std::string *namePtr)
+{
+    dr_rwlock_read_lock(_lock);
+
+    auto it = _exports.find(addr);
+    bool found = it != _exports.end();
+    if (found) {
+        *namePtr = it->second;
+    }
+
+    dr_rwlock_read_unlock(_lock);
+
+    return found;
+}
@@ -0,0 +1,28 @@
+#include <string>
+#include <unordered_map>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef EXPORTINDEX_H
+#define EXPORTINDEX_H
+
+/*
+ * Exported functions of the loaded modules by address, for naming targets
+ * without drsyms. Each module's exports are enumerated once when it is
+ * loaded, so a lookup is a hash map probe instead of a walk over the exports.
+ */
+class ExportIndex {
+private:
+    std::unordered_map<app_pc, std::string> _exports;
+    void *_lock;
+
+public:
+    ExportIndex();
+    ~ExportIndex();
+    void addModule(const module_data_t *mod);
+    void removeModule(const module_data_t *mod);
+    bool find(app_pc addr, std::string *namePtr);
+};
+
+#endif
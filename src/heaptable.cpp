@@ -0,0 +1,155 @@
+#include "heaptable.h"
+
+HeapTable::HeapTable(size_t initialCapacity)
+{
+    DR_ASSERT(initialCapacity > 0 && (initialCapacity & (initialCapacity - 1)) == 0);
+
+    _capacity = initialCapacity;
+    _count = 0;
+
+    // Fresh pages are zeroed, so every slot starts empty
+    _records = (HeapRecord *) dr_raw_mem_alloc(_capacity * sizeof(HeapRecord), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(_records != NULL);
+}
+
+HeapTable::~HeapTable()
+{
+    dr_raw_mem_free(_records, _capacity * sizeof(HeapRecord));
+}
+
+/**
+ * Add an allocation to the table. An existing record with the same address is overwritten.
+ * 
+ * @param[in] address The address of the allocation.
+ * @param[in] size The size of the allocation.
+ * 
+ * @pre address != NULL
+*/
+void HeapTable::insert(void *address, size_t size)
+{
+    DR_ASSERT(address != NULL);
+
+    // Keep load factor at or below 1/2
+    if ((_count + 1) * 2 > _capacity) {
+        resize(_capacity * 2);
+    }
+
+    size_t mask = _capacity - 1;
+    size_t i = getIndex(address);
+    while (_records[i].address != NULL) {
+        if (_records[i].address == address) {
+            _records[i].size = size;
+            return;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    _records[i].address = address;
+    _records[i].size = size;
+    _count += 1;
+}
+
+/**
+ * Find an allocation in the table.
+ * 
+ * @param[in] address The address of the allocation.
+ * @return Pointer to the record if found, otherwise, nullptr. The pointer is invalidated by the next insert or remove.
+*/
+HeapRecord *HeapTable::find(void *address)
+{
+    if (address == NULL) {
+        return nullptr;
+    }
+
+    size_t mask = _capacity - 1;
+    size_t i = getIndex(address);
+    while (_records[i].address != NULL) {
+        if (_records[i].address == address) {
+            return &_records[i];
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+/**
+ * Remove an allocation from the table.
+ * 
+ * @param[in] address The address of the allocation.
+ * @return true if the allocation was found and removed, otherwise, false.
+*/
+bool HeapTable::remove(void *address)
+{
+    HeapRecord *record = find(address);
+    if (record == nullptr) {
+        return false;
+    }
+
+    size_t mask = _capacity - 1;
+    size_t hole = record - _records;
+    size_t i = (hole + 1) & mask;
+    while (_records[i].address != NULL) {
+        // Move the record back into the hole unless its home slot lies cyclically in (hole, i]
+        size_t home = getIndex(_records[i].address);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            _records[hole] = _records[i];
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    _records[hole].address = NULL;
+    _records[hole].size = 0;
+    _count -= 1;
+
+    return true;
+}
+
+size_t HeapTable::getCount()
+{
+    return _count;
+}
+
+size_t HeapTable::getMemoryUsage()
+{
+    return _capacity * sizeof(HeapRecord);
+}
+
+size_t HeapTable::getIndex(void *address)
+{
+    // Allocations are at least 16-byte aligned, drop the low bits before mixing
+    uint64 key = ((uint64) address) >> 4;
+    key *= 0x9E3779B97F4A7C15ULL;
+
+    return (size_t) (key ^ (key >> 32)) & (_capacity - 1);
+}
+
+void HeapTable::resize(size_t newCapacity)
+{
+    HeapRecord *oldRecords = _records;
+    size_t oldCapacity = _capacity;
+
+    _records = (HeapRecord *) dr_raw_mem_alloc(newCapacity * sizeof(HeapRecord), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(_records != NULL);
+    _capacity = newCapacity;
+
+    size_t mask = _capacity - 1;
+    for (size_t j = 0; j < oldCapacity; j++) {
+        if (oldRecords[j].address == NULL) {
+            continue;
+        }
+
+        size_t i = getIndex(oldRecords[j].address);
+        while (_records[i].address != NULL) {
+            i = (i + 1) & mask;
+        }
+
+        _records[i] = oldRecords[j];
+    }
+
+    dr_raw_mem_free(oldRecords, oldCapacity * sizeof(HeapRecord));
+}
@@ -0,0 +1,40 @@
+#include <stddef.h>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef HEAPTABLE_H
+#define HEAPTABLE_H
+
+#define HEAP_TABLE_INITIAL_CAPACITY 1024
+
+typedef struct {
+    void *address;
+    size_t size;
+} HeapRecord;
+
+/*
+ * Open-addressing hash table of live allocations keyed by address. Records are
+ * stored inline using linear probing, and removal uses backward shifting so no
+ * tombstones are left behind. An empty slot has a NULL address.
+ */
+class HeapTable {
+private:
+    HeapRecord *_records;
+    size_t _capacity;
+    size_t _count;
+
+    size_t getIndex(void *address);
+    void resize(size_t newCapacity);
+
+public:
+    HeapTable(size_t initialCapacity = HEAP_TABLE_INITIAL_CAPACITY);
+    ~HeapTable();
+    void insert(void *address, size_t size);
+    HeapRecord *find(void *address);
+    bool remove(void *address);
+    size_t getCount();
+    size_t getMemoryUsage();
+};
+
+#endif
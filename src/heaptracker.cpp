@@ -0,0 +1,116 @@
+#include "heaptracker.h"
+
+HeapTracker::HeapTracker()
+{
+    for (size_t i = 0; i < HEAP_TRACKER_SHARD_COUNT; i++) {
+        Shard *shard = &_shards[i].shard;
+        shard->mutex = dr_mutex_create();
+        shard->table = new HeapTable(HEAP_TRACKER_SHARD_CAPACITY);
+    }
+}
+
+HeapTracker::~HeapTracker()
+{
+    for (size_t i = 0; i < HEAP_TRACKER_SHARD_COUNT; i++) {
+        Shard *shard = &_shards[i].shard;
+        delete shard->table;
+        dr_mutex_destroy(shard->mutex);
+    }
+}
+
+/**
+ * Add an allocation.
+ * 
+ * @param[in] address The address of the allocation.
+ * @param[in] size The size of the allocation.
+ * 
+ * @pre address != NULL
+*/
+void HeapTracker::insert(void *address, size_t size)
+{
+    Shard *shard = getShard(address);
+
+    dr_mutex_lock(shard->mutex);
+    shard->table->insert(address, size);
+    dr_mutex_unlock(shard->mutex);
+}
+
+/**
+ * Find an allocation.
+ * 
+ * @param[in] address The address of the allocation.
+ * @param[out] sizePtr Pointer to receive the size of the allocation, may be nullptr.
+ * @return true if the allocation is tracked, otherwise, false.
+*/
+bool HeapTracker::find(void *address, size_t *sizePtr)
+{
+    Shard *shard = getShard(address);
+
+    dr_mutex_lock(shard->mutex);
+    HeapRecord *record = shard->table->find(address);
+    if (record != nullptr && sizePtr != nullptr) {
+        *sizePtr = record->size;
+    }
+    dr_mutex_unlock(shard->mutex);
+
+    return record != nullptr;
+}
+
+/**
+ * Remove an allocation.
+ * 
+ * @param[in] address The address of the allocation.
+ * @param[out] sizePtr Pointer to receive the size of the removed allocation, may be nullptr.
+ * @return true if the allocation was found and removed, otherwise, false.
+*/
+bool HeapTracker::remove(void *address, size_t *sizePtr)
+{
+    Shard *shard = getShard(address);
+
+    dr_mutex_lock(shard->mutex);
+    HeapRecord *record = shard->table->find(address);
+    if (record != nullptr && sizePtr != nullptr) {
+        *sizePtr = record->size;
+    }
+    bool isRemoved = shard->table->remove(address);
+    dr_mutex_unlock(shard->mutex);
+
+    return isRemoved;
+}
+
+size_t HeapTracker::getCount()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < HEAP_TRACKER_SHARD_COUNT; i++) {
+        Shard *shard = &_shards[i].shard;
+
+        dr_mutex_lock(shard->mutex);
+        count += shard->table->getCount();
+        dr_mutex_unlock(shard->mutex);
+    }
+
+    return count;
+}
+
+size_t HeapTracker::getMemoryUsage()
+{
+    size_t memory = sizeof(*this);
+    for (size_t i = 0; i < HEAP_TRACKER_SHARD_COUNT; i++) {
+        Shard *shard = &_shards[i].shard;
+
+        dr_mutex_lock(shard->mutex);
+        memory += shard->table->getMemoryUsage();
+        dr_mutex_unlock(shard->mutex);
+    }
+
+    return memory;
+}
+
+HeapTracker::Shard *HeapTracker::getShard(void *address)
+{
+    // Use the high bits of the product, HeapTable indexes with the low bits
+    uint64 key = ((uint64) address) >> 4;
+    key *= 0xC2B2AE3D27D4EB4FULL;
+
+    return &_shards[key >> (64 - HEAP_TRACKER_SHARD_BITS)].shard;
+}
@@ -0,0 +1,48 @@
+#include <stddef.h>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "heaptable.h"
+
+#ifndef HEAPTRACKER_H
+#define HEAPTRACKER_H
+
+#define HEAP_TRACKER_SHARD_BITS 6
+#define HEAP_TRACKER_SHARD_COUNT (1 << HEAP_TRACKER_SHARD_BITS)
+#define HEAP_TRACKER_SHARD_CAPACITY 256
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Thread-safe set of live allocations. Addresses are striped across shards by
+ * hash, each shard being a HeapTable behind its own lock, so threads only
+ * contend when they touch the same shard. Any thread can remove an allocation
+ * made by another thread.
+ */
+class HeapTracker {
+private:
+    typedef struct {
+        void *mutex;
+        HeapTable *table;
+    } Shard;
+
+    typedef struct {
+        Shard shard;
+        char padding[CACHE_LINE_SIZE - sizeof(Shard)];
+    } PaddedShard;
+
+    PaddedShard _shards[HEAP_TRACKER_SHARD_COUNT];
+
+    Shard *getShard(void *address);
+
+public:
+    HeapTracker();
+    ~HeapTracker();
+    void insert(void *address, size_t size);
+    bool find(void *address, size_t *sizePtr);
+    bool remove(void *address, size_t *sizePtr);
+    size_t getCount();
+    size_t getMemoryUsage();
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "inlinecache.h"
+
+InlineCache::InlineCache()
+{
+    _mutex = dr_mutex_create();
+}
+
+InlineCache::~InlineCache()
+{
+    dr_mutex_destroy(_mutex);
+}
+
+/**
+ * Get the cached targets of a site.
+ * 
+ * @param[in] site The address of the indirect branch instruction.
+ * @param[out] targets Array of at least INLINE_CACHE_SIZE elements to receive the targets.
+ * @return The number of targets written.
+*/
+uint InlineCache::getTargets(app_pc site, app_pc *targets)
+{
+    dr_mutex_lock(_mutex);
+
+    uint count = 0;
+    auto it = _entries.find(site);
+    if (it != _entries.end()) {
+        count = it->second.count;
+        for (uint i = 0; i < count; i++) {
+            targets[i] = it->second.targets[i];
+        }
+    }
+
+    dr_mutex_unlock(_mutex);
+
+    return count;
+}
+
+/**
+ * Add a validated target to a site.
+ * 
+ * @param[in] site The address of the indirect branch instruction.
+ * @param[in] target The target address.
+ * @return true if the target was added, false if it is already cached or the site is full.
+*/
+bool InlineCache::addTarget(app_pc site, app_pc target)
+{
+    dr_mutex_lock(_mutex);
+
+    Entry &entry = _entries[site];
+
+    bool isAdded = false;
+    if (entry.count < INLINE_CACHE_SIZE) {
+        isAdded = true;
+        for (uint i = 0; i < entry.count; i++) {
+            if (entry.targets[i] == target) {
+                isAdded = false;
+                break;
+            }
+        }
+
+        if (isAdded) {
+            entry.targets[entry.count] = target;
+            entry.count += 1;
+        }
+    }
+
+    dr_mutex_unlock(_mutex);
+
+    return isAdded;
+}
+
+/**
+ * Drop sites and targets within an address range, eg. an unloaded module.
+ * 
+ * @param[in] start The start of the range.
+ * @param[in] end The end of the range (exclusive).
+ * @param[out] staleSites Sites outside the range that lost targets, their fragments still have the targets emitted.
+*/
+void InlineCache::invalidateRange(app_pc start, app_pc end, std::vector<app_pc> *staleSites)
+{
+    dr_mutex_lock(_mutex);
+
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (it->first >= start && it->first < end) {
+            it = _entries.erase(it);
+            continue;
+        }
+
+        Entry &entry = it->second;
+        uint count = 0;
+        for (uint i = 0; i < entry.count; i++) {
+            if (entry.targets[i] < start || entry.targets[i] >= end) {
+                entry.targets[count++] = entry.targets[i];
+            }
+        }
+
+        if (count != entry.count) {
+            entry.count = count;
+            staleSites->push_back(it->first);
+        }
+
+        ++it;
+    }
+
+    dr_mutex_unlock(_mutex);
+}
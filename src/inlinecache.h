@@ -0,0 +1,35 @@
+#include <unordered_map>
+#include <vector>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef INLINECACHE_H
+#define INLINECACHE_H
+
+#define INLINE_CACHE_SIZE 4
+
+/*
+ * Targets already validated for each indirect branch site. The targets are
+ * emitted as immediates in front of the branch, so a fragment has to be
+ * rebuilt for a newly added target to take effect.
+ */
+class InlineCache {
+private:
+    typedef struct {
+        app_pc targets[INLINE_CACHE_SIZE];
+        uint count;
+    } Entry;
+
+    std::unordered_map<app_pc, Entry> _entries;
+    void *_mutex;
+
+public:
+    InlineCache();
+    ~InlineCache();
+    uint getTargets(app_pc site, app_pc *targets);
+    bool addTarget(app_pc site, app_pc target);
+    void invalidateRange(app_pc start, app_pc end, std::vector<app_pc> *staleSites);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "jumptable.h"
+
+/**
+ * @param[in] targets The offset edges of the site, sorted in ascending order.
+ * @param[in] targetCount The number of offset edges.
+ * @param[in] jumpTable The jump table entry of the site.
+ * @pre targetCount is greater than 0.
+*/
+JumpTable::JumpTable(const uint64 *targets, uint64 targetCount, const CfgFileJumpTable *jumpTable)
+{
+    DR_ASSERT(targetCount > 0);
+
+    _targetStart = targets[0];
+    _span = targets[targetCount - 1] - _targetStart + 1;
+    // The inline bit test loads the whole qword holding the bit
+    _bits.resize(ALIGN_FORWARD((_span + 7) / 8, sizeof(uint64)));
+    for (uint64 i = 0; i < targetCount; i++) {
+        uint64 offset = targets[i] - _targetStart;
+        _bits[offset / 8] |= 1 << (offset % 8);
+    }
+
+    _table = jumpTable->table;
+    _entryCount = jumpTable->entryCount;
+}
+
+/**
+ * Check if an offset is one of the cases.
+ * 
+ * @param[in] offset The module relative offset of the target.
+ * @return true if the offset is a case, otherwise, false.
+*/
+bool JumpTable::contains(uint64 offset)
+{
+    if (offset < _targetStart || offset - _targetStart >= _span) {
+        return false;
+    }
+
+    offset -= _targetStart;
+
+    return (_bits[offset / 8] & (1 << (offset % 8))) != 0;
+}
+
+uint64 JumpTable::getTargetStart()
+{
+    return _targetStart;
+}
+
+uint64 JumpTable::getSpan()
+{
+    return _span;
+}
+
+const byte *JumpTable::getBits()
+{
+    return _bits.data();
+}
+
+/**
+ * @return The module relative offset of the table, 0 if unknown.
+*/
+uint64 JumpTable::getTable()
+{
+    return _table;
+}
+
+uint32 JumpTable::getEntryCount()
+{
+    return _entryCount;
+}
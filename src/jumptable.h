@@ -0,0 +1,35 @@
+#include <vector>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgformat.h"
+
+#ifndef JUMPTABLE_H
+#define JUMPTABLE_H
+
+/*
+ * Cases of a switch dispatch site, as a bitmap over the range from the lowest
+ * to the highest case, laid out like TargetBitmap. Membership is a range check
+ * and a bit test, whatever the number of cases. Switches are small and many,
+ * so the bitmap lives on the heap instead of in pages of its own.
+ */
+class JumpTable {
+private:
+    uint64 _targetStart;
+    uint64 _span;
+    std::vector<byte> _bits;
+    uint64 _table;
+    uint32 _entryCount;
+
+public:
+    JumpTable(const uint64 *targets, uint64 targetCount, const CfgFileJumpTable *jumpTable);
+    bool contains(uint64 offset);
+    uint64 getTargetStart();
+    uint64 getSpan();
+    const byte *getBits();
+    uint64 getTable();
+    uint32 getEntryCount();
+};
+
+#endif
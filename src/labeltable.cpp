@@ -0,0 +1,56 @@
+#include "labeltable.h"
+
+/**
+ * Build the table from the target labels of a CFG. The table is read-only once built.
+ * 
+ * @param[in] image The CFG of the module.
+ * @param[in] span The size of the module, targets at or past it are ignored.
+ * @pre All target labels are at most LABEL_TABLE_MAX_LABEL.
+*/
+LabelTable::LabelTable(CfgImage *image, size_t span)
+{
+    _span = span;
+    _allocSize = ALIGN_FORWARD(span * sizeof(uint16), dr_page_size());
+
+    // Fresh pages are zeroed, so offsets that are not targets need no initialization
+    _entries = (uint16 *) dr_raw_mem_alloc(_allocSize, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(_entries != NULL);
+
+    uint64 count;
+    const CfgFileTargetLabel *labels = image->getTargetLabels(&count);
+    for (uint64 i = 0; i < count; i++) {
+        DR_ASSERT(labels[i].label <= LABEL_TABLE_MAX_LABEL);
+        if (labels[i].offset < _span) {
+            _entries[labels[i].offset] = (uint16) labels[i].label;
+        }
+    }
+
+    bool ok = dr_memory_protect(_entries, _allocSize, DR_MEMPROT_READ);
+    DR_ASSERT(ok);
+}
+
+LabelTable::~LabelTable()
+{
+    dr_raw_mem_free(_entries, _allocSize);
+}
+
+/**
+ * Get the label of an offset.
+ * 
+ * @param[in] offset The module relative offset.
+ * @return The label, or 0 if the offset is not a valid target.
+*/
+uint32 LabelTable::get(uint64 offset)
+{
+    return offset < _span ? _entries[offset] : 0;
+}
+
+const uint16 *LabelTable::getEntries()
+{
+    return _entries;
+}
+
+size_t LabelTable::getSpan()
+{
+    return _span;
+}
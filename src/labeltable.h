@@ -0,0 +1,32 @@
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgimage.h"
+
+#ifndef LABELTABLE_H
+#define LABELTABLE_H
+
+// Labels are stored in 16 bits, larger classes are rejected when loading
+#define LABEL_TABLE_MAX_LABEL 0xffff
+
+/*
+ * Dense table with the equivalence class label of every offset of a module,
+ * 0 if the offset is not a valid target. Read inline by the label check, so
+ * it is indexed by offset directly. Only pages holding targets are ever
+ * touched, so the untouched rest of the table costs address space only.
+ */
+class LabelTable {
+private:
+    uint16 *_entries;
+    size_t _span;
+    size_t _allocSize;
+
+public:
+    LabelTable(CfgImage *image, size_t span);
+    ~LabelTable();
+    uint32 get(uint64 offset);
+    const uint16 *getEntries();
+    size_t getSpan();
+};
+
+#endif
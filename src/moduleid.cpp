@@ -0,0 +1,248 @@
+#include <string.h>
+
+#include "moduleid.h"
+
+/**
+ * Locate the program headers of a module.
+ *
+ * @param[in] image The file contents, or the start of the mapped module.
+ * @param[in] size The size of the file, or of the mapped module.
+ * @param[in] isLoaded true if image is a module mapped by the loader, false if it is the file contents.
+*/
+ModuleId::ModuleId(const void *image, size_t size, bool isLoaded)
+{
+    _image = (const byte *) image;
+    _size = size;
+    _isLoaded = isLoaded;
+    _base = 0;
+    _segments = nullptr;
+    _segmentCount = 0;
+
+    const Elf64_Ehdr *header = (const Elf64_Ehdr *) getBytes(0, sizeof(Elf64_Ehdr));
+    if (header == nullptr || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 ||
+        header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_phentsize != sizeof(Elf64_Phdr)) {
+        return;
+    }
+
+    // The first segment maps the start of the file, so a loaded module has its program headers at the file offset too
+    const Elf64_Phdr *segments = (const Elf64_Phdr *) getBytes(header->e_phoff, header->e_phnum * sizeof(Elf64_Phdr));
+    if (segments == nullptr) {
+        return;
+    }
+
+    bool hasLoad = false;
+    uint64 base = 0;
+    for (uint32 i = 0; i < header->e_phnum; i++) {
+        if (segments[i].p_type == PT_LOAD && (!hasLoad || segments[i].p_vaddr < base)) {
+            base = segments[i].p_vaddr;
+            hasLoad = true;
+        }
+    }
+
+    if (!hasLoad) {
+        return;
+    }
+
+    _base = ALIGN_BACKWARD(base, MODULE_ID_PAGE_SIZE);
+    _segments = segments;
+    _segmentCount = header->e_phnum;
+}
+
+bool ModuleId::isValid()
+{
+    return _segments != nullptr;
+}
+
+/**
+ * Get the build-id of the module.
+ *
+ * @param[out] sizePtr Pointer to receive the size of the build-id.
+ * @return The build-id, or nullptr if the module has no NT_GNU_BUILD_ID note.
+*/
+const byte *ModuleId::getBuildId(uint32 *sizePtr)
+{
+    for (uint32 i = 0; i < _segmentCount; i++) {
+        if (_segments[i].p_type != PT_NOTE) {
+            continue;
+        }
+
+        const byte *data = getSegmentData(&_segments[i]);
+        if (data == nullptr) {
+            continue;
+        }
+
+        uint64 align = _segments[i].p_align == 8 ? 8 : 4;
+        uint64 position = 0;
+        while (position + sizeof(Elf64_Nhdr) <= _segments[i].p_filesz) {
+            const Elf64_Nhdr *note = (const Elf64_Nhdr *) (data + position);
+            uint64 nameOffset = position + sizeof(Elf64_Nhdr);
+            uint64 descOffset = nameOffset + ALIGN_FORWARD(note->n_namesz, align);
+            uint64 end = descOffset + ALIGN_FORWARD(note->n_descsz, align);
+            if (end > _segments[i].p_filesz) {
+                break;
+            }
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == sizeof(ELF_NOTE_GNU) &&
+                memcmp(data + nameOffset, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0) {
+                *sizePtr = note->n_descsz;
+                return data + descOffset;
+            }
+
+            position = end;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Get the build-id of the module as lowercase hex, the name of its CFG in a CFG directory.
+ *
+ * @return The build-id, empty if the module has none.
+*/
+std::string ModuleId::getBuildIdString()
+{
+    uint32 size = 0;
+    const byte *buildId = getBuildId(&size);
+    if (buildId == nullptr) {
+        return "";
+    }
+
+    return formatBuildId(buildId, size);
+}
+
+/**
+ * Compute the identity recorded in a CFG of the module. Hashes every executable segment.
+ *
+ * @param[out] id Pointer to receive the identity.
+ * @return true if the identity was computed, false if the module has no executable segment or a segment is not
+ * readable.
+*/
+bool ModuleId::getFileModuleId(CfgFileModuleId *id)
+{
+    memset(id, 0, sizeof(CfgFileModuleId));
+
+    uint32 buildIdSize = 0;
+    const byte *buildId = getBuildId(&buildIdSize);
+    if (buildId != nullptr && buildIdSize <= CFG_BUILD_ID_MAX_SIZE) {
+        memcpy(id->buildId, buildId, buildIdSize);
+        id->buildIdSize = buildIdSize;
+    }
+
+    id->textHash = CFG_TEXT_HASH_SEED;
+    for (uint32 i = 0; i < _segmentCount; i++) {
+        if (_segments[i].p_type != PT_LOAD || (_segments[i].p_flags & PF_X) == 0) {
+            continue;
+        }
+
+        const byte *data = getSegmentData(&_segments[i]);
+        if (data == nullptr) {
+            return false;
+        }
+
+        id->textHash = hashText(id->textHash, data, _segments[i].p_filesz);
+        id->textSize += _segments[i].p_filesz;
+    }
+
+    return id->textSize > 0;
+}
+
+/**
+ * Check whether a CFG was exported from this module. The build-id is only compared if the CFG has one.
+ *
+ * @param[in] id The identity recorded in the CFG.
+ * @return true if the module has the same identity, otherwise, false.
+*/
+bool ModuleId::matches(const CfgFileModuleId *id)
+{
+    CfgFileModuleId moduleId;
+    if (!getFileModuleId(&moduleId)) {
+        return false;
+    }
+
+    if (id->buildIdSize != 0 &&
+        (id->buildIdSize != moduleId.buildIdSize || memcmp(id->buildId, moduleId.buildId, id->buildIdSize) != 0)) {
+        return false;
+    }
+
+    return id->textSize == moduleId.textSize && id->textHash == moduleId.textHash;
+}
+
+/**
+ * Continue the text hash over a buffer. Whole little endian 64-bit words are mixed in first, then the remaining
+ * bytes one at a time, each as h = (h ^ value) * CFG_TEXT_HASH_PRIME, h ^= h >> 32.
+ *
+ * @param[in] hash The hash so far, CFG_TEXT_HASH_SEED for the first buffer.
+ * @param[in] data The buffer.
+ * @param[in] size The size of the buffer.
+ * @return The updated hash.
+*/
+uint64 ModuleId::hashText(uint64 hash, const byte *data, size_t size)
+{
+    size_t wordCount = size / sizeof(uint64);
+    for (size_t i = 0; i < wordCount; i++) {
+        uint64 word;
+        memcpy(&word, data + i * sizeof(uint64), sizeof(uint64));
+        hash = (hash ^ word) * CFG_TEXT_HASH_PRIME;
+        hash ^= hash >> 32;
+    }
+
+    for (size_t i = wordCount * sizeof(uint64); i < size; i++) {
+        hash = (hash ^ data[i]) * CFG_TEXT_HASH_PRIME;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
+
+std::string ModuleId::formatBuildId(const byte *buildId, uint32 size)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string res;
+    for (uint32 i = 0; i < size; i++) {
+        res.push_back(digits[buildId[i] >> 4]);
+        res.push_back(digits[buildId[i] & 0xf]);
+    }
+
+    return res;
+}
+
+/**
+ * Get a range of the module, checking that it is within the image and, for a loaded module, readable.
+ *
+ * @param[in] offset The offset of the range, from the start of the image.
+ * @param[in] size The size of the range.
+ * @return Pointer to the range, or nullptr if it cannot be read.
+*/
+const byte *ModuleId::getBytes(uint64 offset, uint64 size)
+{
+    if (offset > _size || size > _size - offset) {
+        return nullptr;
+    }
+
+    if (_isLoaded && size > 0 && !dr_memory_is_readable(_image + offset, size)) {
+        return nullptr;
+    }
+
+    return _image + offset;
+}
+
+/**
+ * Get the file bytes of a segment, at its file offset or at its address in a loaded module.
+ *
+ * @param[in] segment The program header of the segment.
+ * @return Pointer to the p_filesz bytes of the segment, or nullptr if they cannot be read.
+*/
+const byte *ModuleId::getSegmentData(const Elf64_Phdr *segment)
+{
+    if (!_isLoaded) {
+        return getBytes(segment->p_offset, segment->p_filesz);
+    }
+
+    if (segment->p_vaddr < _base) {
+        return nullptr;
+    }
+
+    return getBytes(segment->p_vaddr - _base, segment->p_filesz);
+}
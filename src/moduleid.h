@@ -0,0 +1,44 @@
+#include <elf.h>
+#include <string>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgformat.h"
+
+#ifndef MODULEID_H
+#define MODULEID_H
+
+#define MODULE_ID_PAGE_SIZE 0x1000
+
+/*
+ * Reads the identity of an x86-64 ELF module, its build-id and text hash (see
+ * CfgFileModuleId), either from the file contents or from the module mapped
+ * by the loader. Offsets are taken from the start of the first mapped page,
+ * as CFG offsets are.
+ */
+class ModuleId {
+private:
+    const byte *_image;
+    size_t _size;
+    bool _isLoaded;
+    uint64 _base;
+    const Elf64_Phdr *_segments;
+    uint32 _segmentCount;
+
+    const byte *getBytes(uint64 offset, uint64 size);
+    const byte *getSegmentData(const Elf64_Phdr *segment);
+
+public:
+    ModuleId(const void *image, size_t size, bool isLoaded);
+    bool isValid();
+    const byte *getBuildId(uint32 *sizePtr);
+    std::string getBuildIdString();
+    bool getFileModuleId(CfgFileModuleId *id);
+    bool matches(const CfgFileModuleId *id);
+
+    static uint64 hashText(uint64 hash, const byte *data, size_t size);
+    static std::string formatBuildId(const byte *buildId, uint32 size);
+};
+
+#endif
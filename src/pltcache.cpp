@@ -0,0 +1,85 @@
+#include "pltcache.h"
+
+PltCache::PltCache()
+{
+    _mutex = dr_mutex_create();
+}
+
+PltCache::~PltCache()
+{
+    for (auto &it : _cells) {
+        dr_global_free(it.second, sizeof(app_pc));
+    }
+
+    dr_mutex_destroy(_mutex);
+}
+
+/**
+ * Get the cell holding the validated target of a PLT stub, creating an empty one if needed. The cell stays at the same
+ * address until its site is invalidated, so it can be referenced from the code cache.
+ * 
+ * @param[in] site The address of the indirect jump of the stub.
+ * @return The cell, holding nullptr until a target is validated.
+*/
+app_pc *PltCache::getCell(app_pc site)
+{
+    dr_mutex_lock(_mutex);
+
+    app_pc *&cell = _cells[site];
+    if (cell == nullptr) {
+        cell = (app_pc *) dr_global_alloc(sizeof(app_pc));
+        *cell = nullptr;
+    }
+
+    app_pc *res = cell;
+
+    dr_mutex_unlock(_mutex);
+
+    return res;
+}
+
+/**
+ * Set the validated target of a PLT stub.
+ * 
+ * @param[in] site The address of the indirect jump of the stub.
+ * @param[in] target The target address.
+*/
+void PltCache::setTarget(app_pc site, app_pc target)
+{
+    dr_mutex_lock(_mutex);
+
+    auto it = _cells.find(site);
+    if (it != _cells.end()) {
+        *it->second = target;
+    }
+
+    dr_mutex_unlock(_mutex);
+}
+
+/**
+ * Drop sites and targets within an address range, eg. an unloaded module. Cells of sites within the range are freed,
+ * their fragments are flushed with the module. Cells of other sites holding a target within the range are emptied.
+ * 
+ * @param[in] start The start of the range.
+ * @param[in] end The end of the range (exclusive).
+*/
+void PltCache::invalidateRange(app_pc start, app_pc end)
+{
+    dr_mutex_lock(_mutex);
+
+    for (auto it = _cells.begin(); it != _cells.end();) {
+        if (it->first >= start && it->first < end) {
+            dr_global_free(it->second, sizeof(app_pc));
+            it = _cells.erase(it);
+            continue;
+        }
+
+        if (*it->second >= start && *it->second < end) {
+            *it->second = nullptr;
+        }
+
+        ++it;
+    }
+
+    dr_mutex_unlock(_mutex);
+}
@@ -0,0 +1,27 @@
+#include <unordered_map>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef PLTCACHE_H
+#define PLTCACHE_H
+
+/*
+ * The resolved target validated for each PLT stub. Unlike the inline cache,
+ * the target is kept in memory and compared against the loaded GOT slot, so
+ * a slot that is rebound only misses once and no fragment is rebuilt.
+ */
+class PltCache {
+private:
+    std::unordered_map<app_pc, app_pc *> _cells;
+    void *_mutex;
+
+public:
+    PltCache();
+    ~PltCache();
+    app_pc *getCell(app_pc site);
+    void setTarget(app_pc site, app_pc target);
+    void invalidateRange(app_pc start, app_pc end);
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef REPORTFORMAT_H
+#define REPORTFORMAT_H
+
+/*
+ * Addresses in reports of the client are written as
+ * "0x<address> <module name>:0x<module offset>", followed by
+ * "!<symbol>+0x<symbol offset>" when symbols are looked up at run time, or
+ * "0x<address> ??:0" outside of any module. With -offline, symbols are not
+ * looked up, and every fatal report ends with the module map: the header line,
+ * then one "<start>-<end> <build-id> <path>" line per loaded module, start and
+ * end in hex. tools/symbolize reads the map to add the symbols afterwards.
+ */
+
+#define REPORT_MODULE_MAP_HEADER "Module Map:"
+// Build-id of a module without an NT_GNU_BUILD_ID note
+#define REPORT_NO_BUILD_ID "-"
+#define REPORT_UNKNOWN_MODULE "??:0"
+
+#endif
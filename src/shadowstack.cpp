@@ -0,0 +1,91 @@
+#include "shadowstack.h"
+
+ShadowStack::ShadowStack(ShadowStackTls *tls)
+{
+    _tls = tls;
+    _capacity = SHADOW_STACK_INITIAL_CAPACITY;
+
+    ShadowFrame *frames = (ShadowFrame *) dr_raw_mem_alloc(SHADOW_STACK_MAX_CAPACITY * sizeof(ShadowFrame), DR_MEMPROT_NONE, NULL);
+    DR_ASSERT(frames != NULL);
+
+    bool ok = dr_memory_protect(frames, _capacity * sizeof(ShadowFrame), DR_MEMPROT_READ | DR_MEMPROT_WRITE);
+    DR_ASSERT(ok);
+
+    _tls->base = frames;
+    _tls->top = frames;
+    _tls->limit = frames + _capacity;
+}
+
+ShadowStack::~ShadowStack()
+{
+    dr_raw_mem_free(_tls->base, SHADOW_STACK_MAX_CAPACITY * sizeof(ShadowFrame));
+
+    _tls->base = NULL;
+    _tls->top = NULL;
+    _tls->limit = NULL;
+}
+
+void ShadowStack::pop()
+{
+    DR_ASSERT(!isEmpty());
+
+    _tls->top -= 1;
+}
+
+/**
+ * Get the most recently pushed frame.
+ * 
+ * @return Pointer to the frame if the stack is not empty, otherwise, nullptr.
+*/
+ShadowFrame *ShadowStack::top()
+{
+    if (isEmpty()) {
+        return nullptr;
+    }
+
+    return _tls->top - 1;
+}
+
+/**
+ * Get a frame counted from the bottom of the stack.
+ * 
+ * @param[in] index The index of the frame, 0 being the oldest frame.
+ * @return Pointer to the frame.
+ * 
+ * @pre index < size()
+*/
+ShadowFrame *ShadowStack::frameAt(size_t index)
+{
+    DR_ASSERT(index < size());
+
+    return _tls->base + index;
+}
+
+size_t ShadowStack::size()
+{
+    return _tls->top - _tls->base;
+}
+
+bool ShadowStack::isEmpty()
+{
+    return _tls->top == _tls->base;
+}
+
+/**
+ * Double the capacity of the stack by committing more of the reserved region. Called by the inline instrumentation
+ * when a push would go past the limit.
+*/
+void ShadowStack::grow()
+{
+    if (_capacity == SHADOW_STACK_MAX_CAPACITY) {
+        dr_fprintf(STDERR, "Shadow stack overflow - more than %d nested calls\n", SHADOW_STACK_MAX_CAPACITY);
+        dr_abort();
+    }
+
+    size_t newCapacity = _capacity * 2;
+    bool ok = dr_memory_protect(_tls->base + _capacity, (newCapacity - _capacity) * sizeof(ShadowFrame), DR_MEMPROT_READ | DR_MEMPROT_WRITE);
+    DR_ASSERT(ok);
+
+    _capacity = newCapacity;
+    _tls->limit = _tls->base + newCapacity;
+}
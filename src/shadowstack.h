@@ -0,0 +1,57 @@
+#include <stddef.h>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef SHADOWSTACK_H
+#define SHADOWSTACK_H
+
+#define SHADOW_STACK_INITIAL_CAPACITY 4096
+// Address space reserved per thread, only the used part is committed
+#define SHADOW_STACK_MAX_CAPACITY (1 << 20)
+
+/*
+ * Layout of a frame as written by the inline call instrumentation. The field
+ * offsets are baked into the code cache, so this must stay a plain struct.
+ */
+typedef struct {
+    app_pc pc;
+    app_pc returnAddress;
+    reg_t sp;
+    reg_t bp;
+} ShadowFrame;
+
+/*
+ * Per-thread raw TLS slots read and written directly by the inline
+ * instrumentation. top points one past the last pushed frame.
+ */
+typedef struct {
+    ShadowFrame *top;
+    ShadowFrame *limit;
+    ShadowFrame *base;
+} ShadowStackTls;
+
+#define SHADOW_STACK_TLS_SLOTS (sizeof(ShadowStackTls) / sizeof(void *))
+
+/*
+ * Per-thread stack of frames for calls that have not returned yet. The frames
+ * live in a contiguous region reserved up front and committed as the stack
+ * grows, so frames never move.
+ */
+class ShadowStack {
+private:
+    ShadowStackTls *_tls;
+    size_t _capacity;
+
+public:
+    ShadowStack(ShadowStackTls *tls);
+    ~ShadowStack();
+    void pop();
+    ShadowFrame *top();
+    ShadowFrame *frameAt(size_t index);
+    size_t size();
+    bool isEmpty();
+    void grow();
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include <string.h>
+
+#include "statistics.h"
+
+/**
+ * Create the segment file and map it shared.
+ * 
+ * @param[in] path The path of the segment file, replaced if it exists.
+*/
+Statistics::Statistics(std::string path)
+{
+    _path = path;
+    _map = NULL;
+    _size = sizeof(StatsFileHeader) + STATS_MAX_THREADS * sizeof(StatsSlot);
+    _isValid = false;
+    _header = nullptr;
+    _slots = nullptr;
+    _mutex = dr_mutex_create();
+
+    file_t file = dr_open_file(path.c_str(), DR_FILE_READ | DR_FILE_WRITE_OVERWRITE);
+    if (file == INVALID_FILE) {
+        return;
+    }
+
+    if (dr_file_resize(file, _size)) {
+        _map = dr_map_file(file, &_size, 0, NULL, DR_MEMPROT_READ | DR_MEMPROT_WRITE, 0);
+    }
+    dr_close_file(file);
+
+    if (_map == NULL) {
+        dr_delete_file(path.c_str());
+        return;
+    }
+
+    memset(_map, 0, _size);
+
+    _header = (StatsFileHeader *) _map;
+    _slots = (StatsSlot *) ((byte *) _map + sizeof(StatsFileHeader));
+
+    _header->version = STATS_FILE_VERSION;
+    _header->slotCount = STATS_MAX_THREADS;
+    _header->counterCount = STAT_COUNTER_COUNT;
+    _header->timerCount = STAT_TIMER_COUNT;
+    _header->histogramBuckets = STATS_HISTOGRAM_BUCKETS;
+    _header->processId = dr_get_process_id();
+    _slots[STATS_RETIRED_SLOT].inUse = 1;
+
+    // Written last so a reader never sees a partial header
+    memcpy(_header->magic, STATS_FILE_MAGIC, STATS_FILE_MAGIC_SIZE);
+
+    _isValid = true;
+}
+
+Statistics::~Statistics()
+{
+    if (_map != NULL) {
+        dr_unmap_file(_map, _size);
+        dr_delete_file(_path.c_str());
+    }
+
+    dr_mutex_destroy(_mutex);
+}
+
+bool Statistics::isValid()
+{
+    return _isValid;
+}
+
+/**
+ * Get the statistics of a new thread.
+ * 
+ * @param[in] threadId The ID of the thread.
+ * @return A free slot of the segment, or private memory if there is none.
+*/
+ThreadStats *Statistics::acquire(thread_id_t threadId)
+{
+    dr_mutex_lock(_mutex);
+
+    for (uint i = 0; i < STATS_MAX_THREADS; i++) {
+        StatsSlot *slot = &_slots[i];
+        if (!slot->inUse) {
+            memset(&slot->stats, 0, sizeof(ThreadStats));
+            slot->threadId = threadId;
+            slot->inUse = 1;
+
+            dr_mutex_unlock(_mutex);
+            return &slot->stats;
+        }
+    }
+
+    dr_mutex_unlock(_mutex);
+
+    ThreadStats *stats = (ThreadStats *) dr_global_alloc(sizeof(ThreadStats));
+    memset(stats, 0, sizeof(ThreadStats));
+
+    return stats;
+}
+
+/**
+ * Fold the statistics of an exiting thread into the retired slot, and free its slot.
+ * 
+ * @param[in] stats The statistics returned by acquire.
+*/
+void Statistics::release(ThreadStats *stats)
+{
+    dr_mutex_lock(_mutex);
+
+    ThreadStats *retired = &_slots[STATS_RETIRED_SLOT].stats;
+    for (uint i = 0; i < STAT_COUNTER_COUNT; i++) {
+        retired->counters[i] += stats->counters[i];
+    }
+
+    for (uint i = 0; i < STAT_TIMER_COUNT; i++) {
+        for (uint j = 0; j < STATS_HISTOGRAM_BUCKETS; j++) {
+            retired->histograms[i][j] += stats->histograms[i][j];
+        }
+    }
+
+    if (isSlot(stats)) {
+        StatsSlot *slot = (StatsSlot *) ((byte *) stats - offsetof(StatsSlot, stats));
+        slot->inUse = 0;
+    } else {
+        dr_global_free(stats, sizeof(ThreadStats));
+    }
+
+    dr_mutex_unlock(_mutex);
+}
+
+/**
+ * Write the totals of all threads as JSON.
+ * 
+ * @param[in] file The file to write to.
+*/
+void Statistics::writeJson(file_t file)
+{
+    ThreadStats totals;
+    getTotals(&totals);
+
+    dr_fprintf(file, "{\n  \"pid\": %d,\n  \"counters\": {\n", dr_get_process_id());
+    for (uint i = 0; i < STAT_COUNTER_COUNT; i++) {
+        dr_fprintf(file, "    \"%s\": " UINT64_FORMAT_STRING "%s\n", STAT_COUNTER_NAMES[i], totals.counters[i],
+                    i + 1 < STAT_COUNTER_COUNT ? "," : "");
+    }
+
+    dr_fprintf(file, "  },\n  \"latency_cycles_log2_histograms\": {\n");
+    for (uint i = 0; i < STAT_TIMER_COUNT; i++) {
+        dr_fprintf(file, "    \"%s\": [", STAT_TIMER_NAMES[i]);
+        for (uint j = 0; j < STATS_HISTOGRAM_BUCKETS; j++) {
+            dr_fprintf(file, UINT64_FORMAT_STRING "%s", totals.histograms[i][j], j + 1 < STATS_HISTOGRAM_BUCKETS ? ", " : "");
+        }
+        dr_fprintf(file, "]%s\n", i + 1 < STAT_TIMER_COUNT ? "," : "");
+    }
+
+    dr_fprintf(file, "  }\n}\n");
+}
+
+/**
+ * Add a latency sample to a histogram.
+ * 
+ * @param[in] stats The statistics of the current thread.
+ * @param[in] timer The timer the sample belongs to.
+ * @param[in] cycles The latency in TSC cycles.
+*/
+void Statistics::recordLatency(ThreadStats *stats, StatTimer timer, uint64 cycles)
+{
+    uint bucket = cycles == 0 ? 0 : 63 - __builtin_clzll(cycles);
+    if (bucket >= STATS_HISTOGRAM_BUCKETS) {
+        bucket = STATS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    stats->histograms[timer][bucket]++;
+}
+
+bool Statistics::isSlot(ThreadStats *stats)
+{
+    return (byte *) stats >= (byte *) _slots && (byte *) stats < (byte *) (_slots + STATS_MAX_THREADS);
+}
+
+/**
+ * Sum the retired slot and the slots of running threads. Threads counting into private memory are missing until
+ * they exit.
+ * 
+ * @param[out] totals The sums.
+*/
+void Statistics::getTotals(ThreadStats *totals)
+{
+    memset(totals, 0, sizeof(ThreadStats));
+
+    dr_mutex_lock(_mutex);
+
+    for (uint i = 0; i < STATS_MAX_THREADS; i++) {
+        StatsSlot *slot = &_slots[i];
+        if (!slot->inUse) {
+            continue;
+        }
+
+        for (uint j = 0; j < STAT_COUNTER_COUNT; j++) {
+            totals->counters[j] += slot->stats.counters[j];
+        }
+
+        for (uint j = 0; j < STAT_TIMER_COUNT; j++) {
+            for (uint k = 0; k < STATS_HISTOGRAM_BUCKETS; k++) {
+                totals->histograms[j][k] += slot->stats.histograms[j][k];
+            }
+        }
+    }
+
+    dr_mutex_unlock(_mutex);
+}
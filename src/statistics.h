@@ -0,0 +1,41 @@
+#include <string>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "statsformat.h"
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+/*
+ * Owner of the live statistics segment (see statsformat.h). Each thread
+ * gets a slot of counters and latency histograms that only it writes. When
+ * all slots are taken, a thread counts into private memory that is only
+ * folded into the segment when it exits.
+ */
+class Statistics {
+private:
+    std::string _path;
+    void *_map;
+    size_t _size;
+    bool _isValid;
+    StatsFileHeader *_header;
+    StatsSlot *_slots;
+    void *_mutex;
+
+    bool isSlot(ThreadStats *stats);
+    void getTotals(ThreadStats *totals);
+
+public:
+    Statistics(std::string path);
+    ~Statistics();
+    bool isValid();
+    ThreadStats *acquire(thread_id_t threadId);
+    void release(ThreadStats *stats);
+    void writeJson(file_t file);
+
+    static void recordLatency(ThreadStats *stats, StatTimer timer, uint64 cycles);
+};
+
+#endif
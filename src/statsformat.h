@@ -0,0 +1,111 @@
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef STATSFORMAT_H
+#define STATSFORMAT_H
+
+/*
+ * Layout of the live statistics segment, a file in /dev/shm mapped shared by
+ * the client and polled by tools/statsreader. The header is followed by
+ * STATS_MAX_THREADS slots. Slot 0 accumulates threads that have exited, the
+ * others belong to one running thread each while inUse is set. Counters are
+ * only written by the owning thread and read without synchronization, so a
+ * reader may see a slightly stale value.
+ */
+
+#define STATS_FILE_MAGIC "DETSTAT\0"
+#define STATS_FILE_MAGIC_SIZE 8
+#define STATS_FILE_VERSION 1
+#define STATS_FILE_PREFIX "/dev/shm/detector-stats."
+
+#define STATS_MAX_THREADS 256
+#define STATS_RETIRED_SLOT 0
+
+// Latencies are bucketed by log2 of the cycle count, bucket i holds [2^i, 2^(i+1)) cycles
+#define STATS_HISTOGRAM_BUCKETS 32
+
+typedef enum {
+    STAT_DIRECT_CALL,
+    STAT_RETURN,
+    STAT_INDIRECT_CALL,
+    STAT_INDIRECT_JUMP,
+    STAT_INLINE_CACHE_MISS,
+    STAT_CFG_UNKNOWN_MODULE,
+    STAT_CFG_DIFFERENT_MODULE,
+    STAT_CFG_UNKNOWN_TARGET,
+    STAT_CFG_NOT_BEGINNING,
+    STAT_CFG_CFGNODE_NOT_FOUND,
+    STAT_CFG_CFGEDGE_NOT_FOUND,
+    STAT_CFG_CFGEDGE_FOUND,
+    STAT_RETURN_EMPTY_CALLSTACK,
+    STAT_RETURN_SP_NOT_FOUND,
+    STAT_RETURN_SUCCESS,
+    STAT_RETURN_FAIL,
+    STAT_MALLOC,
+    STAT_CALLOC,
+    STAT_REALLOC,
+    STAT_REALLOCARRAY,
+    STAT_FREE,
+    STAT_COUNTER_COUNT
+} StatCounter;
+
+typedef enum {
+    STAT_TIMER_CHECK_CFG,
+    STAT_TIMER_CHECK_RETURN,
+    STAT_TIMER_HEAP_LOOKUP,
+    STAT_TIMER_COUNT
+} StatTimer;
+
+typedef struct {
+    uint64 counters[STAT_COUNTER_COUNT];
+    uint64 histograms[STAT_TIMER_COUNT][STATS_HISTOGRAM_BUCKETS];
+} ThreadStats;
+
+typedef struct {
+    uint64 threadId;
+    uint64 inUse;
+    ThreadStats stats;
+} StatsSlot;
+
+typedef struct {
+    char magic[STATS_FILE_MAGIC_SIZE];
+    uint32 version;
+    uint32 slotCount;
+    uint32 counterCount;
+    uint32 timerCount;
+    uint32 histogramBuckets;
+    uint32 processId;
+} StatsFileHeader;
+
+// Names used in the JSON dump and by the reader, indexed by StatCounter and StatTimer
+static const char *const STAT_COUNTER_NAMES[STAT_COUNTER_COUNT] = {
+    "direct_call",
+    "return",
+    "indirect_call",
+    "indirect_jump",
+    "inline_cache_miss",
+    "cfg_unknown_module",
+    "cfg_different_module",
+    "cfg_unknown_target",
+    "cfg_not_beginning",
+    "cfg_cfgnode_not_found",
+    "cfg_cfgedge_not_found",
+    "cfg_cfgedge_found",
+    "return_empty_callstack",
+    "return_sp_not_found",
+    "return_success",
+    "return_fail",
+    "malloc",
+    "calloc",
+    "realloc",
+    "reallocarray",
+    "free"
+};
+
+static const char *const STAT_TIMER_NAMES[STAT_TIMER_COUNT] = {
+    "check_cfg",
+    "check_return",
+    "heap_lookup"
+};
+
+#endif
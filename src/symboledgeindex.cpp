@@ -0,0 +1,250 @@
+#include "drsyms.h"
+
+#include "symboledgeindex.h"
+
+/**
+ * Create an empty index.
+ * 
+ * @param[in] isSymbolLookupEnabled true to also look up names in the symbol tables with drsyms, false to only look
+ * up exports.
+*/
+SymbolEdgeIndex::SymbolEdgeIndex(bool isSymbolLookupEnabled)
+{
+    _lock = dr_rwlock_create();
+    _isSymbolLookupEnabled = isSymbolLookupEnabled;
+}
+
+SymbolEdgeIndex::~SymbolEdgeIndex()
+{
+    dr_rwlock_destroy(_lock);
+}
+
+/**
+ * Add the symbol edges of a CFG image, grouped by library so a module load only visits the edges naming it. The
+ * edges are resolved right away against the modules that are already loaded.
+ * 
+ * @param[in] image The CFG image, it must stay valid until removeImage.
+*/
+void SymbolEdgeIndex::addImage(CfgImage *image)
+{
+    PendingEdgeMap pendingEdges;
+    for (uint64 i = 0; i < image->getSiteCount(); i++) {
+        const CfgFileSite *site = image->getSite(i);
+        for (uint64 j = 0; j < site->symbolEdgeCount; j++) {
+            const char *name;
+            const char *library;
+            if (!image->getSymbolEdge(site, j, &name, &library)) {
+                continue;
+            }
+
+            pendingEdges[library].push_back({ site, name });
+        }
+    }
+
+    if (pendingEdges.empty()) {
+        return;
+    }
+
+    dr_module_iterator_t *iter = dr_module_iterator_start();
+    while (dr_module_iterator_hasnext(iter)) {
+        module_data_t *mod = dr_module_iterator_next(iter);
+        std::vector<ResolvedEdge> resolvedEdges;
+        resolveModule(mod, pendingEdges, &resolvedEdges);
+        addResolvedEdges(mod, resolvedEdges);
+        dr_free_module_data(mod);
+    }
+    dr_module_iterator_stop(iter);
+
+    dr_rwlock_write_lock(_lock);
+
+    for (auto &it : pendingEdges) {
+        std::vector<PendingEdge> &libraryEdges = _pendingEdges[it.first];
+        libraryEdges.insert(libraryEdges.end(), it.second.begin(), it.second.end());
+    }
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Drop the symbol edges of a CFG image, resolved or not.
+ * 
+ * @param[in] image The CFG image.
+*/
+void SymbolEdgeIndex::removeImage(CfgImage *image)
+{
+    dr_rwlock_write_lock(_lock);
+
+    for (auto &it : _pendingEdges) {
+        std::vector<PendingEdge> &libraryEdges = it.second;
+        for (size_t i = 0; i < libraryEdges.size();) {
+            if (image->containsSite(libraryEdges[i].site)) {
+                libraryEdges[i] = libraryEdges.back();
+                libraryEdges.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    for (auto &it : _moduleEdges) {
+        std::vector<ResolvedEdge> &moduleEdges = it.second;
+        for (size_t i = 0; i < moduleEdges.size();) {
+            if (image->containsSite(moduleEdges[i].site)) {
+                _edges.erase(moduleEdges[i]);
+                moduleEdges[i] = moduleEdges.back();
+                moduleEdges.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Resolve the symbol edges naming a newly loaded module, or any library.
+ * 
+ * @param[in] mod The loaded module.
+*/
+void SymbolEdgeIndex::addModule(const module_data_t *mod)
+{
+    // The pending edges change when a CFG is loaded or unloaded, which may happen on another thread
+    std::vector<ResolvedEdge> resolvedEdges;
+    dr_rwlock_read_lock(_lock);
+    resolveModule(mod, _pendingEdges, &resolvedEdges);
+    dr_rwlock_read_unlock(_lock);
+
+    addResolvedEdges(mod, resolvedEdges);
+}
+
+/**
+ * Drop the edges resolved into an unloaded module, its addresses may be reused by another module.
+ * 
+ * @param[in] mod The unloaded module.
+*/
+void SymbolEdgeIndex::removeModule(const module_data_t *mod)
+{
+    dr_rwlock_write_lock(_lock);
+
+    auto it = _moduleEdges.find(mod->start);
+    if (it != _moduleEdges.end()) {
+        for (auto edge : it->second) {
+            _edges.erase(edge);
+        }
+
+        _moduleEdges.erase(it);
+    }
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Check if a site has a symbol edge resolved to a target.
+ * 
+ * @param[in] site The site returned by CfgImage::findSite.
+ * @param[in] target The absolute address of the target.
+ * @return true if the edge exists, otherwise, false.
+*/
+bool SymbolEdgeIndex::hasEdge(const CfgFileSite *site, app_pc target)
+{
+    ResolvedEdge edge = { site, target };
+
+    dr_rwlock_read_lock(_lock);
+    bool found = _edges.find(edge) != _edges.end();
+    dr_rwlock_read_unlock(_lock);
+
+    return found;
+}
+
+size_t SymbolEdgeIndex::getCount()
+{
+    dr_rwlock_read_lock(_lock);
+    size_t count = _edges.size();
+    dr_rwlock_read_unlock(_lock);
+
+    return count;
+}
+
+/**
+ * Resolve the pending edges naming a module, or any library. The symbol table is only searched for the edges naming
+ * the module, edges of any library would otherwise load the debug info of every module. Those are resolved through
+ * the exports, and CfgImage::hasSymbolEdge matches them by name otherwise.
+ * 
+ * @param[in] mod The module to look up the names in.
+ * @param[in] pendingEdges The pending edges grouped by library.
+ * @param[out] resolvedEdges The edges that were found in the module.
+*/
+void SymbolEdgeIndex::resolveModule(const module_data_t *mod, const PendingEdgeMap &pendingEdges, std::vector<ResolvedEdge> *resolvedEdges)
+{
+    const char *modname = dr_module_preferred_name(mod);
+    if (modname == NULL) {
+        return;
+    }
+
+    auto it = pendingEdges.find(modname);
+    if (it != pendingEdges.end()) {
+        resolveEdges(mod, it->second, _isSymbolLookupEnabled, resolvedEdges);
+    }
+
+    it = pendingEdges.find("");
+    if (it != pendingEdges.end()) {
+        resolveEdges(mod, it->second, false, resolvedEdges);
+    }
+}
+
+/**
+ * Add resolved edges into a module to the index.
+ * 
+ * @param[in] mod The module the edges resolved into.
+ * @param[in] resolvedEdges The edges.
+*/
+void SymbolEdgeIndex::addResolvedEdges(const module_data_t *mod, const std::vector<ResolvedEdge> &resolvedEdges)
+{
+    if (resolvedEdges.empty()) {
+        return;
+    }
+
+    dr_rwlock_write_lock(_lock);
+
+    for (auto edge : resolvedEdges) {
+        _edges.insert(edge);
+    }
+
+    std::vector<ResolvedEdge> &moduleEdges = _moduleEdges[mod->start];
+    moduleEdges.insert(moduleEdges.end(), resolvedEdges.begin(), resolvedEdges.end());
+
+    dr_rwlock_write_unlock(_lock);
+}
+
+/**
+ * Look up the addresses of symbol edges in a module. Exports are looked up first, then the symbol table if enabled.
+ * Both addresses are kept when they differ, eg. an IFUNC export resolves to the selected implementation.
+ * 
+ * @param[in] mod The module to look up the names in.
+ * @param[in] pendingEdges The edges to resolve.
+ * @param[in] isSymbolLookupEnabled true to also look up the names in the symbol table with drsyms.
+ * @param[out] resolvedEdges The edges that were found in the module.
+*/
+void SymbolEdgeIndex::resolveEdges(const module_data_t *mod, const std::vector<PendingEdge> &pendingEdges, bool isSymbolLookupEnabled,
+                                    std::vector<ResolvedEdge> *resolvedEdges)
+{
+    for (auto pendingEdge : pendingEdges) {
+        app_pc exportAddress = (app_pc) dr_get_proc_address(mod->handle, pendingEdge.name);
+        if (exportAddress != NULL) {
+            resolvedEdges->push_back({ pendingEdge.site, exportAddress });
+        }
+
+        if (!isSymbolLookupEnabled) {
+            continue;
+        }
+
+        size_t offset;
+        if (drsym_lookup_symbol(mod->full_path, pendingEdge.name, &offset, DRSYM_DEFAULT_FLAGS) == DRSYM_SUCCESS) {
+            app_pc symbolAddress = mod->start + offset;
+            if (symbolAddress != exportAddress) {
+                resolvedEdges->push_back({ pendingEdge.site, symbolAddress });
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#include "cfgimage.h"
+
+#ifndef SYMBOLEDGEINDEX_H
+#define SYMBOLEDGEINDEX_H
+
+/*
+ * Symbol edges (S:library::name) of the loaded CFG images resolved to
+ * absolute addresses. Edges are resolved once when both their image and
+ * their library are loaded, and dropped when either is unloaded, so checking
+ * an external target is a set lookup on the site and target address.
+ */
+class SymbolEdgeIndex {
+private:
+    typedef struct {
+        const CfgFileSite *site;
+        const char *name;
+    } PendingEdge;
+
+    typedef struct ResolvedEdge {
+        const CfgFileSite *site;
+        app_pc target;
+
+        bool operator==(const ResolvedEdge &other) const
+        {
+            return site == other.site && target == other.target;
+        }
+    } ResolvedEdge;
+
+    struct ResolvedEdgeHash {
+        size_t operator()(const ResolvedEdge &edge) const
+        {
+            return (size_t) (((uint64) edge.target ^ ((uint64) edge.site << 32)) * 0x9E3779B97F4A7C15ULL);
+        }
+    };
+
+    typedef std::unordered_map<std::string, std::vector<PendingEdge>> PendingEdgeMap;
+
+    PendingEdgeMap _pendingEdges;
+    std::unordered_set<ResolvedEdge, ResolvedEdgeHash> _edges;
+    std::unordered_map<app_pc, std::vector<ResolvedEdge>> _moduleEdges;
+    void *_lock;
+    bool _isSymbolLookupEnabled;
+
+    void resolveModule(const module_data_t *mod, const PendingEdgeMap &pendingEdges, std::vector<ResolvedEdge> *resolvedEdges);
+    void resolveEdges(const module_data_t *mod, const std::vector<PendingEdge> &pendingEdges, bool isSymbolLookupEnabled,
+                        std::vector<ResolvedEdge> *resolvedEdges);
+    void addResolvedEdges(const module_data_t *mod, const std::vector<ResolvedEdge> &resolvedEdges);
+
+public:
+    SymbolEdgeIndex(bool isSymbolLookupEnabled);
+    ~SymbolEdgeIndex();
+    void addImage(CfgImage *image);
+    void removeImage(CfgImage *image);
+    void addModule(const module_data_t *mod);
+    void removeModule(const module_data_t *mod);
+    bool hasEdge(const CfgFileSite *site, app_pc target);
+    size_t getCount();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "targetbitmap.h"
+
+/**
+ * @param[in] span The size of the module, offsets at or past it are never valid.
+*/
+TargetBitmap::TargetBitmap(size_t span)
+{
+    _span = span;
+    _allocSize = ALIGN_FORWARD((span + 7) / 8, dr_page_size());
+    _isSealed = false;
+
+    // Fresh pages are zeroed, so offsets that are not targets need no initialization
+    _bits = (byte *) dr_raw_mem_alloc(_allocSize, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    DR_ASSERT(_bits != NULL);
+}
+
+TargetBitmap::~TargetBitmap()
+{
+    dr_raw_mem_free(_bits, _allocSize);
+}
+
+/**
+ * Mark an offset as a valid target. Offsets past the span are ignored.
+ * 
+ * @param[in] offset The module relative offset.
+ * @pre The bitmap is not sealed.
+*/
+void TargetBitmap::add(uint64 offset)
+{
+    DR_ASSERT(!_isSealed);
+
+    if (offset < _span) {
+        _bits[offset / 8] |= 1 << (offset % 8);
+    }
+}
+
+/**
+ * Make the bitmap read-only, once all targets are added.
+*/
+void TargetBitmap::seal()
+{
+    bool ok = dr_memory_protect(_bits, _allocSize, DR_MEMPROT_READ);
+    DR_ASSERT(ok);
+
+    _isSealed = true;
+}
+
+/**
+ * Check if an offset is a valid target.
+ * 
+ * @param[in] offset The module relative offset.
+ * @return true if the offset was added, otherwise, false.
+*/
+bool TargetBitmap::contains(uint64 offset)
+{
+    return offset < _span && (_bits[offset / 8] & (1 << (offset % 8))) != 0;
+}
+
+const byte *TargetBitmap::getBits()
+{
+    return _bits;
+}
+
+size_t TargetBitmap::getSpan()
+{
+    return _span;
+}
@@ -0,0 +1,29 @@
+#include "dr_defines.h"
+#include "dr_api.h"
+
+#ifndef TARGETBITMAP_H
+#define TARGETBITMAP_H
+
+/*
+ * One bit per offset of a module, set if the offset is a valid target. Bit k
+ * is bit k % 8 of byte k / 8, so the inline check is a single bit test with
+ * the offset as the bit index.
+ */
+class TargetBitmap {
+private:
+    byte *_bits;
+    size_t _span;
+    size_t _allocSize;
+    bool _isSealed;
+
+public:
+    TargetBitmap(size_t span);
+    ~TargetBitmap();
+    void add(uint64 offset);
+    void seal();
+    bool contains(uint64 offset);
+    const byte *getBits();
+    size_t getSpan();
+};
+
+#endif
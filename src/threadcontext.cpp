@@ -1,19 +1,15 @@
 #include "threadcontext.h"
 
-ThreadContext::ThreadContext(void *drcontext)
+ThreadContext::ThreadContext(void *drcontext, ShadowStackTls *shadowStackTls, bool hasEventRing) : _shadowStack(shadowStackTls)
 {
     _drcontext = drcontext;
     _threadId = dr_get_thread_id(drcontext);
+    _eventRing = hasEventRing ? new EventRing() : nullptr;
 }
 
 ThreadContext::~ThreadContext()
 {
-    while (!_callStack.empty()) {
-        CallNode *node = _callStack.top();
-        _callStack.pop();
-
-        delete node;
-    }
+    delete _eventRing;
 }
 
 thread_id_t ThreadContext::getThreadId()
@@ -21,7 +17,17 @@ thread_id_t ThreadContext::getThreadId()
     return _threadId;
 }
 
-std::stack<CallNode *> *ThreadContext::getCallStack()
+ShadowStack *ThreadContext::getShadowStack()
+{
+    return &_shadowStack;
+}
+
+/**
+ * Get the ring the thread queues indirect branches to in asynchronous mode.
+ * 
+ * @return Pointer to the ring, nullptr if checks are synchronous.
+*/
+EventRing *ThreadContext::getEventRing()
 {
-    return &_callStack;
+    return _eventRing;
 }
@@ -1,9 +1,8 @@
-#include <stack>
-
 #include "dr_defines.h"
 #include "dr_api.h"
 
-#include "callnode.h"
+#include "shadowstack.h"
+#include "eventring.h"
 
 #ifndef THREADCONTEXT_H
 #define THREADCONTEXT_H
@@ -12,13 +11,15 @@ class ThreadContext {
 private:
     void *_drcontext;
     thread_id_t _threadId;
-    std::stack<CallNode *> _callStack;
+    ShadowStack _shadowStack;
+    EventRing *_eventRing;
 
 public:
-    ThreadContext(void *drcontext);
+    ThreadContext(void *drcontext, ShadowStackTls *shadowStackTls, bool hasEventRing);
     ~ThreadContext();
     thread_id_t getThreadId();
-    std::stack<CallNode *> *getCallStack();
+    ShadowStack *getShadowStack();
+    EventRing *getEventRing();
 };
 
 #endif
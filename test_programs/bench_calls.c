@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_ITERATIONS 200000
+#define DEEP_DEPTH 256
+#define WIDE_ROUNDS 16
+
+static volatile unsigned long sink;
+
+// Deep chain: one recursive call per level, every return pops through DEEP_DEPTH frames
+__attribute__((noinline)) static unsigned long deep(int depth) {
+	if (depth == 0) {
+		return 1;
+	}
+	return deep(depth - 1) + depth;
+}
+
+// Wide chain: many distinct direct call sites at depth 1
+#define LEAF(n) __attribute__((noinline)) static unsigned long leaf##n(unsigned long x) { return x * (n + 1) + n; }
+LEAF(0) LEAF(1) LEAF(2) LEAF(3) LEAF(4) LEAF(5) LEAF(6) LEAF(7)
+LEAF(8) LEAF(9) LEAF(10) LEAF(11) LEAF(12) LEAF(13) LEAF(14) LEAF(15)
+
+__attribute__((noinline)) static unsigned long wide(unsigned long x) {
+	for (int i = 0; i < WIDE_ROUNDS; i++) {
+		x = leaf0(x) ^ leaf1(x) ^ leaf2(x) ^ leaf3(x) ^ leaf4(x) ^ leaf5(x) ^ leaf6(x) ^ leaf7(x);
+		x = leaf8(x) ^ leaf9(x) ^ leaf10(x) ^ leaf11(x) ^ leaf12(x) ^ leaf13(x) ^ leaf14(x) ^ leaf15(x);
+	}
+	return x;
+}
+
+int main(int argc, char **argv) {
+	long iterations = DEFAULT_ITERATIONS;
+	if (argc >= 2) {
+		iterations = atol(argv[1]);
+	}
+
+	if (iterations < 1) {
+		printf("Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	for (long i = 0; i < iterations; i++) {
+		sink += deep(DEEP_DEPTH);
+		sink += wide(i);
+	}
+
+	printf("calls: %ld\n", iterations * (DEEP_DEPTH + 1 + 1 + WIDE_ROUNDS * 16));
+	return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_ITERATIONS 20000000
+#define TABLE_SIZE 16
+
+static volatile unsigned long sink;
+
+#define HANDLER(n) __attribute__((noinline)) static unsigned long handler##n(unsigned long x) { return x * (n + 3) + n; }
+HANDLER(0) HANDLER(1) HANDLER(2) HANDLER(3) HANDLER(4) HANDLER(5) HANDLER(6) HANDLER(7)
+HANDLER(8) HANDLER(9) HANDLER(10) HANDLER(11) HANDLER(12) HANDLER(13) HANDLER(14) HANDLER(15)
+
+static unsigned long (*const table[TABLE_SIZE])(unsigned long) = {
+	handler0, handler1, handler2, handler3, handler4, handler5, handler6, handler7,
+	handler8, handler9, handler10, handler11, handler12, handler13, handler14, handler15
+};
+
+int main(int argc, char **argv) {
+	long iterations = DEFAULT_ITERATIONS;
+	int targets = TABLE_SIZE;
+	if (argc >= 2) {
+		iterations = atol(argv[1]);
+	}
+	if (argc >= 3) {
+		targets = atoi(argv[2]);
+	}
+
+	if (iterations < 1 || targets < 1 || targets > TABLE_SIZE) {
+		printf("Usage: %s [iterations] [targets (1-%d)]\n", argv[0], TABLE_SIZE);
+		return 1;
+	}
+
+	// Pseudo-random target per call, so a site sees all of its targets
+	unsigned long state = 88172645463325252UL;
+	unsigned long x = 0;
+	for (long i = 0; i < iterations; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		x = table[state % targets](x);
+	}
+
+	sink = x;
+	printf("indirect calls: %ld\n", iterations);
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_ITERATIONS 20000000
+
+static volatile unsigned long sink;
+
+// Dense cases so the compiler emits a jump table, an indirect jump per iteration
+__attribute__((noinline)) static unsigned long step(unsigned long op, unsigned long x) {
+	switch (op) {
+	case 0: return x + 1;
+	case 1: return x * 3;
+	case 2: return x ^ 0x5555;
+	case 3: return x - 7;
+	case 4: return x << 1;
+	case 5: return x >> 1;
+	case 6: return x | 0x10;
+	case 7: return x & 0xffff;
+	case 8: return x + 11;
+	case 9: return x * 5;
+	case 10: return x ^ 0xaaaa;
+	case 11: return x - 13;
+	case 12: return x + 17;
+	case 13: return x * 7;
+	case 14: return ~x;
+	default: return x;
+	}
+}
+
+int main(int argc, char **argv) {
+	long iterations = DEFAULT_ITERATIONS;
+	if (argc >= 2) {
+		iterations = atol(argv[1]);
+	}
+
+	if (iterations < 1) {
+		printf("Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	unsigned long state = 2463534242UL;
+	unsigned long x = 0;
+	for (long i = 0; i < iterations; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		x = step(state & 15, x);
+	}
+
+	sink = x;
+	printf("switches: %ld\n", iterations);
+	return 0;
+}
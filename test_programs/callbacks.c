@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* libc calls back into the program through function pointers */
+
+int compare(const void *a, const void *b) {
+   return *(const int *) a - *(const int *) b;
+}
+
+void *worker(void *arg) {
+   int *values = arg;
+   qsort(values, 5, sizeof(int), compare);
+   return values;
+}
+
+void done() {
+   printf("atexit handler\n");
+}
+
+int main () {
+   int values[] = { 5, 3, 1, 4, 2 };
+   pthread_t thread;
+
+   atexit(done);
+
+   pthread_create(&thread, NULL, worker, values);
+   pthread_join(thread, NULL);
+
+   for (int i = 0; i < 5; i++) {
+      printf("%d ", values[i]);
+   }
+   printf("\n");
+
+   /* an imported function called through a pointer loaded from its GOT slot */
+   int (*compareStrings)(const char *, const char *) = strcmp;
+   printf("strcmp = %d\n", compareStrings("a", "a"));
+
+   return(0);
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#define BATCH_SIZE 1024
+#define DEFAULT_ROUNDS 200
+
+typedef struct {
+	int id;
+	int threadCount;
+	int rounds;
+	void **slots;
+	pthread_barrier_t *barrier;
+} ThreadArgs;
+
+static void **allSlots[64];
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg) {
+	ThreadArgs *args = (ThreadArgs *) arg;
+
+	for (int round = 0; round < args->rounds; round++) {
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			args->slots[i] = malloc(16 + (i % 64) * 8);
+		}
+
+		// Half of the batch is grown in place or moved
+		for (int i = 0; i < BATCH_SIZE; i += 2) {
+			args->slots[i] = realloc(args->slots[i], 1024);
+		}
+
+		pthread_barrier_wait(args->barrier);
+
+		// Free the neighbour's batch so every free is a cross-thread free
+		void **victim = allSlots[(args->id + 1) % args->threadCount];
+		for (int i = 0; i < BATCH_SIZE; i++) {
+			free(victim[i]);
+		}
+
+		pthread_barrier_wait(args->barrier);
+	}
+
+	return NULL;
+}
+
+static double run(int threadCount, int rounds) {
+	pthread_t threads[64];
+	ThreadArgs args[64];
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, threadCount);
+
+	for (int i = 0; i < threadCount; i++) {
+		allSlots[i] = calloc(BATCH_SIZE, sizeof(void *));
+		args[i].id = i;
+		args[i].threadCount = threadCount;
+		args[i].rounds = rounds;
+		args[i].slots = allSlots[i];
+		args[i].barrier = &barrier;
+	}
+
+	double start = now();
+	for (int i = 0; i < threadCount; i++) {
+		pthread_create(&threads[i], NULL, worker, &args[i]);
+	}
+	for (int i = 0; i < threadCount; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	double elapsed = now() - start;
+
+	for (int i = 0; i < threadCount; i++) {
+		free(allSlots[i]);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	// malloc and realloc both count as allocations
+	double allocations = (double) threadCount * rounds * (BATCH_SIZE + BATCH_SIZE / 2);
+	return allocations / elapsed;
+}
+
+int main(int argc, char **argv) {
+	int maxThreads = 8;
+	int rounds = DEFAULT_ROUNDS;
+	if (argc >= 2) {
+		maxThreads = atoi(argv[1]);
+	}
+	if (argc >= 3) {
+		rounds = atoi(argv[2]);
+	}
+
+	if (maxThreads < 1 || maxThreads > 64 || rounds < 1) {
+		printf("Usage: %s [max threads (1-64)] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	printf("threads,allocs_per_sec\n");
+	for (int threadCount = 1; threadCount <= maxThreads; threadCount++) {
+		printf("%d,%.0f\n", threadCount, run(threadCount, rounds));
+	}
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+# Usage: python3 run_benchmarks.py --drrun <DynamoRio Folder>/bin64/drrun --client <Project Folder>/build/libdetector.so
+# Runs each benchmark natively, under bare drrun and under the detector, and reports the median wall time, the
+# slowdown relative to native and the peak RSS of each configuration as JSON (or CSV with --csv).
+# Build the benchmarks with make first.
+import argparse
+import csv
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# name -> arguments, sized to run for about a second natively
+BENCHMARKS = {
+    'bench_calls': ['200000'],
+    'bench_indirect': ['20000000'],
+    'bench_switch': ['20000000'],
+    'heap_stress': ['4', '200'],
+}
+
+CONFIGURATIONS = ['native', 'drrun', 'detector']
+
+RSS_POLL_INTERVAL = 0.005
+
+
+def build_command(configuration, program, program_args, args, cfg_path):
+    if configuration == 'native':
+        return [program] + program_args
+
+    if configuration == 'drrun':
+        return [args.drrun, '--', program] + program_args
+
+    return [args.drrun, '-c', args.client] + args.client_options + [cfg_path, '--', program] + program_args
+
+
+def read_peak_rss(pid):
+    """Return the VmHWM of a running process in KiB, or 0 once it has exited."""
+    try:
+        with open('/proc/{}/status'.format(pid)) as f:
+            for line in f:
+                if line.startswith('VmHWM:'):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+
+    return 0
+
+
+def run_once(command):
+    """Run a command and return its wall time in seconds and peak RSS in KiB."""
+    # stderr goes to a file, a pipe could fill up while the process is being polled
+    stderr_file = tempfile.TemporaryFile()
+    start = time.monotonic()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=stderr_file)
+
+    # ru_maxrss of the child would include the interpreter memory it had before exec, so VmHWM is sampled instead
+    peak_rss = 0
+    while True:
+        pid, status, _ = os.wait4(process.pid, os.WNOHANG)
+        if pid != 0:
+            break
+        peak_rss = max(peak_rss, read_peak_rss(process.pid))
+        time.sleep(RSS_POLL_INTERVAL)
+    elapsed = time.monotonic() - start
+
+    # Popen would otherwise wait on the already reaped process
+    process.returncode = os.waitstatus_to_exitcode(status)
+    stderr_file.seek(0)
+    stderr = stderr_file.read().decode('utf-8', 'replace')
+    stderr_file.close()
+
+    if process.returncode != 0:
+        raise RuntimeError('{} exited with {}:\n{}'.format(' '.join(command), process.returncode, stderr))
+
+    return elapsed, peak_rss
+
+
+def run_benchmark(name, program_args, args, cfg_path):
+    program = os.path.join(SCRIPT_DIR, name)
+    result = {'benchmark': name, 'args': program_args}
+
+    for configuration in CONFIGURATIONS:
+        command = build_command(configuration, program, program_args, args, cfg_path)
+        times = []
+        peak_rss = 0
+        for _ in range(args.repeat):
+            elapsed, rss = run_once(command)
+            times.append(elapsed)
+            peak_rss = max(peak_rss, rss)
+
+        result[configuration + '_seconds'] = statistics.median(times)
+        result[configuration + '_peak_rss_kib'] = peak_rss
+
+    native = result['native_seconds']
+    for configuration in CONFIGURATIONS[1:]:
+        result[configuration + '_slowdown'] = result[configuration + '_seconds'] / native if native > 0 else None
+
+    return result
+
+
+def write_results(results, use_csv, output):
+    if use_csv:
+        writer = csv.DictWriter(output, fieldnames=list(results[0].keys()))
+        writer.writeheader()
+        for result in results:
+            row = dict(result)
+            row['args'] = ' '.join(row['args'])
+            writer.writerow(row)
+    else:
+        json.dump(results, output, indent=2)
+        output.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--drrun', required=True, help='path to drrun')
+    parser.add_argument('--client', required=True, help='path to libdetector.so')
+    parser.add_argument('--cfg', help='CFG file or directory passed to the detector (default: an empty CFG)')
+    parser.add_argument('--client-option', dest='client_options', action='append', default=[],
+                        help='extra detector option, eg. --client-option=-async (repeatable)')
+    parser.add_argument('--repeat', type=int, default=3, help='runs per configuration, the median time is reported')
+    parser.add_argument('--csv', action='store_true', help='write CSV instead of JSON')
+    parser.add_argument('--output', help='output file (default: stdout)')
+    parser.add_argument('benchmarks', nargs='*', help='benchmarks to run (default: all)')
+
+    args = parser.parse_args()
+
+    names = args.benchmarks or list(BENCHMARKS.keys())
+    for name in names:
+        if name not in BENCHMARKS:
+            parser.error('unknown benchmark {}, expected one of {}'.format(name, ', '.join(BENCHMARKS.keys())))
+        if not os.path.exists(os.path.join(SCRIPT_DIR, name)):
+            parser.error('{} is not built, run make in {}'.format(name, SCRIPT_DIR))
+
+    # Without a CFG the detector still runs the shadow stack and heap checks
+    empty_cfg = None
+    cfg_path = args.cfg
+    if cfg_path is None:
+        empty_cfg = tempfile.NamedTemporaryFile(suffix='.cfg', delete=False)
+        empty_cfg.close()
+        cfg_path = empty_cfg.name
+
+    try:
+        results = []
+        for name in names:
+            print('Running {}...'.format(name), file=sys.stderr)
+            results.append(run_benchmark(name, BENCHMARKS[name], args, cfg_path))
+    finally:
+        if empty_cfg is not None:
+            os.remove(empty_cfg.name)
+
+    if args.output:
+        with open(args.output, 'w', newline='') as f:
+            write_results(results, args.csv, f)
+    else:
+        write_results(results, args.csv, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t count = 0;
+
+void handler(int sig) {
+   count++;
+}
+
+int main () {
+   struct sigaction action;
+   action.sa_handler = handler;
+   action.sa_flags = 0;
+   sigemptyset(&action.sa_mask);
+   sigaction(SIGUSR1, &action, NULL);
+   sigaction(SIGALRM, &action, NULL);
+
+   /* the handler returns to the sigreturn trampoline of libc */
+   for (int i = 0; i < 3; i++) {
+      raise(SIGUSR1);
+   }
+
+   alarm(1);
+   pause();
+
+   printf("handled %d signals\n", (int) count);
+
+   return(0);
+}
@@ -0,0 +1,739 @@
+/*
+ * Extracts the CFG of an x86-64 ELF file without Ghidra. The executable
+ * sections are cut at function starts (symbols and unwind entries) and the
+ * pieces are decoded linearly by the DynamoRIO standalone decoder on all
+ * cores. Switch dispatch through a bounded jump table gets one O: edge per
+ * case, jumps and calls through a GOT slot get an S: edge to the symbol of
+ * the slot, and other indirect calls get L:1, the label of every
+ * address-taken function, and an S: edge to every imported function whose
+ * address is taken, since they may call out of the module through it. Other
+ * indirect jumps are left out, the client does not check sites without a CFG
+ * entry.
+ *
+ * Usage: cfgextract [-binary] [-threads <count>] <program> <output>
+ */
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dr_api.h"
+
+#include "cfgbuilder.h"
+#include "moduleid.h"
+
+#define ADDRESS_TAKEN_LABEL 1
+#define ELF_PAGE_SIZE 0x1000
+// Longest instruction, the file data is padded so the decoder never reads past it
+#define MAX_INSTRUCTION_LENGTH 16
+// Instructions searched back from a jump for the table load and its bounds check
+#define JUMP_TABLE_WINDOW 16
+#define MAX_JUMP_TABLE_ENTRIES 0x10000
+
+// .eh_frame_hdr encodings of the binary search table written by GNU ld and lld
+#define DW_EH_PE_udata4 0x03
+#define DW_EH_PE_sdata4 0x0b
+#define DW_EH_PE_pcrel 0x10
+#define DW_EH_PE_datarel 0x30
+
+typedef struct {
+    uint64 start;
+    uint64 end;
+} Range;
+
+// The fields of a decoded instruction the jump table match looks at, registers are pointer sized
+typedef struct {
+    uint64 pc;
+    int opcode;
+    reg_id_t dst;
+    reg_id_t src;
+    reg_id_t base;
+    reg_id_t index;
+    int scale;
+    uint64 address;
+    ptr_int_t immediate;
+    bool hasImmediate;
+} Instruction;
+
+typedef struct {
+    uint64 pc;
+    bool isCall;
+    // GOT slot the target is loaded from, 0 if none
+    uint64 slot;
+    uint64 table;
+    uint32 entryCount;
+    uint32 entrySize;
+    std::vector<uint64> targets;
+} Site;
+
+typedef struct {
+    std::vector<uint64> instructions;
+    std::vector<uint64> returnSites;
+    std::vector<uint64> codeReferences;
+    std::vector<Site> sites;
+} PieceResult;
+
+typedef struct {
+    std::vector<byte> data;
+    const Elf64_Ehdr *header;
+    std::vector<Elf64_Shdr> sections;
+    std::vector<Elf64_Phdr> segments;
+    std::vector<Range> code;
+    uint64 base;
+    // GOT slot -> symbol name, from JUMP_SLOT and GLOB_DAT relocations
+    std::unordered_map<uint64, std::string> slotSymbols;
+    // Undefined functions whose address is loaded, from GLOB_DAT and 64 relocations
+    std::set<std::string> importedFunctions;
+    // Relocated pointer -> value, from RELATIVE and 64 relocations against defined symbols
+    std::unordered_map<uint64, uint64> pointers;
+    std::vector<uint64> functions;
+    std::vector<uint64> exportedFunctions;
+} ElfFile;
+
+static const char *getSectionName(const ElfFile &elf, const Elf64_Shdr &section)
+{
+    const Elf64_Shdr &names = elf.sections[elf.header->e_shstrndx];
+    return (const char *) &elf.data[names.sh_offset + section.sh_name];
+}
+
+// Bytes at a virtual address, nullptr unless size bytes are backed by the file
+static const byte *readAddress(const ElfFile &elf, uint64 address, size_t size)
+{
+    for (const Elf64_Phdr &segment : elf.segments) {
+        if (address >= segment.p_vaddr && address + size <= segment.p_vaddr + segment.p_filesz) {
+            return &elf.data[segment.p_offset + address - segment.p_vaddr];
+        }
+    }
+
+    return nullptr;
+}
+
+static bool isCode(const ElfFile &elf, uint64 address)
+{
+    for (const Range &range : elf.code) {
+        if (address >= range.start && address < range.end) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void readSymbols(ElfFile *elf, const Elf64_Shdr &table)
+{
+    size_t count = table.sh_entsize != 0 ? table.sh_size / table.sh_entsize : 0;
+    for (size_t i = 0; i < count; i++) {
+        const Elf64_Sym *symbol = (const Elf64_Sym *) &elf->data[table.sh_offset + i * table.sh_entsize];
+        if (ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_shndx == SHN_UNDEF || !isCode(*elf, symbol->st_value)) {
+            continue;
+        }
+
+        elf->functions.push_back(symbol->st_value);
+        if (table.sh_type == SHT_DYNSYM) {
+            elf->exportedFunctions.push_back(symbol->st_value);
+        }
+    }
+}
+
+static void readRelocations(ElfFile *elf, const Elf64_Shdr &table)
+{
+    const Elf64_Shdr *symbols = table.sh_link != 0 ? &elf->sections[table.sh_link] : nullptr;
+    size_t count = table.sh_entsize != 0 ? table.sh_size / table.sh_entsize : 0;
+    for (size_t i = 0; i < count; i++) {
+        const Elf64_Rela *relocation = (const Elf64_Rela *) &elf->data[table.sh_offset + i * table.sh_entsize];
+        uint32 type = ELF64_R_TYPE(relocation->r_info);
+        if (type == R_X86_64_RELATIVE) {
+            elf->pointers[relocation->r_offset] = relocation->r_addend;
+            continue;
+        }
+
+        if ((type != R_X86_64_JUMP_SLOT && type != R_X86_64_GLOB_DAT && type != R_X86_64_64) || symbols == nullptr) {
+            continue;
+        }
+
+        const Elf64_Sym *symbol = (const Elf64_Sym *) &elf->data[symbols->sh_offset + ELF64_R_SYM(relocation->r_info) * symbols->sh_entsize];
+        const Elf64_Shdr &strings = elf->sections[symbols->sh_link];
+        if (type != R_X86_64_JUMP_SLOT && symbol->st_shndx == SHN_UNDEF && ELF64_ST_TYPE(symbol->st_info) == STT_FUNC) {
+            elf->importedFunctions.insert((const char *) &elf->data[strings.sh_offset + symbol->st_name]);
+        }
+
+        if (type == R_X86_64_64) {
+            if (symbol->st_shndx != SHN_UNDEF) {
+                elf->pointers[relocation->r_offset] = symbol->st_value + relocation->r_addend;
+            }
+            continue;
+        }
+
+        elf->slotSymbols[relocation->r_offset] = (const char *) &elf->data[strings.sh_offset + symbol->st_name];
+    }
+}
+
+// Function starts from the binary search table of .eh_frame_hdr, present in stripped files too
+static void readUnwindTable(ElfFile *elf, const Elf64_Shdr &section)
+{
+    const byte *header = &elf->data[section.sh_offset];
+    if (section.sh_size < 12 || header[0] != 1 || header[1] != (DW_EH_PE_pcrel | DW_EH_PE_sdata4) || header[2] != DW_EH_PE_udata4 ||
+        header[3] != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+        return;
+    }
+
+    uint32 count = *(const uint32 *) (header + 8);
+    if (12 + (uint64) count * 8 > section.sh_size) {
+        return;
+    }
+
+    for (uint32 i = 0; i < count; i++) {
+        int32_t start = *(const int32_t *) (header + 12 + i * 8);
+        uint64 address = section.sh_addr + start;
+        if (isCode(*elf, address)) {
+            elf->functions.push_back(address);
+        }
+    }
+}
+
+static bool loadElf(const char *filename, ElfFile *elf)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    elf->data.resize(size + MAX_INSTRUCTION_LENGTH);
+    bool isRead = size >= (long) sizeof(Elf64_Ehdr) && fread(elf->data.data(), 1, size, file) == (size_t) size;
+    fclose(file);
+
+    elf->header = (const Elf64_Ehdr *) elf->data.data();
+    if (!isRead || memcmp(elf->header->e_ident, ELFMAG, SELFMAG) != 0 || elf->header->e_ident[EI_CLASS] != ELFCLASS64 ||
+        elf->header->e_machine != EM_X86_64) {
+        return false;
+    }
+
+    uint64 base = UINT64_MAX;
+    for (int i = 0; i < elf->header->e_phnum; i++) {
+        const Elf64_Phdr *segment = (const Elf64_Phdr *) &elf->data[elf->header->e_phoff + i * elf->header->e_phentsize];
+        if (segment->p_type == PT_LOAD) {
+            elf->segments.push_back(*segment);
+            base = std::min(base, (uint64) segment->p_vaddr);
+        }
+    }
+    if (elf->segments.empty()) {
+        return false;
+    }
+
+    // Offsets are taken from the start of the first mapped page, like the client and the Ghidra export
+    elf->base = base & ~((uint64) ELF_PAGE_SIZE - 1);
+
+    for (int i = 0; i < elf->header->e_shnum; i++) {
+        elf->sections.push_back(*(const Elf64_Shdr *) &elf->data[elf->header->e_shoff + i * elf->header->e_shentsize]);
+    }
+
+    for (const Elf64_Shdr &section : elf->sections) {
+        if ((section.sh_flags & SHF_EXECINSTR) != 0 && section.sh_type == SHT_PROGBITS && section.sh_size > 0) {
+            elf->code.push_back({ section.sh_addr, section.sh_addr + section.sh_size });
+        }
+    }
+
+    // Relocations first, init and fini arrays of position independent files are filled in by them
+    for (const Elf64_Shdr &section : elf->sections) {
+        if (section.sh_type == SHT_RELA) {
+            readRelocations(elf, section);
+        }
+    }
+
+    for (const Elf64_Shdr &section : elf->sections) {
+        if (section.sh_type == SHT_SYMTAB || section.sh_type == SHT_DYNSYM) {
+            readSymbols(elf, section);
+        } else if (strcmp(getSectionName(*elf, section), ".eh_frame_hdr") == 0) {
+            readUnwindTable(elf, section);
+        } else if (section.sh_type == SHT_INIT_ARRAY || section.sh_type == SHT_FINI_ARRAY) {
+            for (uint64 offset = 0; offset + sizeof(uint64) <= section.sh_size; offset += sizeof(uint64)) {
+                auto it = elf->pointers.find(section.sh_addr + offset);
+                uint64 address = it != elf->pointers.end() ? it->second : *(const uint64 *) &elf->data[section.sh_offset + offset];
+                elf->functions.push_back(address);
+            }
+        }
+    }
+
+    elf->functions.push_back(elf->header->e_entry);
+
+    return true;
+}
+
+// Cut the code at function starts, so every piece starts on an instruction and can be decoded on its own
+static std::vector<Range> getPieces(const ElfFile &elf)
+{
+    std::vector<Range> pieces;
+    for (const Range &range : elf.code) {
+        std::vector<uint64> starts = { range.start };
+        for (uint64 function : elf.functions) {
+            if (function > range.start && function < range.end) {
+                starts.push_back(function);
+            }
+        }
+
+        std::sort(starts.begin(), starts.end());
+        starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+        for (size_t i = 0; i < starts.size(); i++) {
+            pieces.push_back({ starts[i], i + 1 < starts.size() ? starts[i + 1] : range.end });
+        }
+    }
+
+    return pieces;
+}
+
+static Instruction describeInstruction(instr_t *instr, uint64 pc)
+{
+    Instruction instruction = {};
+    instruction.pc = pc;
+    instruction.opcode = instr_get_opcode(instr);
+
+    if (instr_num_dsts(instr) > 0 && opnd_is_reg(instr_get_dst(instr, 0))) {
+        instruction.dst = reg_to_pointer_sized(opnd_get_reg(instr_get_dst(instr, 0)));
+    }
+
+    for (int i = 0; i < instr_num_srcs(instr); i++) {
+        opnd_t src = instr_get_src(instr, i);
+        if (opnd_is_reg(src)) {
+            if (instruction.src == DR_REG_NULL) {
+                instruction.src = reg_to_pointer_sized(opnd_get_reg(src));
+            }
+        } else if (opnd_is_immed_int(src)) {
+            instruction.immediate = opnd_get_immed_int(src);
+            instruction.hasImmediate = true;
+        } else if (opnd_is_rel_addr(src) || opnd_is_abs_addr(src)) {
+            instruction.address = (uint64) opnd_get_addr(src);
+        } else if (opnd_is_base_disp(src)) {
+            instruction.base = opnd_get_base(src) != DR_REG_NULL ? reg_to_pointer_sized(opnd_get_base(src)) : DR_REG_NULL;
+            instruction.index = opnd_get_index(src) != DR_REG_NULL ? reg_to_pointer_sized(opnd_get_index(src)) : DR_REG_NULL;
+            instruction.scale = opnd_get_scale(src);
+            instruction.address = (uint64) (ptr_int_t) opnd_get_disp(src);
+        }
+    }
+
+    return instruction;
+}
+
+/**
+ * Match a switch dispatch ending at the last instruction of the window, either jmp [table + index * 8] or the
+ * position independent lea base, [rip + table]; movsxd target, [base + index * 4]; add target, base; jmp target. The
+ * entry count is taken from the bounds check of the index, cmp index, <bound> followed by an unsigned jcc.
+ *
+ * @param[in] elf The file.
+ * @param[in] window The instructions of the piece decoded so far, ending with the indirect jump.
+ * @param[out] site Receives the table, entry count and case targets.
+ * @return true if a bounded jump table was found, otherwise, false.
+*/
+static bool matchJumpTable(const ElfFile &elf, const std::vector<Instruction> &window, Site *site)
+{
+    size_t jump = window.size() - 1;
+    size_t first = jump > JUMP_TABLE_WINDOW ? jump - JUMP_TABLE_WINDOW : 0;
+
+    size_t load = jump;
+    reg_id_t index = DR_REG_NULL;
+    uint64 table = 0;
+    bool isRelative = false;
+    if (window[jump].index != DR_REG_NULL && window[jump].base == DR_REG_NULL && window[jump].scale == sizeof(uint64)) {
+        index = window[jump].index;
+        table = window[jump].address;
+    } else if (window[jump].src != DR_REG_NULL) {
+        reg_id_t target = window[jump].src;
+        for (load = jump; load-- > first;) {
+            if (window[load].opcode == OP_movsxd && window[load].dst == target && window[load].scale == sizeof(int32_t)) {
+                break;
+            }
+        }
+        if (load < first || load >= jump) {
+            return false;
+        }
+
+        for (size_t i = load; i-- > first;) {
+            if (window[i].opcode == OP_lea && window[i].dst == window[load].base && window[i].base == DR_REG_NULL && window[i].index == DR_REG_NULL) {
+                index = window[load].index;
+                table = window[i].address;
+                isRelative = true;
+                break;
+            }
+        }
+    }
+
+    if (index == DR_REG_NULL || table == 0 || isCode(elf, table)) {
+        return false;
+    }
+
+    // Follows one register copy, eg. mov eax, edi between the check and the load
+    uint64 entryCount = 0;
+    for (size_t i = load; i-- > first && entryCount == 0;) {
+        const Instruction &instruction = window[i];
+        if ((instruction.opcode == OP_mov_ld || instruction.opcode == OP_mov_st) && instruction.dst == index && instruction.src != DR_REG_NULL) {
+            index = instruction.src;
+            continue;
+        }
+
+        if (instruction.opcode != OP_cmp || instruction.src != index || !instruction.hasImmediate || instruction.immediate < 0) {
+            continue;
+        }
+
+        for (size_t j = i + 1; j < load; j++) {
+            int opcode = window[j].opcode;
+            if (opcode == OP_jnbe || opcode == OP_jnbe_short || opcode == OP_jbe || opcode == OP_jbe_short) {
+                entryCount = instruction.immediate + 1;
+                break;
+            }
+            if (opcode == OP_jnb || opcode == OP_jnb_short || opcode == OP_jb || opcode == OP_jb_short) {
+                entryCount = instruction.immediate;
+                break;
+            }
+        }
+        break;
+    }
+
+    if (entryCount == 0 || entryCount > MAX_JUMP_TABLE_ENTRIES) {
+        return false;
+    }
+
+    size_t entrySize = isRelative ? sizeof(int32_t) : sizeof(uint64);
+    for (uint64 i = 0; i < entryCount; i++) {
+        uint64 entry = table + i * entrySize;
+        const byte *bytes = readAddress(elf, entry, entrySize);
+        if (bytes == nullptr) {
+            return false;
+        }
+
+        uint64 target;
+        if (isRelative) {
+            target = table + *(const int32_t *) bytes;
+        } else {
+            // Entries of position independent files are filled in by relocations
+            auto it = elf.pointers.find(entry);
+            target = it != elf.pointers.end() ? it->second : *(const uint64 *) bytes;
+        }
+
+        if (!isCode(elf, target)) {
+            return false;
+        }
+        site->targets.push_back(target);
+    }
+
+    std::sort(site->targets.begin(), site->targets.end());
+    site->targets.erase(std::unique(site->targets.begin(), site->targets.end()), site->targets.end());
+    site->table = table;
+    site->entryCount = (uint32) entryCount;
+    site->entrySize = (uint32) entrySize;
+
+    return true;
+}
+
+static void decodePiece(void *drcontext, const ElfFile &elf, const Range &piece, PieceResult *result)
+{
+    std::vector<Instruction> window;
+
+    instr_t instr;
+    instr_init(drcontext, &instr);
+
+    uint64 pc = piece.start;
+    while (pc < piece.end) {
+        byte *bytes = (byte *) readAddress(elf, pc, 1);
+        if (bytes == nullptr) {
+            break;
+        }
+
+        instr_reset(drcontext, &instr);
+        if (decode_from_copy(drcontext, bytes, (byte *) pc, &instr) == NULL || !instr_valid(&instr)) {
+            // Data or padding in the code
+            pc++;
+            continue;
+        }
+
+        uint64 next = pc + instr_length(drcontext, &instr);
+        result->instructions.push_back(pc);
+        window.push_back(describeInstruction(&instr, pc));
+
+        if (instr_is_call_direct(&instr)) {
+            result->returnSites.push_back(next);
+        } else if (instr_is_call_indirect(&instr) || instr_get_opcode(&instr) == OP_jmp_ind) {
+            Site site = {};
+            site.pc = pc;
+            site.isCall = instr_is_call_indirect(&instr);
+
+            opnd_t target = instr_get_target(&instr);
+            if (opnd_is_rel_addr(target) || opnd_is_abs_addr(target)) {
+                site.slot = (uint64) opnd_get_addr(target);
+            }
+
+            if (site.isCall) {
+                result->returnSites.push_back(next);
+            }
+
+            // A jump through a slot without a relocation may be an unbounded table, which is left out like any other
+            bool isKnownSlot = elf.slotSymbols.count(site.slot) != 0 || elf.pointers.count(site.slot) != 0;
+            if (site.isCall || isKnownSlot || matchJumpTable(elf, window, &site)) {
+                result->sites.push_back(site);
+            }
+        } else if (window.back().opcode == OP_lea && window.back().base == DR_REG_NULL && window.back().index == DR_REG_NULL &&
+                   isCode(elf, window.back().address)) {
+            result->codeReferences.push_back(window.back().address);
+        } else if (window.back().opcode == OP_mov_imm && window.back().hasImmediate && isCode(elf, window.back().immediate)) {
+            result->codeReferences.push_back(window.back().immediate);
+        }
+
+        pc = next;
+    }
+
+    instr_free(drcontext, &instr);
+}
+
+// Offsets of the targets of a site, empty if it may branch to any address-taken function
+static std::vector<uint64> getTargets(const ElfFile &elf, const Site &site)
+{
+    std::vector<uint64> targets;
+    if (!site.targets.empty()) {
+        for (uint64 target : site.targets) {
+            targets.push_back(target - elf.base);
+        }
+    } else if (site.slot != 0 && elf.slotSymbols.count(site.slot) == 0 && elf.pointers.count(site.slot) != 0) {
+        targets.push_back(elf.pointers.at(site.slot) - elf.base);
+    }
+
+    return targets;
+}
+
+static void writeText(FILE *file, const ElfFile &elf, const std::vector<Site> &sites, const std::set<uint64> &addressTaken,
+                        const std::set<uint64> &returnSites, const CfgFileModuleId *moduleId)
+{
+    for (const Site &site : sites) {
+        fprintf(file, "0x%lx ", (unsigned long) (site.pc - elf.base));
+
+        std::vector<uint64> targets = getTargets(elf, site);
+        if (site.slot != 0 && elf.slotSymbols.count(site.slot) != 0) {
+            fprintf(file, "S:%s\n", elf.slotSymbols.at(site.slot).c_str());
+        } else if (targets.empty()) {
+            fprintf(file, "L:0x%x", ADDRESS_TAKEN_LABEL);
+            for (const std::string &name : elf.importedFunctions) {
+                fprintf(file, ",S:%s", name.c_str());
+            }
+            fprintf(file, "\n");
+        } else {
+            for (size_t i = 0; i < targets.size(); i++) {
+                fprintf(file, "%sO:0x%lx", i == 0 ? "" : ",", (unsigned long) targets[i]);
+            }
+            fprintf(file, "\n");
+        }
+    }
+
+    for (uint64 target : addressTaken) {
+        fprintf(file, "@label 0x%lx 0x%x\n", (unsigned long) (target - elf.base), ADDRESS_TAKEN_LABEL);
+    }
+
+    for (uint64 returnSite : returnSites) {
+        fprintf(file, "@retsite 0x%lx\n", (unsigned long) (returnSite - elf.base));
+    }
+
+    for (const Site &site : sites) {
+        if (site.entryCount != 0) {
+            fprintf(file, "@jumptable 0x%lx 0x%lx 0x%x\n", (unsigned long) (site.pc - elf.base), (unsigned long) (site.table - elf.base),
+                    site.entryCount);
+        }
+    }
+
+    if (moduleId != nullptr) {
+        fprintf(file, "@module 0x%lx 0x%lx %s\n", (unsigned long) moduleId->textSize, (unsigned long) moduleId->textHash,
+                ModuleId::formatBuildId(moduleId->buildId, moduleId->buildIdSize).c_str());
+    }
+}
+
+static bool writeBinary(FILE *file, const ElfFile &elf, const std::vector<Site> &sites, const std::set<uint64> &addressTaken,
+                            const std::set<uint64> &returnSites, const CfgFileModuleId *moduleId)
+{
+    CfgBuilder builder;
+    for (const Site &site : sites) {
+        uint64 offset = site.pc - elf.base;
+        builder.addSite(offset);
+
+        std::vector<uint64> targets = getTargets(elf, site);
+        if (site.slot != 0 && elf.slotSymbols.count(site.slot) != 0) {
+            builder.addSymbolEdge(offset, elf.slotSymbols.at(site.slot), "");
+        } else if (targets.empty()) {
+            builder.setSiteLabel(offset, ADDRESS_TAKEN_LABEL);
+            for (const std::string &name : elf.importedFunctions) {
+                builder.addSymbolEdge(offset, name, "");
+            }
+        } else {
+            for (uint64 target : targets) {
+                builder.addOffsetEdge(offset, target);
+            }
+        }
+
+        if (site.entryCount != 0) {
+            builder.addJumpTable(offset, site.table - elf.base, site.entryCount);
+        }
+    }
+
+    for (uint64 target : addressTaken) {
+        builder.addTargetLabel(target - elf.base, ADDRESS_TAKEN_LABEL);
+    }
+
+    for (uint64 returnSite : returnSites) {
+        builder.addReturnSite(returnSite - elf.base);
+    }
+
+    if (moduleId != nullptr) {
+        builder.setModuleId(*moduleId);
+    }
+
+    size_t size;
+    void *data = builder.build(&size);
+    bool isWritten = fwrite(data, 1, size, file) == size;
+    CfgBuilder::freeImage(data, size);
+
+    return isWritten;
+}
+
+int main(int argc, char **argv)
+{
+    bool isBinary = false;
+    uint threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    const char *programFilename = NULL;
+    const char *outputFilename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-binary") == 0) {
+            isBinary = true;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threadCount = std::max(atoi(argv[++i]), 1);
+        } else if (programFilename == NULL) {
+            programFilename = argv[i];
+        } else if (outputFilename == NULL) {
+            outputFilename = argv[i];
+        }
+    }
+
+    if (programFilename == NULL || outputFilename == NULL) {
+        fprintf(stderr, "Usage: %s [-binary] [-threads <count>] <program> <output>\n", argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    ElfFile elf;
+    if (!loadElf(programFilename, &elf)) {
+        fprintf(stderr, "Not an x86-64 ELF file - %s\n", programFilename);
+        return 1;
+    }
+
+    // Recorded so the client refuses the CFG for any other build of the program
+    CfgFileModuleId moduleId;
+    ModuleId id(elf.data.data(), elf.data.size() - MAX_INSTRUCTION_LENGTH, false);
+    bool hasModuleId = id.getFileModuleId(&moduleId);
+
+    void *drcontext = dr_standalone_init();
+
+    std::vector<Range> pieces = getPieces(elf);
+    std::vector<PieceResult> results(pieces.size());
+    std::atomic<size_t> nextPiece(0);
+    std::vector<std::thread> threads;
+    for (uint i = 0; i < threadCount; i++) {
+        threads.emplace_back([&]() {
+            for (size_t j = nextPiece++; j < pieces.size(); j = nextPiece++) {
+                decodePiece(drcontext, elf, pieces[j], &results[j]);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::vector<uint64> instructions;
+    std::set<uint64> returnSites;
+    std::vector<uint64> references = elf.exportedFunctions;
+    std::vector<Site> sites;
+    for (auto &result : results) {
+        instructions.insert(instructions.end(), result.instructions.begin(), result.instructions.end());
+        returnSites.insert(result.returnSites.begin(), result.returnSites.end());
+        references.insert(references.end(), result.codeReferences.begin(), result.codeReferences.end());
+        sites.insert(sites.end(), result.sites.begin(), result.sites.end());
+    }
+
+    std::sort(instructions.begin(), instructions.end());
+    auto isInstruction = [&](uint64 address) {
+        return std::binary_search(instructions.begin(), instructions.end(), address);
+    };
+
+    // Cases must be instructions the sweep decoded, otherwise the table is not trusted and the site is left out
+    std::unordered_set<uint64> tableEntries;
+    for (size_t i = 0; i < sites.size();) {
+        Site &site = sites[i];
+        if (!site.targets.empty() && !std::all_of(site.targets.begin(), site.targets.end(), isInstruction)) {
+            sites.erase(sites.begin() + i);
+            continue;
+        }
+
+        for (uint32 j = 0; j < site.entryCount; j++) {
+            tableEntries.insert(site.table + j * site.entrySize);
+        }
+        i++;
+    }
+
+    // Pointers to code stored in data, relocated in position independent files and plain values otherwise
+    for (auto &it : elf.pointers) {
+        if (!isCode(elf, it.first)) {
+            references.push_back(it.second);
+        }
+    }
+    if (elf.header->e_type == ET_EXEC) {
+        for (const Elf64_Shdr &section : elf.sections) {
+            if ((section.sh_flags & SHF_ALLOC) == 0 || (section.sh_flags & SHF_EXECINSTR) != 0 || section.sh_type != SHT_PROGBITS) {
+                continue;
+            }
+
+            for (uint64 offset = 0; offset + sizeof(uint64) <= section.sh_size; offset += sizeof(uint64)) {
+                if (tableEntries.count(section.sh_addr + offset) == 0) {
+                    references.push_back(*(const uint64 *) &elf.data[section.sh_offset + offset]);
+                }
+            }
+        }
+    }
+
+    std::set<uint64> addressTaken;
+    for (uint64 reference : references) {
+        if (isCode(elf, reference) && isInstruction(reference)) {
+            addressTaken.insert(reference);
+        }
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const Site &a, const Site &b) { return a.pc < b.pc; });
+
+    FILE *file = fopen(outputFilename, isBinary ? "wb" : "w");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open output file - %s\n", outputFilename);
+        return 1;
+    }
+
+    bool isWritten = true;
+    if (isBinary) {
+        isWritten = writeBinary(file, elf, sites, addressTaken, returnSites, hasModuleId ? &moduleId : nullptr);
+    } else {
+        writeText(file, elf, sites, addressTaken, returnSites, hasModuleId ? &moduleId : nullptr);
+    }
+    isWritten = fclose(file) == 0 && isWritten;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%zu pieces, %zu instructions, %zu sites, %zu address-taken functions in %.1f ms on %u threads\n", pieces.size(),
+            instructions.size(), sites.size(), addressTaken.size(), elapsed.count(), threadCount);
+
+    dr_standalone_exit();
+
+    return isWritten ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+ * Compares memory per edge and lookup latency of the CSR CFG index
+ * (CfgBuilder + CfgImage) against the unordered_map of per-node
+ * unordered_sets used by the old CfgNode::hasOffsetEdge.
+ *
+ * Usage: cfgindex_bench [sites] [max edges per site]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dr_api.h"
+
+#include "cfgbuilder.h"
+#include "cfgimage.h"
+
+#define DEFAULT_SITES 100000
+#define DEFAULT_MAX_EDGES 64
+#define LOOKUPS 2000000
+
+static size_t allocatedBytes = 0;
+
+// Counts the bytes the baseline containers allocate, including buckets and nodes
+template <typename T>
+struct CountingAllocator {
+    typedef T value_type;
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        allocatedBytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        allocatedBytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> &) const { return false; }
+};
+
+typedef std::unordered_set<uint64, std::hash<uint64>, std::equal_to<uint64>, CountingAllocator<uint64>> EdgeSet;
+typedef std::unordered_map<uint64, EdgeSet *, std::hash<uint64>, std::equal_to<uint64>, CountingAllocator<std::pair<const uint64, EdgeSet *>>> NodeMap;
+
+typedef struct {
+    uint64 site;
+    uint64 target;
+} Query;
+
+int main(int argc, char **argv)
+{
+    size_t siteCount = DEFAULT_SITES;
+    size_t maxEdges = DEFAULT_MAX_EDGES;
+    if (argc >= 2) {
+        siteCount = strtoull(argv[1], NULL, 10);
+    }
+    if (argc >= 3) {
+        maxEdges = strtoull(argv[2], NULL, 10);
+    }
+
+    dr_standalone_init();
+
+    std::mt19937_64 random(5231);
+    // Most sites have a handful of targets, a few (switch tables) have many
+    std::geometric_distribution<size_t> edgeDistribution(0.25);
+
+    std::vector<std::vector<uint64>> sites(siteCount);
+    std::vector<uint64> siteOffsets(siteCount);
+    uint64 edgeCount = 0;
+    for (size_t i = 0; i < siteCount; i++) {
+        siteOffsets[i] = 0x1000 + i * 0x40 + (random() % 0x30);
+
+        size_t edges = 1 + std::min(edgeDistribution(random), maxEdges - 1);
+        for (size_t j = 0; j < edges; j++) {
+            sites[i].push_back(random() % 0x4000000);
+        }
+        edgeCount += edges;
+    }
+
+    std::vector<Query> queries(LOOKUPS);
+    for (auto &query : queries) {
+        size_t i = random() % siteCount;
+        query.site = siteOffsets[i];
+        query.target = (random() % 2) ? sites[i][random() % sites[i].size()] : random() % 0x4000000;
+    }
+
+    // Baseline
+    NodeMap *nodeMap = new NodeMap();
+    for (size_t i = 0; i < siteCount; i++) {
+        EdgeSet *edges = new EdgeSet();
+        allocatedBytes += sizeof(EdgeSet);
+        edges->insert(sites[i].begin(), sites[i].end());
+        (*nodeMap)[siteOffsets[i]] = edges;
+    }
+    size_t baselineBytes = allocatedBytes;
+
+    size_t baselineHits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &query : queries) {
+        auto it = nodeMap->find(query.site);
+        if (it != nodeMap->end() && it->second->find(query.target) != it->second->end()) {
+            baselineHits++;
+        }
+    }
+    std::chrono::duration<double, std::nano> baselineElapsed = std::chrono::steady_clock::now() - start;
+
+    // CSR index
+    CfgBuilder builder;
+    for (size_t i = 0; i < siteCount; i++) {
+        builder.addSite(siteOffsets[i]);
+        for (uint64 target : sites[i]) {
+            builder.addOffsetEdge(siteOffsets[i], target);
+        }
+    }
+    size_t imageSize;
+    void *imageData = builder.build(&imageSize);
+    CfgImage image(imageData, imageSize);
+    DR_ASSERT(image.isValid());
+
+    size_t indexHits = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto &query : queries) {
+        const CfgFileSite *site = image.findSite(query.site);
+        if (site != nullptr && image.hasOffsetEdge(site, query.target)) {
+            indexHits++;
+        }
+    }
+    std::chrono::duration<double, std::nano> indexElapsed = std::chrono::steady_clock::now() - start;
+
+    DR_ASSERT(baselineHits == indexHits);
+
+    printf("sites %zu, edges %lu, lookups %d\n", siteCount, (unsigned long) edgeCount, LOOKUPS);
+    printf("%-14s  %14s  %12s\n", "index", "bytes/edge", "ns/lookup");
+    printf("%-14s  %14.1f  %12.1f\n", "unordered_map", (double) baselineBytes / edgeCount, baselineElapsed.count() / LOOKUPS);
+    printf("%-14s  %14.1f  %12.1f\n", "csr", (double) imageSize / edgeCount, indexElapsed.count() / LOOKUPS);
+
+    for (auto &pair : *nodeMap) {
+        delete pair.second;
+    }
+    delete nodeMap;
+    CfgBuilder::freeImage(imageData, imageSize);
+
+    dr_standalone_exit();
+
+    return 0;
+}
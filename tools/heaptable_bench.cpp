@@ -0,0 +1,143 @@
+/*
+ * Compares the memory use and throughput of HeapTable against the std::list
+ * based heap tracking it replaced.
+ *
+ * Usage: heaptable_bench [max live allocations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include "dr_api.h"
+
+#include "heaptable.h"
+
+#define DEFAULT_MAX_LIVE 1000000
+// The list is O(n) per operation, stop measuring it past this size
+#define LIST_MAX_LIVE 20000
+
+// Approximate per-node cost of the old tracker: list node (prev, next, value), HeapNode object, and two malloc headers
+#define LIST_BYTES_PER_ALLOCATION (3 * sizeof(void *) + 2 * sizeof(void *) + 2 * 16)
+
+typedef struct {
+    void *address;
+    size_t size;
+} ListNode;
+
+static std::vector<void *> makeAddresses(size_t count)
+{
+    std::vector<void *> addresses;
+    addresses.reserve(count);
+
+    // Spread addresses like a real heap: 16-byte aligned, mostly increasing
+    std::mt19937_64 random(5231);
+    uint64 address = 0x555555560000ULL;
+    for (size_t i = 0; i < count; i++) {
+        address += 16 * (1 + (random() % 8));
+        addresses.push_back((void *) address);
+    }
+
+    std::shuffle(addresses.begin(), addresses.end(), random);
+
+    return addresses;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start, size_t operations)
+{
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / operations;
+}
+
+static void benchmarkTable(const std::vector<void *> &addresses)
+{
+    size_t count = addresses.size();
+    HeapTable *table = new HeapTable();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        table->insert(addresses[i], i);
+    }
+    double insertNs = elapsedNs(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        HeapRecord *record = table->find(addresses[count - i - 1]);
+        DR_ASSERT(record != nullptr);
+    }
+    double findNs = elapsedNs(start, count);
+
+    size_t memory = table->getMemoryUsage();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        bool isRemoved = table->remove(addresses[i]);
+        DR_ASSERT(isRemoved);
+    }
+    double removeNs = elapsedNs(start, count);
+    DR_ASSERT(table->getCount() == 0);
+
+    delete table;
+
+    printf("table  %8zu  %10.1f  %10.1f  %10.1f  %12.1f\n", count, insertNs, findNs, removeNs, (double) memory / count);
+}
+
+static void benchmarkList(const std::vector<void *> &addresses)
+{
+    size_t count = addresses.size();
+    std::list<ListNode *> list;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        list.push_back(new ListNode { addresses[i], i });
+    }
+    double insertNs = elapsedNs(start, count);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        auto it = std::find_if(list.begin(), list.end(), [&](ListNode *node) { return node->address == addresses[count - i - 1]; });
+        DR_ASSERT(it != list.end());
+    }
+    double findNs = elapsedNs(start, count);
+
+    // Same access pattern as the old removeNodeFromHeapList: find, then std::find and list::remove
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        auto it = std::find_if(list.begin(), list.end(), [&](ListNode *node) { return node->address == addresses[i]; });
+        ListNode *node = *it;
+        if (std::find(list.begin(), list.end(), node) != list.end()) {
+            list.remove(node);
+        }
+        delete node;
+    }
+    double removeNs = elapsedNs(start, count);
+
+    printf("list   %8zu  %10.1f  %10.1f  %10.1f  %12.1f\n", count, insertNs, findNs, removeNs, (double) LIST_BYTES_PER_ALLOCATION);
+}
+
+int main(int argc, char **argv)
+{
+    size_t maxLive = DEFAULT_MAX_LIVE;
+    if (argc == 2) {
+        maxLive = strtoull(argv[1], NULL, 10);
+    }
+
+    dr_standalone_init();
+
+    printf("kind   %8s  %10s  %10s  %10s  %12s\n", "live", "insert ns", "find ns", "remove ns", "bytes/alloc");
+    for (size_t count = 1000; count <= maxLive; count *= 10) {
+        std::vector<void *> addresses = makeAddresses(count);
+
+        benchmarkTable(addresses);
+        if (count <= LIST_MAX_LIVE) {
+            benchmarkList(addresses);
+        }
+    }
+
+    dr_standalone_exit();
+
+    return 0;
+}
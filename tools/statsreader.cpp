@@ -0,0 +1,146 @@
+/*
+ * Polls the live statistics segment of a process running under the detector
+ * with -stats, and prints the counters summed over all threads and the
+ * latency percentiles of each timer.
+ *
+ * Usage: statsreader <pid> [interval ms]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+#include "dr_api.h"
+
+#include "statsformat.h"
+
+#define DEFAULT_INTERVAL_MS 1000
+
+static void sumSlots(const StatsSlot *slots, uint32 slotCount, ThreadStats *totals, uint32 *threadCountPtr)
+{
+    memset(totals, 0, sizeof(ThreadStats));
+    *threadCountPtr = 0;
+
+    for (uint32 i = 0; i < slotCount; i++) {
+        const StatsSlot *slot = &slots[i];
+        if (!slot->inUse) {
+            continue;
+        }
+
+        if (i != STATS_RETIRED_SLOT) {
+            (*threadCountPtr)++;
+        }
+
+        for (uint32 j = 0; j < STAT_COUNTER_COUNT; j++) {
+            totals->counters[j] += slot->stats.counters[j];
+        }
+
+        for (uint32 j = 0; j < STAT_TIMER_COUNT; j++) {
+            for (uint32 k = 0; k < STATS_HISTOGRAM_BUCKETS; k++) {
+                totals->histograms[j][k] += slot->stats.histograms[j][k];
+            }
+        }
+    }
+}
+
+// Upper bound in cycles of the bucket holding the given fraction of samples
+static uint64 percentile(const uint64 *histogram, uint64 count, double fraction)
+{
+    uint64 rank = (uint64) (count * fraction);
+    uint64 seen = 0;
+    for (uint32 i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > rank) {
+            return 2ULL << i;
+        }
+    }
+
+    return 2ULL << (STATS_HISTOGRAM_BUCKETS - 1);
+}
+
+static void printStats(const ThreadStats *totals, uint32 threadCount)
+{
+    printf("threads: %u\n", threadCount);
+    for (uint32 i = 0; i < STAT_COUNTER_COUNT; i++) {
+        printf("  %-24s %llu\n", STAT_COUNTER_NAMES[i], (unsigned long long) totals->counters[i]);
+    }
+
+    for (uint32 i = 0; i < STAT_TIMER_COUNT; i++) {
+        uint64 count = 0;
+        for (uint32 j = 0; j < STATS_HISTOGRAM_BUCKETS; j++) {
+            count += totals->histograms[i][j];
+        }
+
+        if (count == 0) {
+            printf("  %-24s no samples\n", STAT_TIMER_NAMES[i]);
+            continue;
+        }
+
+        printf("  %-24s n=%llu p50<%llu p90<%llu p99<%llu cycles\n", STAT_TIMER_NAMES[i], (unsigned long long) count,
+                (unsigned long long) percentile(totals->histograms[i], count, 0.5),
+                (unsigned long long) percentile(totals->histograms[i], count, 0.9),
+                (unsigned long long) percentile(totals->histograms[i], count, 0.99));
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <pid> [interval ms]\n", argv[0]);
+        return 1;
+    }
+
+    std::string path = std::string(STATS_FILE_PREFIX) + argv[1];
+    int intervalMs = argc > 2 ? atoi(argv[2]) : DEFAULT_INTERVAL_MS;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s\n", path.c_str());
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(StatsFileHeader)) {
+        fprintf(stderr, "Invalid statistics segment %s\n", path.c_str());
+        return 1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", path.c_str());
+        return 1;
+    }
+
+    const StatsFileHeader *header = (const StatsFileHeader *) map;
+    if (memcmp(header->magic, STATS_FILE_MAGIC, STATS_FILE_MAGIC_SIZE) != 0 || header->version != STATS_FILE_VERSION ||
+        header->counterCount != STAT_COUNTER_COUNT || header->timerCount != STAT_TIMER_COUNT ||
+        header->histogramBuckets != STATS_HISTOGRAM_BUCKETS ||
+        sizeof(StatsFileHeader) + header->slotCount * sizeof(StatsSlot) > (size_t) st.st_size) {
+        fprintf(stderr, "Incompatible statistics segment %s\n", path.c_str());
+        return 1;
+    }
+
+    const StatsSlot *slots = (const StatsSlot *) ((const char *) map + sizeof(StatsFileHeader));
+
+    // The client deletes the segment at exit, the mapping stays readable until then
+    while (access(path.c_str(), F_OK) == 0) {
+        ThreadStats totals;
+        uint32 threadCount;
+        sumSlots(slots, header->slotCount, &totals, &threadCount);
+        printStats(&totals, threadCount);
+
+        usleep(intervalMs * 1000);
+    }
+
+    munmap(map, st.st_size);
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Adds symbols to the report of a process run under the detector with
+ * -offline. Each "0x<address> <module>:0x<offset>" (see reportformat.h) is
+ * looked up with drsyms in the file of its module, found in the module map
+ * that follows the report, so debug info is only loaded here and never in the
+ * reporting process. Modules whose file now has another build-id than the one
+ * in the map are left as they are.
+ *
+ * Usage: symbolize [-sysroot <dir>] [report file]
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dr_api.h"
+#include "drsyms.h"
+
+#include "moduleid.h"
+#include "reportformat.h"
+
+#define MAX_SYMBOL_NAME 256
+
+typedef enum {
+    MODULE_UNCHECKED,
+    MODULE_USABLE,
+    MODULE_STALE
+} ModuleState;
+
+typedef struct {
+    uint64 start;
+    uint64 end;
+    std::string buildId;
+    std::string path;
+} Module;
+
+typedef struct {
+    // Index of the header line, the map describes the reports before it
+    size_t line;
+    std::vector<Module> modules;
+} ModuleMap;
+
+static std::string sysroot;
+// File path -> whether its build-id matches the map
+static std::unordered_map<std::string, ModuleState> moduleStates;
+
+static bool readLines(FILE *file, std::vector<std::string> *lines)
+{
+    std::string line;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '\n') {
+            lines->push_back(line);
+            line.clear();
+        } else {
+            line.push_back((char) c);
+        }
+    }
+
+    if (!line.empty()) {
+        lines->push_back(line);
+    }
+
+    return ferror(file) == 0;
+}
+
+static std::vector<ModuleMap> readModuleMaps(const std::vector<std::string> &lines)
+{
+    std::vector<ModuleMap> maps;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i] != REPORT_MODULE_MAP_HEADER) {
+            continue;
+        }
+
+        ModuleMap map;
+        map.line = i;
+        for (size_t j = i + 1; j < lines.size(); j++) {
+            unsigned long long start;
+            unsigned long long end;
+            int pathStart = 0;
+            char buildId[CFG_BUILD_ID_MAX_SIZE * 2 + 1];
+            if (sscanf(lines[j].c_str(), "%llx-%llx %128s %n", &start, &end, buildId, &pathStart) != 3 || pathStart == 0) {
+                break;
+            }
+
+            map.modules.push_back({ start, end, buildId, lines[j].substr(pathStart) });
+        }
+
+        maps.push_back(map);
+    }
+
+    return maps;
+}
+
+// Check once per file that it is the build the report was made with
+static bool isModuleUsable(const Module &module)
+{
+    std::string filename = sysroot + module.path;
+    ModuleState &state = moduleStates[filename];
+    if (state != MODULE_UNCHECKED) {
+        return state == MODULE_USABLE;
+    }
+
+    state = MODULE_STALE;
+
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open module, not symbolized - %s\n", filename.c_str());
+        return false;
+    }
+
+    std::vector<byte> data;
+    byte buffer[1 << 16];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+    fclose(file);
+
+    if (module.buildId != REPORT_NO_BUILD_ID) {
+        ModuleId moduleId(data.data(), data.size(), false);
+        if (moduleId.getBuildIdString() != module.buildId) {
+            fprintf(stderr, "Module has another build-id than the report, not symbolized - %s\n", filename.c_str());
+            return false;
+        }
+    }
+
+    state = MODULE_USABLE;
+
+    return true;
+}
+
+static const Module *findModule(const ModuleMap &map, uint64 address)
+{
+    for (const Module &module : map.modules) {
+        if (module.start <= address && address < module.end) {
+            return &module;
+        }
+    }
+
+    return nullptr;
+}
+
+static std::string getSymbolSuffix(const Module &module, uint64 offset)
+{
+    char name[MAX_SYMBOL_NAME];
+    char file[MAXIMUM_PATH];
+
+    drsym_info_t sym;
+    sym.struct_size = sizeof(sym);
+    sym.name = name;
+    sym.name_size = MAX_SYMBOL_NAME;
+    sym.file = file;
+    sym.file_size = MAXIMUM_PATH;
+
+    std::string filename = sysroot + module.path;
+    drsym_error_t symres = drsym_lookup_address(filename.c_str(), offset, &sym, DRSYM_DEFAULT_FLAGS);
+    if (symres != DRSYM_SUCCESS && symres != DRSYM_ERROR_LINE_NOT_AVAILABLE) {
+        return "";
+    }
+
+    char suffix[MAX_SYMBOL_NAME + 32];
+    snprintf(suffix, sizeof(suffix), "!%s+0x%llx", name, (unsigned long long) (offset - sym.start_offs));
+
+    return suffix;
+}
+
+// Append the symbol to every "0x<address> <module>:0x<offset>" of a line, the same way the client does online
+static std::string symbolizeLine(const std::string &line, const ModuleMap &map)
+{
+    std::string res;
+    size_t position = 0;
+    while (position < line.size()) {
+        size_t start = line.find("0x", position);
+        if (start == std::string::npos) {
+            break;
+        }
+
+        // Module offsets and hex within words are not addresses
+        if (start > 0 && (isalnum((unsigned char) line[start - 1]) || line[start - 1] == ':')) {
+            res.append(line, position, start + 2 - position);
+            position = start + 2;
+            continue;
+        }
+
+        char *end;
+        uint64 address = strtoull(line.c_str() + start + 2, &end, 16);
+        size_t addressEnd = end - line.c_str();
+        size_t tokenEnd = line.find_first_of(" \t,", addressEnd + 1);
+        if (tokenEnd == std::string::npos) {
+            tokenEnd = line.size();
+        }
+
+        // Addresses outside of modules and already symbolized ones are kept
+        std::string token = addressEnd < line.size() && line[addressEnd] == ' ' ? line.substr(addressEnd + 1, tokenEnd - addressEnd - 1) : "";
+        size_t separator = token.rfind(":0x");
+        const Module *module = findModule(map, address);
+        if (addressEnd == start + 2 || separator == std::string::npos || token.find('!') != std::string::npos || module == nullptr ||
+            !isModuleUsable(*module)) {
+            res.append(line, position, addressEnd - position);
+            position = addressEnd;
+            continue;
+        }
+
+        res.append(line, position, tokenEnd - position);
+        res.append(getSymbolSuffix(*module, address - module->start));
+        position = tokenEnd;
+    }
+
+    res.append(line, position, std::string::npos);
+
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    const char *reportFilename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-sysroot") == 0 && i + 1 < argc) {
+            sysroot = argv[++i];
+        } else if (argv[i][0] != '-' && reportFilename == NULL) {
+            reportFilename = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-sysroot <dir>] [report file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *file = reportFilename != NULL ? fopen(reportFilename, "r") : stdin;
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open report - %s\n", reportFilename);
+        return 1;
+    }
+
+    std::vector<std::string> lines;
+    bool isRead = readLines(file, &lines);
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!isRead) {
+        fprintf(stderr, "Unable to read report\n");
+        return 1;
+    }
+
+    std::vector<ModuleMap> maps = readModuleMaps(lines);
+    if (maps.empty()) {
+        fprintf(stderr, "No module map in the report, was it made with -offline?\n");
+    }
+
+    dr_standalone_init();
+    if (drsym_init(0) != DRSYM_SUCCESS) {
+        fprintf(stderr, "Unable to initialize symbol translation\n");
+        return 1;
+    }
+
+    std::vector<bool> isMapLine(lines.size(), false);
+    for (const ModuleMap &map : maps) {
+        for (size_t i = map.line; i <= map.line + map.modules.size(); i++) {
+            isMapLine[i] = true;
+        }
+    }
+
+    // Each report is followed by its own map, lines after the last map use the last one
+    size_t mapIndex = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (maps.empty() || isMapLine[i]) {
+            printf("%s\n", lines[i].c_str());
+            continue;
+        }
+
+        while (mapIndex + 1 < maps.size() && maps[mapIndex].line < i) {
+            mapIndex++;
+        }
+
+        printf("%s\n", symbolizeLine(lines[i], maps[mapIndex]).c_str());
+    }
+
+    drsym_exit();
+    dr_standalone_exit();
+
+    return 0;
+}